@@ -0,0 +1,669 @@
+#define _GNU_SOURCE
+#include "checkpoint.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <asm/prctl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// Real-time signal used to park the guest while a checkpoint is taken
+#define CKPT_SIGNAL (SIGRTMAX - 2)
+
+#define CKPT_MAX_RANGES 4096
+#define CKPT_MAX_FIXED 64
+#define CKPT_MAPS_BUF_SIZE (4UL << 20)
+#define CKPT_STOP_TIMEOUT_MS 1000
+#define CKPT_THREAD_STACK_SIZE (256UL << 10)
+#define CKPT_XSTATE_MAX (16UL << 10)
+
+// Pages are copied out while the guest is stopped and written once it runs
+// again. These areas are reserved up front (so they count as the pager's own
+// mappings) and only take memory while a checkpoint is in flight.
+#define CKPT_DATA_AREA (16UL << 30)
+#define CKPT_INDEX_AREA (1UL << 30)
+
+// pagemap entry bits, see Documentation/admin-guide/mm/pagemap.rst
+#define PM_PRESENT (1ULL << 63)
+#define PM_SWAPPED (1ULL << 62)
+#define PM_UFFD_WP (1ULL << 57)
+#define PM_SOFT_DIRTY (1ULL << 55)
+
+// How writes are tracked between checkpoints
+#define TRACK_NONE 0        // every checkpoint is a full image
+#define TRACK_SOFT_DIRTY 1  // dirty: soft-dirty bit set since clear_refs
+#define TRACK_UFFD_WP 2     // dirty: present but no longer write-protected
+
+// Software-reserved bytes at the end of the legacy FXSAVE area. When magic1
+// matches, the signal frame carries a full XSAVE area of extended_size bytes.
+#define FP_XSTATE_MAGIC1 0x46505853U
+#define FP_SW_BYTES_OFFSET 464
+
+typedef struct {
+    uint32_t magic1;
+    uint32_t extended_size;
+    uint64_t xfeatures;
+    uint32_t xstate_size;
+} fp_sw_bytes_t;
+
+// Guest stop handshake between the checkpoint thread and the signal handler
+#define STOP_IDLE 0
+#define STOP_REQUESTED 1
+#define STOP_CAPTURING 2
+#define STOP_STOPPED 3
+#define STOP_RESUME 4
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    int prot;
+    int uffd_mode;
+} range_t;
+
+static range_t fixed[CKPT_MAX_FIXED];
+static int nfixed;
+static range_t pager_maps[CKPT_MAX_RANGES];
+static int npager_maps;
+static range_t guest[CKPT_MAX_RANGES];
+static int nguest;
+
+static int tracking = TRACK_NONE;
+static int uffd = -1;
+static int own_uffd;
+static int out_fd = -1;
+static int pagemap_fd = -1;
+static int clear_refs_fd = -1;
+static unsigned interval;
+static pid_t guest_tid;
+static size_t page_size;
+static uint64_t epoch;
+static off_t file_offset;
+
+static char *maps_buf;
+static char *data;
+static ckpt_index_t *page_index;
+static size_t max_pages;
+
+static int attached;
+static int stop_state = STOP_IDLE;
+static ckpt_header_t captured;  // registers, filled in by the signal handler
+static char captured_xstate[CKPT_XSTATE_MAX] __attribute__((aligned(64)));
+static size_t captured_xstate_size;
+
+static const char *tracking_names[] = {"full images only", "soft-dirty", "userfaultfd write-protect"};
+
+int checkpoint_add_range(uintptr_t start, size_t len, int prot, int uffd_mode) {
+    for (int f = 0; f < nfixed; f++) {
+        if (fixed[f].start == start && fixed[f].end == start + len) {
+            return 0;
+        }
+    }
+    if (nfixed == CKPT_MAX_FIXED) {
+        fprintf(stderr, "Too many checkpoint ranges\n");
+        return 1;
+    }
+    fixed[nfixed].start = start;
+    fixed[nfixed].end = start + len;
+    fixed[nfixed].prot = prot;
+    fixed[nfixed].uffd_mode = uffd_mode;
+    nfixed++;
+    return 0;
+}
+
+static uint64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Writes a message to stdout without stdio, which the guest thread may be in.
+static void report(const char *fmt, ...) {
+    char msg[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    write(STDOUT_FILENO, msg, len < sizeof(msg) ? len : sizeof(msg) - 1);
+}
+
+// Reads /proc/self/maps into `out`, skipping the kernel's special mappings.
+// Returns the number of entries, or -1.
+static int read_maps(range_t *out, int max) {
+    int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    size_t len = 0;
+    ssize_t n;
+    while (len < CKPT_MAPS_BUF_SIZE - 1 && (n = read(fd, maps_buf + len, CKPT_MAPS_BUF_SIZE - 1 - len)) > 0) {
+        len += n;
+    }
+    close(fd);
+    maps_buf[len] = '\0';
+
+    int count = 0;
+    for (char *line = maps_buf; *line != '\0' && count < max;) {
+        char *eol = strchr(line, '\n');
+        if (eol != NULL) {
+            *eol = '\0';
+        }
+
+        char *p = line;
+        uintptr_t start = strtoul(p, &p, 16);
+        uintptr_t end = strtoul(p + 1, &p, 16);
+        char *perms = p + 1;
+        char *path = strchr(perms, '/');
+        char *special = strchr(perms, '[');
+        if (special != NULL && (path == NULL || special < path)) {
+            path = special;
+        }
+
+        if (path == NULL || path[0] != '[' || strcmp(path, "[heap]") == 0) {
+            out[count].start = start;
+            out[count].end = end;
+            out[count].prot = (perms[0] == 'r' ? PROT_READ : 0) | (perms[1] == 'w' ? PROT_WRITE : 0) |
+                              (perms[2] == 'x' ? PROT_EXEC : 0);
+            out[count].uffd_mode = 0;
+            count++;
+        }
+        if (eol == NULL) {
+            break;
+        }
+        line = eol + 1;
+    }
+    return count;
+}
+
+static void add_guest_range(uintptr_t start, uintptr_t end, int prot, int uffd_mode) {
+    if (nguest < CKPT_MAX_RANGES && start < end) {
+        guest[nguest].start = start;
+        guest[nguest].end = end;
+        guest[nguest].prot = prot;
+        guest[nguest].uffd_mode = uffd_mode;
+        nguest++;
+    }
+}
+
+/**
+ * Works out which mappings belong to the guest: the pager-managed ranges, and
+ * whatever did not exist yet when checkpointing started. That includes the
+ * part of the brk heap the guest grew past the pager's own allocations.
+ *
+ * The pager's own memory must stay out of this: with write-protection, a
+ * pager thread writing to it would wait on a fault only it can resolve.
+ */
+static int collect_guest_ranges() {
+    static range_t current[CKPT_MAX_RANGES];
+    int count = read_maps(current, CKPT_MAX_RANGES);
+    if (count < 0) {
+        return -1;
+    }
+
+    nguest = 0;
+    for (int i = 0; i < count; i++) {
+        range_t *r = &current[i];
+        int owner = -1;
+        for (int f = 0; f < nfixed; f++) {
+            if (r->start >= fixed[f].start && r->end <= fixed[f].end) {
+                owner = f;
+            }
+        }
+        if (owner >= 0) {
+            add_guest_range(r->start, r->end, r->prot, fixed[owner].uffd_mode);
+            continue;
+        }
+
+        // Whatever the pager's own mappings do not cover is the guest's
+        uintptr_t cur = r->start;
+        for (int p = 0; p < npager_maps && cur < r->end; p++) {
+            if (pager_maps[p].end <= cur || pager_maps[p].start >= r->end) {
+                continue;
+            }
+            if (pager_maps[p].start > cur) {
+                add_guest_range(cur, pager_maps[p].start, r->prot, 0);
+            }
+            cur = pager_maps[p].end;
+        }
+        if (cur < r->end) {
+            add_guest_range(cur, r->end, r->prot, 0);
+        }
+    }
+    return 0;
+}
+
+int checkpoint_guest_ranges(ckpt_range_t *out, int max) {
+    if (collect_guest_ranges() != 0) {
+        return -1;
+    }
+
+    int count = 0;
+    for (int f = 0; f < nfixed && count < max; f++) {
+        out[count].start = fixed[f].start;
+        out[count].end = fixed[f].end;
+        out[count].prot = fixed[f].prot;
+        count++;
+    }
+    for (int r = 0; r < nguest && count < max; r++) {
+        int managed = 0;
+        for (int f = 0; f < nfixed; f++) {
+            managed |= guest[r].start >= fixed[f].start && guest[r].end <= fixed[f].end;
+        }
+        if (!managed) {
+            out[count].start = guest[r].start;
+            out[count].end = guest[r].end;
+            out[count].prot = guest[r].prot;
+            count++;
+        }
+    }
+    return count;
+}
+
+static int is_dirty(uint64_t entry) {
+    if (!(entry & (PM_PRESENT | PM_SWAPPED))) {
+        return 0;
+    }
+    switch (tracking) {
+    case TRACK_SOFT_DIRTY:
+        return (entry & PM_SOFT_DIRTY) != 0;
+    case TRACK_UFFD_WP:
+        return (entry & PM_UFFD_WP) == 0;
+    default:
+        return 1;
+    }
+}
+
+/**
+ * Fills page_index with the guest pages to save: every present page for a full
+ * image, otherwise the ones written since the last checkpoint. Only readable
+ * ranges are considered; PROT_NONE pages have not been installed yet.
+ */
+static size_t collect_pages(int full) {
+    uint64_t entries[512];
+    size_t npages = 0;
+
+    for (int r = 0; r < nguest; r++) {
+        if (!(guest[r].prot & PROT_READ)) {
+            continue;
+        }
+        for (uintptr_t addr = guest[r].start; addr < guest[r].end;) {
+            size_t chunk = (guest[r].end - addr) / page_size;
+            if (chunk > 512) {
+                chunk = 512;
+            }
+            ssize_t n = pread(pagemap_fd, entries, chunk * sizeof(uint64_t), addr / page_size * sizeof(uint64_t));
+            if (n <= 0) {
+                break;
+            }
+            for (size_t i = 0; i < n / sizeof(uint64_t) && npages < max_pages; i++) {
+                if (full ? (entries[i] & (PM_PRESENT | PM_SWAPPED)) != 0 : is_dirty(entries[i])) {
+                    page_index[npages++].vaddr = addr + i * page_size;
+                }
+            }
+            addr += (n / sizeof(uint64_t)) * page_size;
+        }
+    }
+    return npages;
+}
+
+// Re-arms write tracking for the next checkpoint.
+static void rearm_tracking() {
+    if (tracking == TRACK_SOFT_DIRTY) {
+        pwrite(clear_refs_fd, "4", 1, 0);
+        return;
+    }
+    if (tracking != TRACK_UFFD_WP) {
+        return;
+    }
+    for (int r = 0; r < nguest; r++) {
+        struct uffdio_register reg = {
+            .range = { .start = guest[r].start, .len = guest[r].end - guest[r].start },
+            .mode = UFFDIO_REGISTER_MODE_WP | guest[r].uffd_mode,
+        };
+        // Ranges that cannot be registered stay unprotected and are saved every time
+        if (ioctl(uffd, UFFDIO_REGISTER, &reg) == -1) {
+            continue;
+        }
+        struct uffdio_writeprotect wp = {
+            .range = reg.range,
+            .mode = UFFDIO_WRITEPROTECT_MODE_WP,
+        };
+        ioctl(uffd, UFFDIO_WRITEPROTECT, &wp);
+    }
+}
+
+void checkpoint_write_fault(uintptr_t page) {
+    struct uffdio_writeprotect wp = {
+        .range = { .start = page & ~(page_size - 1), .len = page_size },
+        .mode = 0,
+    };
+    ioctl(uffd, UFFDIO_WRITEPROTECT, &wp);
+}
+
+// Lets writes through on our own userfaultfd, waiting up to `timeout_ms`.
+static void service_write_faults(int timeout_ms) {
+    if (!own_uffd) {
+        poll(NULL, 0, timeout_ms);
+        return;
+    }
+
+    struct pollfd pfd = { .fd = uffd, .events = POLLIN };
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+        return;
+    }
+    struct uffd_msg msgs[16];
+    ssize_t n = read(uffd, msgs, sizeof(msgs));
+    for (ssize_t i = 0; i < n / (ssize_t)sizeof(struct uffd_msg); i++) {
+        if (msgs[i].event == UFFD_EVENT_PAGEFAULT && (msgs[i].arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP)) {
+            checkpoint_write_fault(msgs[i].arg.pagefault.address);
+        }
+    }
+}
+
+/**
+ * Runs on the guest's thread. Saves the guest's registers and parks it until
+ * the checkpoint thread has copied out everything it needs. Only touches
+ * pager memory (it runs on the alternate signal stack) and makes no calls
+ * that can fail, because errno here would land in the guest's TLS.
+ */
+static void checkpoint_signal_handler(int sig, siginfo_t *info, void *ucontext) {
+    int expected = STOP_REQUESTED;
+    if (!__atomic_compare_exchange_n(&stop_state, &expected, STOP_CAPTURING, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // A stale signal for a checkpoint that already gave up waiting
+        return;
+    }
+
+    ucontext_t *uc = (ucontext_t *)ucontext;
+    for (int i = 0; i < __NGREG; i++) {
+        captured.gregs[i] = uc->uc_mcontext.gregs[i];
+    }
+    captured_xstate_size = 0;
+    if (uc->uc_mcontext.fpregs != NULL) {
+        captured.fpregs = *uc->uc_mcontext.fpregs;
+        fp_sw_bytes_t *sw = (fp_sw_bytes_t *)((char *)uc->uc_mcontext.fpregs + FP_SW_BYTES_OFFSET);
+        size_t size = sw->magic1 == FP_XSTATE_MAGIC1 ? sw->extended_size : sizeof(captured.fpregs);
+        if (size <= CKPT_XSTATE_MAX) {
+            memcpy(captured_xstate, uc->uc_mcontext.fpregs, size);
+            captured_xstate_size = size;
+        }
+    }
+    syscall(SYS_arch_prctl, ARCH_GET_FS, &captured.fs_base);
+
+    // Checkpoints hold the guest for milliseconds, a migrated guest for good
+    struct timespec nap = { 0, 100000 };
+    __atomic_store_n(&stop_state, STOP_STOPPED, __ATOMIC_RELEASE);
+    for (int spins = 0; __atomic_load_n(&stop_state, __ATOMIC_ACQUIRE) != STOP_RESUME; spins++) {
+        if (spins < 1000) {
+            sched_yield();
+        } else {
+            nanosleep(&nap, NULL);
+        }
+    }
+    __atomic_store_n(&stop_state, STOP_IDLE, __ATOMIC_RELEASE);
+}
+
+// Parks the guest in checkpoint_signal_handler. Returns -1 if it did not stop in time.
+static int stop_guest() {
+    int idle = STOP_IDLE;
+    while (!__atomic_compare_exchange_n(&stop_state, &idle, STOP_REQUESTED, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // Someone else holds the guest
+        idle = STOP_IDLE;
+        service_write_faults(1);
+    }
+    syscall(SYS_tgkill, getpid(), guest_tid, CKPT_SIGNAL);
+
+    uint64_t deadline = now_ns(CLOCK_MONOTONIC) + CKPT_STOP_TIMEOUT_MS * 1000000ULL;
+    while (__atomic_load_n(&stop_state, __ATOMIC_ACQUIRE) != STOP_STOPPED) {
+        if (now_ns(CLOCK_MONOTONIC) > deadline) {
+            int expected = STOP_REQUESTED;
+            if (__atomic_compare_exchange_n(&stop_state, &expected, STOP_IDLE, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return -1;
+            }
+        }
+        // The guest may be blocked on a write fault that only we can resolve
+        service_write_faults(1);
+    }
+    return 0;
+}
+
+static void resume_guest() {
+    __atomic_store_n(&stop_state, STOP_RESUME, __ATOMIC_RELEASE);
+}
+
+int checkpoint_stop_guest(ckpt_header_t *regs) {
+    if (stop_guest() != 0) {
+        return -1;
+    }
+    *regs = captured;
+    regs->timestamp_ns = now_ns(CLOCK_REALTIME);
+    return 0;
+}
+
+void checkpoint_resume_guest() {
+    resume_guest();
+}
+
+size_t checkpoint_guest_xstate(const void **area) {
+    *area = captured_xstate;
+    return captured_xstate_size;
+}
+
+static void take_checkpoint() {
+    uint64_t stop_begin = now_ns(CLOCK_MONOTONIC);
+    if (stop_guest() != 0) {
+        report("Checkpoint skipped: guest did not stop within %d ms\n", CKPT_STOP_TIMEOUT_MS);
+        return;
+    }
+
+    int full = epoch == 0 || tracking == TRACK_NONE;
+    ckpt_header_t header = captured;
+    memcpy(header.magic, CKPT_RECORD_MAGIC, sizeof(header.magic));
+    header.kind = full ? CKPT_FULL : CKPT_INCREMENTAL;
+    header.epoch = epoch;
+    header.timestamp_ns = now_ns(CLOCK_REALTIME);
+
+    size_t npages = 0;
+    if (collect_guest_ranges() == 0) {
+        npages = collect_pages(full);
+    }
+
+    // Copy what fits in the staging area now; anything beyond it is written
+    // straight from guest memory before the guest resumes.
+    size_t meta = sizeof(header) + nguest * sizeof(ckpt_range_t) + npages * sizeof(ckpt_index_t);
+    off_t data_offset = (file_offset + meta + page_size - 1) & ~(page_size - 1);
+    size_t staged = npages < CKPT_DATA_AREA / page_size ? npages : CKPT_DATA_AREA / page_size;
+    for (size_t i = 0; i < npages; i++) {
+        page_index[i].offset = data_offset + i * page_size;
+        if (i < staged) {
+            memcpy(data + i * page_size, (void *)page_index[i].vaddr, page_size);
+        } else {
+            pwrite(out_fd, (void *)page_index[i].vaddr, page_size, page_index[i].offset);
+        }
+    }
+    rearm_tracking();
+    resume_guest();
+    uint64_t stopped = now_ns(CLOCK_MONOTONIC) - stop_begin;
+
+    header.stopped_ns = stopped;
+    header.nranges = nguest;
+    header.npages = npages;
+    header.record_size = data_offset + npages * page_size - file_offset;
+
+    off_t off = file_offset;
+    pwrite(out_fd, &header, sizeof(header), off);
+    off += sizeof(header);
+    for (int r = 0; r < nguest; r++) {
+        ckpt_range_t range = { guest[r].start, guest[r].end, guest[r].prot };
+        pwrite(out_fd, &range, sizeof(range), off);
+        off += sizeof(range);
+    }
+    pwrite(out_fd, page_index, npages * sizeof(ckpt_index_t), off);
+    if (staged > 0 && pwrite(out_fd, data, staged * page_size, data_offset) != staged * page_size) {
+        report("Checkpoint %lu: failed to write page data\n", epoch);
+    }
+    file_offset += header.record_size;
+
+    // Give the staging memory back until the next checkpoint
+    madvise(data, staged * page_size, MADV_DONTNEED);
+
+    report("Checkpoint %lu (%s): %zu pages in %d ranges, guest stopped %.3f ms\n", epoch,
+           full ? "full" : "incremental", npages, nguest, stopped / 1e6);
+    epoch++;
+}
+
+static void *checkpoint_thread(void *arg) {
+    uint64_t next = now_ns(CLOCK_MONOTONIC) + interval * 1000000ULL;
+    for (;;) {
+        uint64_t now = now_ns(CLOCK_MONOTONIC);
+        if (now < next) {
+            service_write_faults((next - now) / 1000000 + 1);
+            continue;
+        }
+        take_checkpoint();
+        next += interval * 1000000ULL;
+        if (next < now_ns(CLOCK_MONOTONIC)) {
+            next = now_ns(CLOCK_MONOTONIC) + interval * 1000000ULL;
+        }
+    }
+    return NULL;
+}
+
+// Checks whether writes actually set the soft-dirty bit (CONFIG_MEM_SOFT_DIRTY).
+static int soft_dirty_works() {
+    volatile char *probe = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (probe == MAP_FAILED) {
+        return 0;
+    }
+    uint64_t entry = 0;
+    probe[0] = 1;
+    if (pwrite(clear_refs_fd, "4", 1, 0) == 1) {
+        probe[0] = 2;
+        pread(pagemap_fd, &entry, sizeof(entry), (uintptr_t)probe / page_size * sizeof(uint64_t));
+    }
+    munmap((void *)probe, page_size);
+    return (entry & PM_SOFT_DIRTY) != 0;
+}
+
+static int open_wp_uffd() {
+    int fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) {
+        return -1;
+    }
+    struct uffdio_api api = { .api = UFFD_API, .features = CKPT_UFFD_FEATURES };
+    if (ioctl(fd, UFFDIO_API, &api) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void *thread_stack;
+
+int checkpoint_attach(int pager_uffd) {
+    if (attached) {
+        return 0;
+    }
+    page_size = sysconf(_SC_PAGE_SIZE);
+    guest_tid = gettid();
+
+    pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (pagemap_fd < 0) {
+        perror("Failed to open /proc/self/pagemap");
+        return 1;
+    }
+
+    if (clear_refs_fd >= 0 && soft_dirty_works()) {
+        tracking = TRACK_SOFT_DIRTY;
+    } else if (pager_uffd >= 0) {
+        uffd = pager_uffd;
+        tracking = TRACK_UFFD_WP;
+    } else if ((uffd = open_wp_uffd()) >= 0) {
+        own_uffd = 1;
+        tracking = TRACK_UFFD_WP;
+    }
+
+    // Everything the checkpoint thread needs is mapped before the snapshot of
+    // the pager's own mappings below, so none of it is mistaken for the guest's.
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    maps_buf = mmap(NULL, CKPT_MAPS_BUF_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+    data = mmap(NULL, CKPT_DATA_AREA, PROT_READ | PROT_WRITE, flags, -1, 0);
+    page_index = mmap(NULL, CKPT_INDEX_AREA, PROT_READ | PROT_WRITE, flags, -1, 0);
+    thread_stack = mmap(NULL, CKPT_THREAD_STACK_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+    void *alt_stack = mmap(NULL, SIGSTKSZ * 4, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (maps_buf == MAP_FAILED || data == MAP_FAILED || page_index == MAP_FAILED ||
+        thread_stack == MAP_FAILED || alt_stack == MAP_FAILED) {
+        perror("Failed to allocate checkpoint buffers");
+        return 1;
+    }
+    max_pages = CKPT_INDEX_AREA / sizeof(ckpt_index_t);
+
+    npager_maps = read_maps(pager_maps, CKPT_MAX_RANGES);
+    if (npager_maps < 0) {
+        perror("Failed to read /proc/self/maps");
+        return 1;
+    }
+
+    // The stop handler runs on its own stack so that parking the guest does
+    // not dirty (or write-fault on) the guest's stack.
+    stack_t ss = { .ss_sp = alt_stack, .ss_size = SIGSTKSZ * 4, .ss_flags = 0 };
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = checkpoint_signal_handler;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+    sigfillset(&sa.sa_mask);
+    if (sigaltstack(&ss, NULL) == -1 || sigaction(CKPT_SIGNAL, &sa, NULL) == -1) {
+        perror("Failed to set up checkpoint signal");
+        return 1;
+    }
+    attached = 1;
+    return 0;
+}
+
+int checkpoint_start(const char *path, unsigned interval_ms, int pager_uffd) {
+    interval = interval_ms;
+    if (checkpoint_attach(pager_uffd) != 0) {
+        return 1;
+    }
+
+    out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out_fd < 0) {
+        perror("Failed to open checkpoint file");
+        return 1;
+    }
+
+    ckpt_file_header_t file_header = { CKPT_FILE_MAGIC, 1, page_size };
+    if (write(out_fd, &file_header, sizeof(file_header)) != sizeof(file_header)) {
+        perror("Failed to write checkpoint header");
+        return 1;
+    }
+    file_offset = sizeof(file_header);
+
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, thread_stack, CKPT_THREAD_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&thread, &attr, checkpoint_thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        fprintf(stderr, "Failed to start checkpoint thread: %s\n", strerror(err));
+        return 1;
+    }
+
+    printf("Checkpointing to %s every %u ms, tracking writes with %s\n", path, interval_ms,
+           tracking_names[tracking]);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/ucontext.h>
+#include <linux/userfaultfd.h>
+
+/*
+ * Incremental checkpoints of a running guest.
+ *
+ * The first checkpoint is a full image of every guest page that is present.
+ * Later checkpoints only carry the pages written since the previous one,
+ * tracked with soft-dirty bits when the kernel has them and with userfaultfd
+ * write-protection otherwise. The guest is only stopped while dirty pages are
+ * collected and copied; the file is written after it resumes.
+ *
+ * File layout: a ckpt_file_header_t, then one record per checkpoint:
+ * ckpt_header_t, nranges ckpt_range_t, npages ckpt_index_t, padding to a page
+ * boundary, and npages pages of data in index order.
+ */
+
+#define CKPT_FILE_MAGIC "PGCKPT1"
+#define CKPT_RECORD_MAGIC "CKPT"
+
+// Features a pager must request on its own userfaultfd so that checkpoints
+// can add write-protection to the ranges it already registered.
+#define CKPT_UFFD_FEATURES (UFFD_FEATURE_PAGEFAULT_FLAG_WP | (1 << 13) /* WP_UNPOPULATED */)
+
+#define CKPT_FULL 0
+#define CKPT_INCREMENTAL 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+} ckpt_file_header_t;
+
+typedef struct {
+    char magic[4];
+    uint32_t kind;              // CKPT_FULL or CKPT_INCREMENTAL
+    uint64_t epoch;
+    uint64_t timestamp_ns;      // CLOCK_REALTIME when the guest was stopped
+    uint64_t stopped_ns;        // how long the guest was held
+    uint64_t nranges;
+    uint64_t npages;
+    uint64_t record_size;       // offset from this header to the next one
+    uint64_t fs_base;
+    uint64_t gregs[__NGREG];    // guest registers, indexed by REG_*
+    struct _libc_fpstate fpregs;
+} ckpt_header_t;
+
+// Guest memory layout at the time of the checkpoint
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    uint64_t prot;
+} ckpt_range_t;
+
+typedef struct {
+    uint64_t vaddr;
+    uint64_t offset;            // absolute file offset of the page data
+} ckpt_index_t;
+
+/**
+ * Registers a pager-managed range (a reserved segment) that belongs to the
+ * guest. `prot` is the protection its pages get once installed. `uffd_mode`
+ * holds the UFFDIO_REGISTER_MODE_* bits the pager itself registered the range
+ * with, so they are kept when write-protection is added.
+ */
+int checkpoint_add_range(uintptr_t start, size_t len, int prot, int uffd_mode);
+
+/**
+ * Starts checkpointing to `path` every `interval_ms`. Must be called on the
+ * guest's thread right before jumping to the guest: every mapping that exists
+ * at this point and was not added with checkpoint_add_range is treated as the
+ * pager's own. `uffd` is the pager's userfaultfd if it has one (its service
+ * thread must then pass write faults to checkpoint_write_fault), or -1.
+ */
+int checkpoint_start(const char *path, unsigned interval_ms, int uffd);
+
+// Records a userfaultfd write-protect fault and lets the write through.
+void checkpoint_write_fault(uintptr_t page);
+
+/*
+ * The same machinery without periodic checkpoints, for pagers that need to
+ * stop and inspect the guest themselves (live migration).
+ */
+
+// Same rules as checkpoint_start, which calls it; calling both is fine.
+int checkpoint_attach(int uffd);
+
+// Parks the guest and fills `regs` with its registers and the time it was
+// stopped. Returns -1 if the guest did not stop in time.
+int checkpoint_stop_guest(ckpt_header_t *regs);
+void checkpoint_resume_guest();
+
+// Points `area` at the stopped guest's full XSAVE area and returns its size.
+size_t checkpoint_guest_xstate(const void **area);
+
+/**
+ * Fills `out` with the guest's memory layout. Pager-managed ranges are
+ * reported whole, with the protection given to checkpoint_add_range.
+ * Returns the number of ranges, or -1.
+ */
+int checkpoint_guest_ranges(ckpt_range_t *out, int max);
+
+#endif
@@ -0,0 +1,353 @@
+#define _GNU_SOURCE
+#include "dedup.h"
+
+#include <emmintrin.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// A slot's `use`: one of these, or SLOT_READY plus the references to its page
+#define SLOT_EMPTY 0
+#define SLOT_FILLING 1      // claimed, page being copied in or given back
+#define SLOT_READY 2
+
+// Waits for a slot another pager is filling; it may have died doing so
+#define FILL_WAIT_YIELDS 1000
+
+#define CLIENT_SWEEPING -1
+
+typedef struct {
+    uint64_t hash;
+    uint32_t use;
+    uint32_t reserved;
+} dedup_slot_t;
+
+// A hash seen once, 0 if free
+typedef struct {
+    uint64_t hash;
+    int32_t owner;          // the client that noted it
+    uint32_t reserved;
+} dedup_note_t;
+
+typedef struct {
+    int32_t pid;            // 0 if free
+    uint32_t refs[DEDUP_SLOTS];
+} dedup_client_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t reserved;
+    uint64_t data_offset;   // of slot 0's page, page-aligned
+    dedup_slot_t slots[DEDUP_SLOTS];
+    dedup_note_t notes[DEDUP_NOTES];
+    dedup_client_t clients[DEDUP_CLIENTS];
+} dedup_store_t;
+
+static int store_fd = -1;
+static dedup_store_t *store;
+static char *store_pages;
+static size_t page_size;
+static int client = -1;     // this pager's entry in store->clients
+
+// From XXH3's default secret: one key per lane
+static const uint64_t lane_keys[8] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+    0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+};
+
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    return x ^ (x >> 33);
+}
+
+uint64_t dedup_hash(const void *page, size_t len) {
+    const __m128i *p = page;
+    __m128i acc[4], keys[4];
+    for (int l = 0; l < 4; l++) {
+        keys[l] = _mm_set_epi64x(lane_keys[2 * l + 1], lane_keys[2 * l]);
+        acc[l] = keys[l];
+    }
+    // Each 64-bit lane adds the product of its key-mixed 32-bit halves, and
+    // the other lane's data unmixed, so no bit of the page is lost
+    for (size_t i = 0; i < len / sizeof(__m128i); i += 4) {
+        for (int l = 0; l < 4; l++) {
+            __m128i data = _mm_loadu_si128(p + i + l);
+            __m128i key = _mm_xor_si128(data, keys[l]);
+            __m128i product = _mm_mul_epu32(key, _mm_shuffle_epi32(key, _MM_SHUFFLE(2, 3, 0, 1)));
+            acc[l] = _mm_add_epi64(acc[l], _mm_add_epi64(product, _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2))));
+        }
+    }
+    uint64_t lanes[8];
+    memcpy(lanes, acc, sizeof(lanes));
+    uint64_t hash = len;
+    for (int l = 0; l < 8; l++) {
+        hash = mix(hash ^ lanes[l]);
+    }
+    return hash;
+}
+
+// Takes a reference on a ready slot; returns 0 if the slot is not ready
+static int slot_get(dedup_slot_t *slot) {
+    uint32_t use = __atomic_load_n(&slot->use, __ATOMIC_ACQUIRE);
+    while (use >= SLOT_READY &&
+           !__atomic_compare_exchange_n(&slot->use, &use, use + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    }
+    return use >= SLOT_READY;
+}
+
+// Drops `n` references; the last one gives the page back and frees the slot
+static void slot_put(size_t i, uint32_t n) {
+    dedup_slot_t *slot = &store->slots[i];
+    uint32_t use = __atomic_sub_fetch(&slot->use, n, __ATOMIC_ACQ_REL);
+    // Whoever takes a reference meanwhile keeps the slot
+    if (use == SLOT_READY &&
+        __atomic_compare_exchange_n(&slot->use, &use, SLOT_FILLING, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        fallocate(store_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, store->data_offset + i * page_size,
+                  page_size);
+        __atomic_store_n(&slot->use, SLOT_EMPTY, __ATOMIC_RELEASE);
+    }
+}
+
+// Clears note `i` if `owner` left it
+static void note_clear(size_t i, int owner) {
+    dedup_note_t *note = &store->notes[i];
+    uint64_t hash = __atomic_load_n(&note->hash, __ATOMIC_ACQUIRE);
+    if (hash != 0 && __atomic_load_n(&note->owner, __ATOMIC_RELAXED) == owner) {
+        __atomic_compare_exchange_n(&note->hash, &hash, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+}
+
+static size_t note_probe(uint64_t hash, int probe) {
+    return (hash + probe * ((hash >> 32) | 1)) % DEDUP_NOTES;
+}
+
+// The note of `hash`, or -1 if it was not seen
+static int note_find(uint64_t hash) {
+    for (int probe = 0; probe < DEDUP_PROBES; probe++) {
+        size_t i = note_probe(hash, probe);
+        if (__atomic_load_n(&store->notes[i].hash, __ATOMIC_ACQUIRE) == hash) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Notes `hash`, over the note at its first probe if every probe is taken
+static int note_add(uint64_t hash) {
+    size_t i = note_probe(hash, 0);
+    for (int probe = 0; probe < DEDUP_PROBES; probe++) {
+        uint64_t expected = 0;
+        if (__atomic_compare_exchange_n(&store->notes[note_probe(hash, probe)].hash, &expected, hash, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            i = note_probe(hash, probe);
+            break;
+        }
+    }
+    // Notes are only hints: losing one delays a merge by a pass
+    __atomic_store_n(&store->notes[i].hash, hash, __ATOMIC_RELEASE);
+    __atomic_store_n(&store->notes[i].owner, client, __ATOMIC_RELEASE);
+    return i;
+}
+
+static int pager_exited(pid_t pid) {
+    return kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+// Releases the references and notes of every pager that has exited
+static void sweep_clients() {
+    for (int c = 0; c < DEDUP_CLIENTS; c++) {
+        dedup_client_t *cl = &store->clients[c];
+        int32_t pid = __atomic_load_n(&cl->pid, __ATOMIC_ACQUIRE);
+        if (pid <= 0 || !pager_exited(pid) ||
+            !__atomic_compare_exchange_n(&cl->pid, &pid, CLIENT_SWEEPING, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        size_t released = 0;
+        for (size_t i = 0; i < DEDUP_SLOTS; i++) {
+            if (cl->refs[i] > 0) {
+                slot_put(i, cl->refs[i]);
+                released += cl->refs[i];
+                cl->refs[i] = 0;
+            }
+        }
+        for (size_t i = 0; i < DEDUP_NOTES; i++) {
+            note_clear(i, c);
+        }
+        if (released > 0) {
+            printf("Released %zu dedup references of exited pager %d\n", released, pid);
+        }
+        __atomic_store_n(&cl->pid, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Looks for a slot holding `page`, and takes a reference on it. Returns the
+ * slot, or -1 with the first empty slot in *empty, DEDUP_SLOTS if none.
+ */
+static int find_slot(const void *page, uint64_t hash, size_t *empty) {
+    // Double hashing: pages that share a first slot go separate ways after it
+    uint64_t step = (hash >> 32) | 1;
+    *empty = DEDUP_SLOTS;
+    for (int probe = 0; probe < DEDUP_PROBES; probe++) {
+        size_t i = (hash + probe * step) % DEDUP_SLOTS;
+        dedup_slot_t *slot = &store->slots[i];
+        uint32_t use = __atomic_load_n(&slot->use, __ATOMIC_ACQUIRE);
+        for (int wait = 0; use == SLOT_FILLING && wait < FILL_WAIT_YIELDS; wait++) {
+            sched_yield();
+            use = __atomic_load_n(&slot->use, __ATOMIC_ACQUIRE);
+        }
+        if (use == SLOT_EMPTY) {
+            *empty = *empty < DEDUP_SLOTS ? *empty : i;
+        } else if (use >= SLOT_READY && slot_get(slot)) {
+            // Compared only under a reference, so the slot cannot be refilled meanwhile
+            if (slot->hash == hash && memcmp(store_pages + i * page_size, page, page_size) == 0) {
+                return i;
+            }
+            slot_put(i, 1);
+        }
+    }
+    return -1;
+}
+
+int dedup_find(const void *page, uint64_t hash, int *slot) {
+    // A few rounds, for races with other pagers adding the same page
+    for (int round = 0; round < 4; round++) {
+        size_t empty;
+        int found = find_slot(page, hash, &empty);
+        if (found >= 0) {
+            __atomic_add_fetch(&store->clients[client].refs[found], 1, __ATOMIC_RELAXED);
+            *slot = found;
+            return DEDUP_FOUND;
+        }
+        int note = note_find(hash);
+        if (note < 0 || note == *slot) {
+            *slot = note < 0 ? note_add(hash) : note;
+            return DEDUP_NOTED;
+        }
+        // Noted for another page, so it is shared: copy it in
+        if (empty == DEDUP_SLOTS) {
+            // Perhaps pagers that have exited still hold slots
+            sweep_clients();
+            continue;
+        }
+        dedup_slot_t *s = &store->slots[empty];
+        uint32_t use = SLOT_EMPTY;
+        if (!__atomic_compare_exchange_n(&s->use, &use, SLOT_FILLING, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        // Whoever clears the note adds the page; the others find it next round
+        uint64_t expected = hash;
+        if (!__atomic_compare_exchange_n(&store->notes[note].hash, &expected, 0, 0, __ATOMIC_ACQ_REL,
+                                         __ATOMIC_RELAXED)) {
+            __atomic_store_n(&s->use, SLOT_EMPTY, __ATOMIC_RELEASE);
+            continue;
+        }
+        memcpy(store_pages + empty * page_size, page, page_size);
+        s->hash = hash;
+        __atomic_store_n(&s->use, SLOT_READY + 1, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&store->clients[client].refs[empty], 1, __ATOMIC_RELAXED);
+        *slot = empty;
+        return DEDUP_ADDED;
+    }
+    return DEDUP_FULL;
+}
+
+void dedup_put(int slot) {
+    __atomic_sub_fetch(&store->clients[client].refs[slot], 1, __ATOMIC_RELAXED);
+    slot_put(slot, 1);
+}
+
+void dedup_forget(int note) {
+    note_clear(note, client);
+}
+
+off_t dedup_offset(int slot) {
+    return store->data_offset + (size_t)slot * page_size;
+}
+
+int dedup_fd() {
+    return store_fd;
+}
+
+int dedup_open(const char *name) {
+    page_size = sysconf(_SC_PAGE_SIZE);
+    char path[256];
+    snprintf(path, sizeof(path), "/%s", name);
+    size_t data_offset = (sizeof(dedup_store_t) + page_size - 1) & ~(page_size - 1);
+    size_t size = data_offset + DEDUP_SLOTS * page_size;
+
+    // Whoever creates the store sets it up; the others wait for its magic
+    int created = 1;
+    store_fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (store_fd < 0 && errno == EEXIST) {
+        created = 0;
+        store_fd = shm_open(path, O_RDWR | O_CLOEXEC, 0600);
+    }
+    if (store_fd < 0 || (created && ftruncate(store_fd, size) == -1)) {
+        perror("Failed to open the dedup store");
+        return -1;
+    }
+    // Touching the store before its creator has sized it would be SIGBUS
+    struct stat st;
+    for (int wait = 0; !created && fstat(store_fd, &st) == 0 && (size_t)st.st_size < size; wait++) {
+        if (wait == FILL_WAIT_YIELDS) {
+            fprintf(stderr, "/dev/shm%s is not a dedup store of this version; remove it to start over\n", path);
+            return -1;
+        }
+        sched_yield();
+    }
+    store = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, store_fd, 0);
+    if (store == MAP_FAILED) {
+        perror("Failed to map the dedup store");
+        return -1;
+    }
+    store_pages = (char *)store + data_offset;
+    if (created) {
+        store->version = DEDUP_VERSION;
+        store->page_size = page_size;
+        store->data_offset = data_offset;
+        __atomic_store_n(&store->magic, DEDUP_MAGIC, __ATOMIC_RELEASE);
+    }
+    for (int wait = 0; __atomic_load_n(&store->magic, __ATOMIC_ACQUIRE) != DEDUP_MAGIC; wait++) {
+        if (wait == FILL_WAIT_YIELDS) {
+            fprintf(stderr, "/dev/shm%s is not a dedup store\n", path);
+            return -1;
+        }
+        sched_yield();
+    }
+    if (store->version != DEDUP_VERSION || store->page_size != page_size || store->data_offset != data_offset) {
+        fprintf(stderr, "/dev/shm%s was made for another version or page size; remove it to start over\n", path);
+        return -1;
+    }
+
+    sweep_clients();
+    for (int c = 0; c < DEDUP_CLIENTS && client < 0; c++) {
+        int32_t expected = 0;
+        if (__atomic_compare_exchange_n(&store->clients[c].pid, &expected, getpid(), 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED)) {
+            client = c;
+        }
+    }
+    if (client < 0) {
+        fprintf(stderr, "/dev/shm%s is shared by %d pagers already\n", path, DEDUP_CLIENTS);
+        return -1;
+    }
+
+    size_t used = 0;
+    for (size_t i = 0; i < DEDUP_SLOTS; i++) {
+        used += __atomic_load_n(&store->slots[i].use, __ATOMIC_RELAXED) >= SLOT_READY;
+    }
+    printf("Deduplicating pages in /dev/shm%s (%zu of %d pages in use)\n", path, used, DEDUP_SLOTS);
+    return 0;
+}
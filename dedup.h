@@ -0,0 +1,81 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Page deduplication across guests, set by --dedup.
+ *
+ * Every pager started with the same --dedup=NAME shares one store: a POSIX
+ * shared-memory file, /dev/shm/NAME, of DEDUP_SLOTS pages with a hash table
+ * in front. A pager that finds one of the guest's pages in the store maps
+ * the slot over it, private, so identical pages of any number of guests are
+ * one page of memory, and a guest that writes to one gets a copy of its own
+ * from the kernel's copy-on-write.
+ *
+ * A page only takes a slot once it is actually shared. The first time a hash
+ * is seen it goes into a table of notes, which takes no page and forgets the
+ * oldest notes when it runs short. The page is copied into a slot when a
+ * second page with the same contents turns up, in this guest or another. A slot counts
+ * the guest pages mapped from it and is emptied, its memory given back, when
+ * the last one is written to or dropped. Each pager also keeps its own count
+ * per slot in the store. Pagers exit with their guests, without cleaning up,
+ * so the next pager to open the store, or to find it full, releases what
+ * pagers that have exited still held.
+ *
+ * Pages are found by a 64-bit hash of their contents. It is computed with
+ * SSE2, four 16-byte lanes at a time, in the way of XXH3's accumulate step.
+ * It only picks the slot: every match is confirmed by comparing the pages in
+ * full. Remove /dev/shm/NAME to start over.
+ */
+
+#define DEDUP_DEFAULT_NAME "pagerdedup"
+#define DEDUP_MAGIC 0x50444450  // "PDDP"
+#define DEDUP_VERSION 2
+#define DEDUP_SLOTS 8192        // pages the store holds, 32 MiB with 4 KiB pages
+#define DEDUP_NOTES 65536       // hashes seen once
+#define DEDUP_CLIENTS 32        // pagers using the store at once
+#define DEDUP_PROBES 16         // slots tried for one hash
+#define DEDUP_INTERVAL_MS 200
+
+// What dedup_find did with a page
+enum {
+    DEDUP_FOUND,        // the store has it: map the slot
+    DEDUP_ADDED,        // seen before, so copied into the slot: map it
+    DEDUP_NOTED,        // seen for the first time: the hash is noted
+    DEDUP_FULL,         // no slot to be had
+};
+
+/**
+ * Opens the store called `name`, creating it if this is the first pager to
+ * use it, and releases what pagers that have exited held in it. Returns 0,
+ * or -1 on failure.
+ */
+int dedup_open(const char *name);
+
+// Hashes one page of `len` bytes, a multiple of 64
+uint64_t dedup_hash(const void *page, size_t len);
+
+/**
+ * Looks `page` up in the store. `*slot` is the note left for this page on an
+ * earlier pass, or -1. It is set to the slot the page is in for DEDUP_FOUND
+ * and DEDUP_ADDED, and the caller holds a reference on it until dedup_put,
+ * or to the page's note for DEDUP_NOTED.
+ */
+int dedup_find(const void *page, uint64_t hash, int *slot);
+
+// Drops a reference dedup_find took, emptying the slot after the last one
+void dedup_put(int slot);
+
+// Clears a note this pager left, unless the page was added since
+void dedup_forget(int note);
+
+// The offset of `slot`'s page in the store, for mapping it
+off_t dedup_offset(int slot);
+
+// The store, for mapping its slots
+int dedup_fd();
+
+#endif
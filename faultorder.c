@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+#include <elf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Turns a fault profile into a link order for the guest it was recorded from:
+ *
+ *   faultorder [-s] <executable> <profile>
+ *
+ * The profile comes from a pager run with --fault-profile=FILE, best with
+ * --policy=demand so that fault-around hides no pages. Every fault on the
+ * text is mapped back to the function it hit through the symbol table, and
+ * the functions are printed in the order they first faulted, one per line:
+ * a symbol ordering file, as lld's --symbol-ordering-file takes. With -s
+ * each is printed as the section -ffunction-sections puts it in, .text.NAME,
+ * for gold's --section-ordering-file. Linked that way, the code the guest
+ * runs first sits together in a few pages at the start of its text.
+ */
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    const char *name;
+    int printed;
+} function_t;
+
+int by_start(const void *x, const void *y) {
+    const function_t *a = x, *b = y;
+    return a->start < b->start ? -1 : a->start > b->start;
+}
+
+// The function holding `addr`, or NULL
+function_t *find_function(function_t *fns, size_t n, uint64_t addr) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (fns[mid].end <= addr) {
+            lo = mid + 1;
+        } else if (fns[mid].start > addr) {
+            hi = mid;
+        } else {
+            return &fns[mid];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Collects the sized functions of the executable's text from its symbol
+ * table, sorted by address, with one name for each address. Returns their
+ * number, or -1 if the executable has no symbol table.
+ */
+ssize_t read_functions(const uint8_t *elf, size_t len, function_t **out) {
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)elf;
+    if (eh->e_shoff == 0 || eh->e_shentsize != sizeof(Elf64_Shdr) ||
+        eh->e_shoff + eh->e_shnum * sizeof(Elf64_Shdr) > len) {
+        return -1;
+    }
+    const Elf64_Shdr *sh = (const Elf64_Shdr *)(elf + eh->e_shoff);
+    for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum ||
+            sh[i].sh_offset + sh[i].sh_size > len || sh[sh[i].sh_link].sh_offset + sh[sh[i].sh_link].sh_size > len) {
+            continue;
+        }
+        const Elf64_Sym *syms = (const Elf64_Sym *)(elf + sh[i].sh_offset);
+        const char *names = (const char *)elf + sh[sh[i].sh_link].sh_offset;
+        size_t nsyms = sh[i].sh_size / sizeof(Elf64_Sym);
+        function_t *fns = calloc(nsyms > 0 ? nsyms : 1, sizeof(function_t));
+        if (fns == NULL) {
+            perror("Failed to allocate functions");
+            exit(1);
+        }
+        size_t n = 0;
+        for (size_t s = 0; s < nsyms; s++) {
+            const Elf64_Sym *sym = &syms[s];
+            // IFUNC symbols name the resolver; the variants have their own
+            if (ELF64_ST_TYPE(sym->st_info) != STT_FUNC || sym->st_size == 0 || sym->st_shndx == SHN_UNDEF ||
+                sym->st_shndx >= eh->e_shnum || !(sh[sym->st_shndx].sh_flags & SHF_EXECINSTR) ||
+                sym->st_name >= sh[sh[i].sh_link].sh_size) {
+                continue;
+            }
+            fns[n++] = (function_t){ sym->st_value, sym->st_value + sym->st_size, names + sym->st_name, 0 };
+        }
+        qsort(fns, n, sizeof(function_t), by_start);
+
+        // Aliases share an address; keep the first name and drop overlaps
+        size_t kept = 0;
+        for (size_t f = 0; f < n; f++) {
+            if (kept == 0 || fns[f].start >= fns[kept - 1].end) {
+                fns[kept++] = fns[f];
+            }
+        }
+        *out = fns;
+        return kept;
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    int sections = 0;
+    if (argc > 1 && strcmp(argv[1], "-s") == 0) {
+        sections = 1;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    if (argc != 3) {
+        printf("Usage: %s [-s] <executable> <profile>\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) == -1) {
+        perror(argv[1]);
+        return 1;
+    }
+    const uint8_t *elf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (elf == MAP_FAILED) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (st.st_size < sizeof(Elf64_Ehdr) || memcmp(elf, ELFMAG, SELFMAG) != 0) {
+        fprintf(stderr, "%s is not an ELF file\n", argv[1]);
+        return 1;
+    }
+    function_t *fns;
+    ssize_t nfns = read_functions(elf, st.st_size, &fns);
+    if (nfns < 0) {
+        fprintf(stderr, "%s has no symbol table\n", argv[1]);
+        return 1;
+    }
+
+    FILE *profile = fopen(argv[2], "r");
+    if (profile == NULL) {
+        perror(argv[2]);
+        return 1;
+    }
+    char kind;
+    unsigned long addr;
+    size_t faults = 0, outside = 0, printed = 0;
+    while (fscanf(profile, " %c %lx", &kind, &addr) == 2) {
+        faults++;
+        function_t *fn = find_function(fns, nfns, addr);
+        if (fn == NULL) {
+            // Data, or text no symbol covers
+            outside++;
+            continue;
+        }
+        if (!fn->printed) {
+            fn->printed = 1;
+            printed++;
+            printf(sections ? ".text.%s\n" : "%s\n", fn->name);
+        }
+    }
+    fclose(profile);
+    fprintf(stderr, "%zu of %zd functions ordered from %zu faults, %zu outside any function\n", printed, nfns,
+            faults, outside);
+    return 0;
+}
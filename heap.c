@@ -0,0 +1,99 @@
+#define _GNU_SOURCE
+#include "heap.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+static int listener = -1;
+static heap_handler_t heap_handler;
+
+static void *supervisor_thread(void *arg) {
+    for (;;) {
+        struct seccomp_notif req;
+        memset(&req, 0, sizeof(req));
+        if (ioctl(listener, SECCOMP_IOCTL_NOTIF_RECV, &req) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to receive guest system call");
+            return NULL;
+        }
+
+        struct seccomp_notif_resp resp = { .id = req.id };
+        long result;
+        if (heap_handler(req.data.nr, (const uint64_t *)req.data.args, &result)) {
+            if (result < 0) {
+                resp.error = result;
+            } else {
+                resp.val = result;
+            }
+        } else {
+            resp.flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+        }
+        // ENOENT: the guest was killed while blocked, so nobody wants the answer
+        if (ioctl(listener, SECCOMP_IOCTL_NOTIF_SEND, &resp) == -1 && errno != ENOENT) {
+            perror("Failed to answer guest system call");
+        }
+    }
+}
+
+int heap_intercept(uintptr_t text_start, uintptr_t text_end, heap_handler_t handler) {
+    uint32_t hi = text_start >> 32;
+    if (text_end <= text_start || ((text_end - 1) >> 32) != hi) {
+        fprintf(stderr, "Guest text %p - %p is out of the filter's reach\n", (void *)text_start,
+                (void *)text_end);
+        return 1;
+    }
+
+    struct sock_filter filter[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 0, 11),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_brk, 3, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_mmap, 2, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_munmap, 1, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_mremap, 0, 6),
+        // Only calls made from the guest's text; the pager's own go through
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, instruction_pointer) + 4),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, hi, 0, 4),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, instruction_pointer)),
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, (uint32_t)text_start, 0, 2),
+        BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, (uint32_t)(text_end - 1), 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+    };
+    struct sock_fprog prog = { .len = sizeof(filter) / sizeof(filter[0]), .filter = filter };
+
+    heap_handler = handler;
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1) {
+        perror("Failed to set no_new_privs");
+        return 1;
+    }
+    listener = syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_NEW_LISTENER, &prog);
+    if (listener == -1) {
+        perror("Failed to install seccomp filter");
+        return 1;
+    }
+
+    // The supervisor inherits the filter, but none of its calls come from
+    // guest text, so it never waits on itself
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, supervisor_thread, NULL);
+    if (err != 0) {
+        fprintf(stderr, "Failed to start heap supervisor thread: %s\n", strerror(err));
+        return 1;
+    }
+    pthread_detach(thread);
+    printf("Intercepting guest brk, mmap, munmap and mremap\n");
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stdint.h>
+
+/*
+ * Interception of the guest's memory-management system calls with seccomp
+ * user notification.
+ *
+ * A filter on the guest's thread turns brk, mmap, munmap and mremap into
+ * notifications, but only when they are made from the guest's own text: the
+ * pager's code, the fault handler included, runs in the same thread and its
+ * calls still go straight to the kernel. A supervisor thread receives each
+ * notification and asks a handler what to do with it. The guest stays
+ * blocked in the call until the handler has answered, so the handler never
+ * races with the guest touching the memory it is changing.
+ */
+
+/**
+ * Decides what to do with one intercepted call. Returns 1 with the call's
+ * result, or -errno, in *result; or 0 to let the kernel run the call as if
+ * nothing had intercepted it.
+ */
+typedef int (*heap_handler_t)(int nr, const uint64_t args[6], long *result);
+
+/**
+ * Installs the filter on the calling thread for calls whose instruction
+ * pointer lies in [text_start, text_end), and starts the supervisor thread
+ * that passes them to `handler`. Must be called on the guest's thread right
+ * before jumping to the guest.
+ */
+int heap_intercept(uintptr_t text_start, uintptr_t text_end, heap_handler_t handler);
+
+#endif
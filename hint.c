@@ -0,0 +1,108 @@
+#define _GNU_SOURCE
+#include "hint.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    unsigned advice;            // HINT_SEQUENTIAL or HINT_RANDOM, HINT_NORMAL if unused
+} hint_range_t;
+
+hint_mailbox_t *hint_mailbox;
+
+static uint64_t hint_tail;      // position of the next record to take
+
+// Written by the hint thread only. The fault handler may see a range half
+// rewritten, which costs it no more than a wrong amount of fault-around.
+static hint_range_t ranges[HINT_MAX_RANGES];
+static unsigned newest_range;
+
+int hint_open() {
+    void *mb = mmap((void *)HINT_MAILBOX_ADDR, HINT_MAILBOX_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (mb == MAP_FAILED || mb != (void *)HINT_MAILBOX_ADDR) {
+        fprintf(stderr, "Failed to map the hint mailbox at %#lx: %s\n", HINT_MAILBOX_ADDR,
+                strerror(mb == MAP_FAILED ? errno : EEXIST));
+        return -1;
+    }
+    hint_mailbox = mb;
+    for (uint64_t i = 0; i < HINT_SLOTS; i++) {
+        hint_mailbox->ring[i].seq = i;
+    }
+    __atomic_store_n(&hint_mailbox->magic, HINT_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int hint_next(hint_record_t *out, int timeout_ms) {
+    hint_record_t *slot = &hint_mailbox->ring[hint_tail % HINT_SLOTS];
+    for (int waited = 0;; waited = 1) {
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == hint_tail + 1) {
+            *out = *slot;
+            __atomic_store_n(&slot->seq, hint_tail + HINT_SLOTS, __ATOMIC_RELEASE);
+            hint_tail++;
+            return 1;
+        }
+        if (waited) {
+            return 0;
+        }
+        // A post after the doorbell is read changes it, and the wait returns at once
+        uint32_t doorbell = __atomic_load_n(&hint_mailbox->doorbell, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&hint_mailbox->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != hint_tail + 1) {
+            struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+            syscall(SYS_futex, &hint_mailbox->doorbell, FUTEX_WAIT, doorbell, timeout_ms < 0 ? NULL : &timeout,
+                    NULL, 0);
+        }
+        __atomic_store_n(&hint_mailbox->sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+}
+
+void hint_note_range(const hint_record_t *hint) {
+    uintptr_t start = hint->addr;
+    uintptr_t end = hint->len < UINTPTR_MAX - start ? start + hint->len : UINTPTR_MAX;
+    if (hint->advice == HINT_NORMAL) {
+        for (int i = 0; i < HINT_MAX_RANGES; i++) {
+            if (ranges[i].start < end && start < ranges[i].end) {
+                __atomic_store_n(&ranges[i].advice, HINT_NORMAL, __ATOMIC_RELEASE);
+            }
+        }
+        return;
+    }
+    // The oldest range makes way
+    hint_range_t *r = &ranges[(newest_range + 1) % HINT_MAX_RANGES];
+    __atomic_store_n(&r->advice, HINT_NORMAL, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->start, start, __ATOMIC_RELAXED);
+    __atomic_store_n(&r->end, end, __ATOMIC_RELAXED);
+    __atomic_store_n(&r->advice, hint->advice, __ATOMIC_RELEASE);
+    __atomic_store_n(&newest_range, (newest_range + 1) % HINT_MAX_RANGES, __ATOMIC_RELEASE);
+}
+
+size_t hint_fault_around(uintptr_t page, size_t count) {
+    if (hint_mailbox == NULL) {
+        return count;
+    }
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    unsigned newest = __atomic_load_n(&newest_range, __ATOMIC_ACQUIRE);
+    // The latest hint for the page wins
+    for (int i = 0; i < HINT_MAX_RANGES; i++) {
+        hint_range_t *r = &ranges[(newest + HINT_MAX_RANGES - i) % HINT_MAX_RANGES];
+        unsigned advice = __atomic_load_n(&r->advice, __ATOMIC_ACQUIRE);
+        uintptr_t start = __atomic_load_n(&r->start, __ATOMIC_RELAXED);
+        uintptr_t end = __atomic_load_n(&r->end, __ATOMIC_RELAXED);
+        if (advice == HINT_NORMAL || page < start || page >= end) {
+            continue;
+        }
+        if (advice == HINT_RANDOM) {
+            return 1;
+        }
+        size_t left = (end - page + page_size - 1) / page_size;
+        size_t ahead = left < HINT_SEQUENTIAL_PAGES ? left : HINT_SEQUENTIAL_PAGES;
+        return ahead > count ? ahead : count;
+    }
+    return count;
+}
@@ -0,0 +1,134 @@
+#ifndef HINT_H
+#define HINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/auxv.h>
+#include <sys/syscall.h>
+
+/*
+ * Access hints from the guest, set by --hints: like madvise, but read by the
+ * pager's own policies rather than the kernel.
+ *
+ * The pager maps one mailbox page at HINT_MAILBOX_ADDR and hands its address
+ * to the guest in the auxiliary vector as AT_PAGER_HINTS. A guest that knows
+ * what it will touch next posts hint records with pager_hint(), which needs
+ * nothing but this header. Under a pager without --hints getauxval finds no
+ * mailbox and pager_hint() does nothing, so the same guest runs anywhere.
+ *
+ * The mailbox is a bounded ring of HINT_SLOTS records that any number of
+ * guest threads post to without locks: a poster claims a slot by advancing
+ * `head`, fills it, and publishes it by setting its `seq` to its position
+ * plus one. The pager's hint thread takes records in order and hands each
+ * slot back by setting `seq` one lap ahead. When the ring is full the hint
+ * is dropped and counted; hints are advice and never change what the guest
+ * reads. The pager sleeps on `doorbell` while the ring is empty, and posters
+ * wake it with a futex only when `sleeping` says it is waiting.
+ */
+
+#define AT_PAGER_HINTS 0x50474849        // "PGHI", an auxv type the kernel does not use
+#define HINT_MAGIC 0x544e4948            // "HINT"
+#define HINT_MAILBOX_ADDR 0x6ffff000UL   // just below the pagers' text at 0x70000000
+#define HINT_MAILBOX_SIZE 4096
+
+enum {
+    HINT_NORMAL,        // forget earlier SEQUENTIAL and RANDOM hints for the range
+    HINT_WILLNEED,      // install the range now, ahead of the faults
+    HINT_DONTNEED,      // the guest is done with the range for now: give its memory back
+    HINT_SEQUENTIAL,    // faults in the range read far ahead
+    HINT_RANDOM,        // faults in the range install only the page itself
+};
+
+typedef struct {
+    uint64_t seq;       // position + 1 once filled, position + HINT_SLOTS once free again
+    uint64_t addr;
+    uint64_t len;
+    uint32_t advice;    // HINT_*
+    uint32_t reserved;
+} hint_record_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t doorbell;  // bumped by every post
+    uint32_t sleeping;  // set while the pager waits on the doorbell
+    uint32_t reserved;
+    uint64_t head;      // position of the next slot to claim
+    uint64_t dropped;   // hints lost to a full ring
+    uint64_t pad[4];
+    hint_record_t ring[(HINT_MAILBOX_SIZE - 64) / sizeof(hint_record_t)];
+} hint_mailbox_t;
+
+#define HINT_SLOTS ((HINT_MAILBOX_SIZE - 64) / sizeof(hint_record_t))
+
+/**
+ * Posts `advice` for [addr, addr + len) to the pager. Safe from any guest
+ * thread and from signal handlers. Returns 1 if the hint was posted, 0 if
+ * there is no pager to take it or its mailbox is full.
+ */
+static inline int pager_hint(const void *addr, size_t len, unsigned advice) {
+    hint_mailbox_t *mb = (hint_mailbox_t *)getauxval(AT_PAGER_HINTS);
+    if (mb == NULL || mb->magic != HINT_MAGIC) {
+        return 0;
+    }
+    uint64_t pos = __atomic_load_n(&mb->head, __ATOMIC_RELAXED);
+    hint_record_t *slot;
+    for (;;) {
+        slot = &mb->ring[pos % HINT_SLOTS];
+        int64_t lap = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (lap == 0) {
+            if (__atomic_compare_exchange_n(&mb->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (lap < 0) {
+            // The pager has not taken the record from a lap ago yet
+            __atomic_add_fetch(&mb->dropped, 1, __ATOMIC_RELAXED);
+            return 0;
+        } else {
+            pos = __atomic_load_n(&mb->head, __ATOMIC_RELAXED);
+        }
+    }
+    slot->addr = (uintptr_t)addr;
+    slot->len = len;
+    slot->advice = advice;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&mb->doorbell, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&mb->sleeping, __ATOMIC_SEQ_CST)) {
+        syscall(SYS_futex, &mb->doorbell, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+    return 1;
+}
+
+// ---- Pager side (hint.c) ----
+
+#define HINT_MAX_RANGES 16          // SEQUENTIAL and RANDOM ranges remembered at once
+#define HINT_SEQUENTIAL_PAGES 32    // pages a fault in a SEQUENTIAL range installs
+
+extern hint_mailbox_t *hint_mailbox;    // NULL without --hints
+
+/**
+ * Maps the mailbox at HINT_MAILBOX_ADDR for the guest to find through
+ * AT_PAGER_HINTS. Returns 0, or -1 if the address is taken.
+ */
+int hint_open();
+
+/**
+ * Takes the next hint the guest posted into `out`, waiting up to
+ * `timeout_ms` for one, or for good if it is negative. For the hint thread
+ * only. Returns 1 with a hint, or 0 if none came.
+ */
+int hint_next(hint_record_t *out, int timeout_ms);
+
+// Remembers a SEQUENTIAL or RANDOM hint for hint_fault_around, or forgets
+// the ranges a NORMAL hint overlaps
+void hint_note_range(const hint_record_t *hint);
+
+/**
+ * The number of pages a fault on `page` should install, given the `count`
+ * the policy asked for and the ranges the guest hinted. Safe to call from
+ * the fault handler.
+ */
+size_t hint_fault_around(uintptr_t page, size_t count);
+
+#endif
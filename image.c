@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+#include "image.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HASH_BITS 14
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+
+// Decompressed blocks kept around, whatever the block size
+#define IMAGE_CACHE_BYTES (4 << 20)
+
+typedef struct {
+    uint64_t block;         // block held, if ready
+    int ready;
+    int lock;
+} slot_t;
+
+static int image_file = -1;
+static image_header_t header;
+static uint64_t *block_index;   // nblocks + 1 offsets into the image
+static slot_t *slots;
+static size_t nslots;
+static uint8_t *cache;          // per slot: the block, then room for its stored bytes
+static image_aligned_t *aligned;    // set for page-aligned images
+
+// ---- Block format ----
+
+static uint32_t hash4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static int put_byte(uint8_t *dst, size_t dst_len, size_t *out, uint8_t b) {
+    if (*out >= dst_len) {
+        return -1;
+    }
+    dst[(*out)++] = b;
+    return 0;
+}
+
+// Writes the bytes of a length past the 15 its nibble holds
+static int put_length(uint8_t *dst, size_t dst_len, size_t *out, size_t n) {
+    for (n -= 15; n >= 255; n -= 255) {
+        if (put_byte(dst, dst_len, out, 255) != 0) {
+            return -1;
+        }
+    }
+    return put_byte(dst, dst_len, out, n);
+}
+
+// Writes one sequence; a match length of 0 ends the block
+static int put_sequence(uint8_t *dst, size_t dst_len, size_t *out, const uint8_t *lit, size_t nlit,
+                        size_t offset, size_t match) {
+    size_t mcode = match > 0 ? match - MIN_MATCH : 0;
+    uint8_t token = (nlit < 15 ? nlit : 15) << 4 | (mcode < 15 ? mcode : 15);
+    if (put_byte(dst, dst_len, out, token) != 0 ||
+        (nlit >= 15 && put_length(dst, dst_len, out, nlit) != 0) || dst_len - *out < nlit) {
+        return -1;
+    }
+    memcpy(dst + *out, lit, nlit);
+    *out += nlit;
+    if (match == 0) {
+        return 0;
+    }
+    if (put_byte(dst, dst_len, out, offset & 0xff) != 0 || put_byte(dst, dst_len, out, offset >> 8) != 0 ||
+        (mcode >= 15 && put_length(dst, dst_len, out, mcode) != 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+size_t image_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len) {
+    uint32_t table[1 << HASH_BITS];     // last position + 1 of each hash, 0 if none
+    memset(table, 0, sizeof(table));
+    size_t out = 0, anchor = 0, pos = 0;
+    while (pos + MIN_MATCH <= len) {
+        uint32_t h = hash4(src + pos);
+        size_t cand = table[h];
+        table[h] = pos + 1;
+        if (cand == 0 || pos - (cand - 1) > MAX_OFFSET || memcmp(src + cand - 1, src + pos, MIN_MATCH) != 0) {
+            pos++;
+            continue;
+        }
+        cand--;
+        size_t match = MIN_MATCH;
+        while (pos + match < len && src[cand + match] == src[pos + match]) {
+            match++;
+        }
+        if (put_sequence(dst, dst_len, &out, src + anchor, pos - anchor, pos - cand, match) != 0) {
+            return 0;
+        }
+        pos += match;
+        anchor = pos;
+    }
+    if (put_sequence(dst, dst_len, &out, src + anchor, len - anchor, 0, 0) != 0) {
+        return 0;
+    }
+    return out;
+}
+
+static int get_length(const uint8_t *src, size_t src_len, size_t *i, size_t *n) {
+    uint8_t b;
+    do {
+        if (*i >= src_len) {
+            return -1;
+        }
+        b = src[(*i)++];
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+int image_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t len) {
+    size_t i = 0, o = 0;
+    while (i < src_len) {
+        uint8_t token = src[i++];
+        size_t nlit = token >> 4;
+        if ((nlit == 15 && get_length(src, src_len, &i, &nlit) != 0) || nlit > src_len - i || nlit > len - o) {
+            return -1;
+        }
+        memcpy(dst + o, src + i, nlit);
+        i += nlit;
+        o += nlit;
+        if (i == src_len) {
+            break;
+        }
+
+        if (src_len - i < 2) {
+            return -1;
+        }
+        size_t offset = src[i] | src[i + 1] << 8;
+        i += 2;
+        size_t match = token & 15;
+        if ((match == 15 && get_length(src, src_len, &i, &match) != 0)) {
+            return -1;
+        }
+        match += MIN_MATCH;
+        if (offset == 0 || offset > o || match > len - o) {
+            return -1;
+        }
+        if (offset >= match) {
+            memcpy(dst + o, dst + o - offset, match);
+        } else {
+            // Overlapping: a run repeating the last `offset` bytes
+            for (size_t k = 0; k < match; k++) {
+                dst[o + k] = dst[o + k - offset];
+            }
+        }
+        o += match;
+    }
+    return o == len ? 0 : -1;
+}
+
+// ---- Reading an image ----
+
+static void lock_slot(slot_t *slot) {
+    while (__atomic_exchange_n(&slot->lock, 1, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+static void unlock_slot(slot_t *slot) {
+    __atomic_store_n(&slot->lock, 0, __ATOMIC_RELEASE);
+}
+
+static size_t block_length(uint64_t block) {
+    uint64_t start = block * header.block_size;
+    return header.file_size - start < header.block_size ? header.file_size - start : header.block_size;
+}
+
+static int read_stored_bytes(void *dst, size_t len, off_t offset, ssize_t (*read_stored)(void *, size_t, off_t)) {
+    while (len > 0) {
+        ssize_t n = read_stored != NULL ? read_stored(dst, len, offset) : pread(image_file, dst, len, offset);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        dst = (char *)dst + n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+// Reads and decompresses `block` into the slot's memory
+static int fill_slot(slot_t *slot, uint64_t block, ssize_t (*read_stored)(void *, size_t, off_t)) {
+    uint8_t *data = cache + (slot - slots) * 2 * header.block_size;
+    uint8_t *stored = data + header.block_size;
+    size_t len = block_length(block);
+    size_t stored_len = block_index[block + 1] - block_index[block];
+    if (stored_len == len) {
+        return read_stored_bytes(data, len, block_index[block], read_stored);
+    }
+    if (read_stored_bytes(stored, stored_len, block_index[block], read_stored) != 0) {
+        return -1;
+    }
+    if (image_decompress(stored, stored_len, data, len) != 0) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+// Reads through the extents of a page-aligned image
+static ssize_t aligned_pread(void *dst, size_t len, off_t offset, ssize_t (*read_stored)(void *, size_t, off_t)) {
+    size_t done = 0;
+    while (done < len && offset + done < aligned->file_size) {
+        uint64_t at = offset + done;
+        image_extent_t *ext = NULL;
+        for (uint32_t e = 0; e < aligned->nextents; e++) {
+            if (at >= aligned->extents[e].file_offset && at < aligned->extents[e].file_offset + aligned->extents[e].len) {
+                ext = &aligned->extents[e];
+                break;
+            }
+        }
+        if (ext == NULL) {
+            errno = EIO;
+            return -1;
+        }
+        size_t skip = at - ext->file_offset;
+        size_t chunk = ext->len - skip < len - done ? ext->len - skip : len - done;
+        if (read_stored_bytes((char *)dst + done, chunk, ext->offset + skip, read_stored) != 0) {
+            return -1;
+        }
+        done += chunk;
+    }
+    return done;
+}
+
+ssize_t image_pread(void *dst, size_t len, off_t offset, ssize_t (*read_stored)(void *, size_t, off_t)) {
+    if (aligned != NULL) {
+        return aligned_pread(dst, len, offset, read_stored);
+    }
+    size_t done = 0;
+    while (done < len && offset + done < header.file_size) {
+        uint64_t block = (offset + done) / header.block_size;
+        size_t skip = offset + done - block * header.block_size;
+        size_t chunk = block_length(block) - skip < len - done ? block_length(block) - skip : len - done;
+
+        slot_t *slot = &slots[block % nslots];
+        lock_slot(slot);
+        if (!slot->ready || slot->block != block) {
+            slot->ready = 0;
+            if (fill_slot(slot, block, read_stored) != 0) {
+                unlock_slot(slot);
+                return -1;
+            }
+            slot->block = block;
+            slot->ready = 1;
+        }
+        memcpy((char *)dst + done, cache + (slot - slots) * 2 * header.block_size + skip, chunk);
+        unlock_slot(slot);
+        done += chunk;
+    }
+    return done;
+}
+
+int image_loaded() {
+    return image_file >= 0;
+}
+
+off_t image_page_offset(uintptr_t page, size_t *npages) {
+    if (aligned == NULL) {
+        return -1;
+    }
+    for (uint32_t r = 0; r < aligned->nregions; r++) {
+        image_region_t *region = &aligned->regions[r];
+        if (page >= region->start && page < region->start + region->npages * aligned->page_size) {
+            size_t idx = (page - region->start) / aligned->page_size;
+            *npages = region->npages - idx;
+            return region->offset + idx * aligned->page_size;
+        }
+    }
+    return -1;
+}
+
+int image_fd() {
+    return image_file;
+}
+
+static int open_aligned(int fd, struct stat *st) {
+    aligned = malloc(sizeof(image_aligned_t));
+    if (aligned == NULL || pread(fd, aligned, sizeof(image_aligned_t), 0) != sizeof(image_aligned_t)) {
+        perror("Failed to read the image header");
+        return -1;
+    }
+    if (aligned->page_size != (uint32_t)sysconf(_SC_PAGE_SIZE)) {
+        fprintf(stderr, "Image was packed for %u-byte pages\n", aligned->page_size);
+        return -1;
+    }
+    if (aligned->nregions > IMAGE_MAX_REGIONS || aligned->nextents > IMAGE_MAX_EXTENTS) {
+        fprintf(stderr, "Corrupt image header\n");
+        return -1;
+    }
+    for (uint32_t r = 0; r < aligned->nregions; r++) {
+        image_region_t *region = &aligned->regions[r];
+        if (region->offset % aligned->page_size != 0 || region->start % aligned->page_size != 0 ||
+            region->npages > (uint64_t)st->st_size / aligned->page_size ||
+            region->offset + region->npages * aligned->page_size > (uint64_t)st->st_size) {
+            fprintf(stderr, "Corrupt image region %u\n", r);
+            return -1;
+        }
+    }
+    for (uint32_t e = 0; e < aligned->nextents; e++) {
+        image_extent_t *ext = &aligned->extents[e];
+        if (ext->len > (uint64_t)st->st_size || ext->offset > (uint64_t)st->st_size - ext->len) {
+            fprintf(stderr, "Corrupt image extent %u\n", e);
+            return -1;
+        }
+    }
+    image_file = fd;
+    printf("Page-aligned image: %lu bytes in %u regions\n", aligned->file_size, aligned->nregions);
+    return 1;
+}
+
+int image_open(int fd) {
+    uint32_t magic;
+    if (pread(fd, &magic, sizeof(magic), 0) != sizeof(magic) ||
+        (magic != IMAGE_MAGIC && magic != IMAGE_ALIGNED_MAGIC)) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("Failed to stat the image");
+        return -1;
+    }
+    if (magic == IMAGE_ALIGNED_MAGIC) {
+        return open_aligned(fd, &st);
+    }
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        perror("Failed to read the image header");
+        return -1;
+    }
+    if (header.block_size < IMAGE_MIN_BLOCK || header.block_size > IMAGE_MAX_BLOCK ||
+        (header.block_size & (header.block_size - 1)) != 0 ||
+        header.nblocks != (header.file_size + header.block_size - 1) / header.block_size ||
+        header.nblocks > (uint64_t)st.st_size / sizeof(uint64_t)) {
+        fprintf(stderr, "Corrupt image header\n");
+        return -1;
+    }
+
+    size_t index_len = (header.nblocks + 1) * sizeof(uint64_t);
+    block_index = malloc(index_len);
+    if (block_index == NULL) {
+        perror("Failed to allocate the image index");
+        return -1;
+    }
+    if (pread(fd, block_index, index_len, sizeof(header)) != (ssize_t)index_len) {
+        perror("Failed to read the image index");
+        return -1;
+    }
+    for (uint64_t b = 0; b < header.nblocks; b++) {
+        if (block_index[b] < sizeof(header) + index_len || block_index[b + 1] < block_index[b] ||
+            block_index[b + 1] - block_index[b] > block_length(b) || block_index[b + 1] > (uint64_t)st.st_size) {
+            fprintf(stderr, "Corrupt image index at block %lu\n", b);
+            return -1;
+        }
+    }
+
+    nslots = IMAGE_CACHE_BYTES / header.block_size;
+    slots = calloc(nslots, sizeof(slot_t));
+    // Untouched slots cost nothing: the memory is only faulted in when used
+    cache = mmap(NULL, nslots * 2 * header.block_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slots == NULL || cache == MAP_FAILED) {
+        perror("Failed to allocate the image cache");
+        return -1;
+    }
+    image_file = fd;
+    printf("Compressed image: %lu bytes in %lu blocks of %u bytes, %lu stored\n", header.file_size,
+           header.nblocks, header.block_size, block_index[header.nblocks] - block_index[0]);
+    return 1;
+}
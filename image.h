@@ -0,0 +1,120 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Guest images, written by pagerpack and loaded by any pager in place of the
+ * ELF file.
+ *
+ * A compressed image cuts the executable into blocks of block_size bytes, 4
+ * KiB to 64 KiB, and compresses each block on its own, so any page can be read
+ * back by decompressing just the block that holds it. The file starts with an
+ * image_header_t, followed by nblocks + 1 offsets: block i is stored in
+ * [index[i], index[i + 1]). A block that did not shrink is stored as is,
+ * which shows as a stored length equal to the block's own.
+ *
+ * Blocks use a small LZ77 format in the style of LZ4, chosen because it
+ * decodes with nothing but memcpy: the fault handler on the guest's thread
+ * can run it. Each sequence is a token byte, whose high nibble counts the
+ * literals and low nibble the match length less 4 (15 means more length
+ * bytes follow, each added until one is below 255), the literals, and a
+ * 2-byte little-endian match offset. The last sequence has no match.
+ *
+ * Decompressed blocks are kept in a small direct-mapped cache, so faults on
+ * neighbouring pages of a 64 KiB block decompress it once.
+ *
+ * pagerpack -a writes a page-aligned image instead, laid out so that every
+ * file-backed guest page can be mapped straight from the image with mmap.
+ * The first page holds an image_aligned_t, one image_region_t per PT_LOAD
+ * segment and the extents that put the executable's bytes back together.
+ * Each region then stores its segment's pages exactly as they look in
+ * memory, starting on a page boundary: bytes of the page before p_vaddr and
+ * after p_filesz are zero, so the page holding the end of the file data can
+ * be mapped as well. Bytes of the executable outside every segment, such as
+ * the section headers and symbol table, follow the regions.
+ */
+
+#define IMAGE_MAGIC 0x31474d50  // "PMG1"
+#define IMAGE_MIN_BLOCK 4096
+#define IMAGE_MAX_BLOCK 65536
+
+typedef struct {
+    uint32_t magic;
+    uint32_t block_size;
+    uint64_t file_size;     // of the executable the image was packed from
+    uint64_t nblocks;
+} image_header_t;
+
+#define IMAGE_ALIGNED_MAGIC 0x31474150  // "PAG1"
+#define IMAGE_MAX_REGIONS 32
+#define IMAGE_MAX_EXTENTS (2 * IMAGE_MAX_REGIONS + 1)
+
+typedef struct {
+    uint64_t start;         // page-aligned guest address of the region
+    uint64_t file_end;      // guest address where file data ends and zero fill starts
+    uint64_t end;           // guest address where the segment ends
+    uint64_t offset;        // page-aligned image offset of the region's first page
+    uint64_t npages;        // pages stored at `offset`, up to file_end rounded up
+} image_region_t;
+
+typedef struct {
+    uint64_t file_offset;   // in the executable
+    uint64_t len;
+    uint64_t offset;        // in the image
+} image_extent_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t page_size;
+    uint64_t file_size;     // of the executable the image was packed from
+    uint32_t nregions;
+    uint32_t nextents;
+    image_region_t regions[IMAGE_MAX_REGIONS];
+    image_extent_t extents[IMAGE_MAX_EXTENTS];
+} image_aligned_t;
+
+/**
+ * Compresses `len` bytes of `src`, at most IMAGE_MAX_BLOCK, into `dst`,
+ * which has room for `dst_len` bytes. Returns the compressed size, or 0 if it
+ * does not fit.
+ */
+size_t image_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len);
+
+/**
+ * Decompresses a block into exactly `len` bytes at `dst`. Returns 0, or -1 if
+ * the block is corrupt.
+ */
+int image_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t len);
+
+/**
+ * Checks whether the file open on `fd` is a compressed or page-aligned image
+ * and, if so, reads its index. Returns 1 for an image, 0 for anything else,
+ * or -1 on an error.
+ */
+int image_open(int fd);
+
+// Whether image_open found an image of either kind
+int image_loaded();
+
+/**
+ * For a page-aligned image: the image offset of guest page `page`, if its
+ * contents are stored there ready to be mapped, and *npages how many pages
+ * follow it in the same region. Returns -1 for pages of other images and
+ * for pages that are all zero fill.
+ */
+off_t image_page_offset(uintptr_t page, size_t *npages);
+
+// The image, for mapping its pages
+int image_fd();
+
+/**
+ * Like pread on the executable the image was packed from. Stored blocks are
+ * read with `read_stored`, or with pread on the image if it is NULL. Safe to
+ * call from any pager thread and from the fault handler.
+ */
+ssize_t image_pread(void *dst, size_t len, off_t offset, ssize_t (*read_stored)(void *, size_t, off_t));
+
+#endif
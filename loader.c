@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "hint.h"
+#include "image.h"
+#include "pager.h"
+
+// ELF magic numbers
+#define EI_MAG0 0
+#define EI_MAG1 1
+#define EI_MAG2 2
+#define EI_MAG3 3
+#define ELFMAG0 0x7f
+#define ELFMAG1 'E'
+#define ELFMAG2 'L'
+#define ELFMAG3 'F'
+#define STACK_ALIGNMENT 16
+
+extern char **environ;
+
+// Size of the ELF magic number
+#define SELFMAG 4
+
+Elf64_Addr e_entry;
+int global_fd;
+Elf64_Ehdr elf_header;
+Elf64_Phdr *ph;
+
+// Had to add GNU property (elf.h did not have it on lab machine)
+#define PT_GNU_PROPERTY 0x6474e553
+
+// Reads headers of the executable, unpacking them from a compressed image
+static ssize_t read_headers(int fd, void *dst, size_t len, off_t offset) {
+    return image_loaded() ? image_pread(dst, len, offset, NULL) : pread(fd, dst, len, offset);
+}
+
+int load_elf_binary(int argc, char *argv[], Elf64_Ehdr *header) {
+    // for command line argument!
+    if (argc < 2) {
+        printf("Usage: %s <executable>\n", argv[0]);
+        return 1;
+    }
+
+    // Open the ELF file
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open file");
+        return 1;
+    } else {
+        printf("Successfully opened file. \n");
+    }
+    
+
+    // A compressed image stands in for the executable it was packed from
+    if (image_open(fd) == -1) {
+        close(fd);
+        return 1;
+    }
+
+    // Read the ELF header
+    if (read_headers(fd, &elf_header, sizeof(Elf64_Ehdr), 0) != sizeof(Elf64_Ehdr)) {
+        perror("Failed to read ELF header");
+        close(fd);
+        return 1;
+    } else {
+        printf("Successfully read ELF header. \n");
+    }
+    e_entry = elf_header.e_entry;
+
+    // check to see if we are dealing with an elf file!
+    unsigned char elf_magic[SELFMAG] = {ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3};
+    if (memcmp(elf_header.e_ident, elf_magic, SELFMAG) == 0) {
+        printf("We are dealing with an ELF file. \n");
+    } else {
+        fprintf(stderr, "%s is not an ELF file\n", argv[1]);
+        close(fd);
+        return 1;
+    }
+
+    // Allocate memory for program headers
+    ph = (Elf64_Phdr *)malloc(elf_header.e_phnum * sizeof(Elf64_Phdr));
+    if (ph == NULL) {
+        perror("Failed to allocate memory for program headers");
+        close(fd);
+        return 1;
+    }
+
+    // Read all program headers into memory
+    if (read_headers(fd, ph, elf_header.e_phnum * sizeof(Elf64_Phdr), elf_header.e_phoff) !=
+        elf_header.e_phnum * sizeof(Elf64_Phdr)) {
+        perror("Failed to read program headers");
+        free(ph);
+        close(fd);
+        return 1;
+    }
+    
+   printf("Successfully read program headers.\n");
+    header = &elf_header;
+    global_fd = fd;
+    printf("addr of elf_header %p\n", header);
+    printf("Elf loading complete.\n");
+    return 0;
+}
+
+
+/**
+ * Routine for checking stack made for child program.
+ * top_of_stack: stack pointer that will given to child program as %rsp
+ * argc: Expected number of arguments
+ * argv: Expected argument strings
+ */
+void stack_check(void* top_of_stack, uint64_t argc, char** argv) {
+	printf("----- stack check -----\n");
+
+	assert(((uint64_t)top_of_stack) % 8 == 0);
+	printf("top of stack is 8-byte aligned\n");
+
+	uint64_t* stack = top_of_stack;
+	uint64_t actual_argc = *(stack++);
+	printf("argc: %lu\n", actual_argc);
+	assert(actual_argc == argc);
+
+	for (int i = 0; i < argc; i++) {
+		char* argp = (char*)*(stack++);
+		assert(strcmp(argp, argv[i]) == 0);
+		printf("arg %d: %s\n", i, argp);
+	}
+	// Argument list ends with null pointer
+	assert(*(stack++) == 0);
+
+	int envp_count = 0;
+	while (*(stack++) != 0)
+		envp_count++;
+
+	printf("env count: %d\n", envp_count);
+
+	Elf64_auxv_t* auxv_start = (Elf64_auxv_t*)stack;
+	Elf64_auxv_t* auxv_null = auxv_start;
+	while (auxv_null->a_type != AT_NULL) {
+		auxv_null++;
+	}
+	printf("aux count: %lu\n", auxv_null - auxv_start);
+	printf("----- end stack check -----\n");
+}
+
+#define DEFAULT_STACK_SIZE_KB 80
+
+typedef struct {
+  void *base;
+  size_t size;
+} stack_info_t;
+
+int allocate_stack(stack_info_t *stack, size_t size_kb, void *desired_addr) {
+  long page_size = sysconf(_SC_PAGESIZE);
+  if (page_size == -1) {
+    perror("Failed to get page size");
+    return -1;
+  }
+
+  size_t stack_size = size_kb * 1024;
+  if (stack_size % page_size != 0) {
+    stack_size = ((stack_size / page_size) + 1) * page_size;
+  }
+
+  void *stack_base = mmap(desired_addr, stack_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (stack_base == MAP_FAILED) {
+    perror("Failed to allocate stack");
+    return -1;
+  }
+
+  stack->base = stack_base;
+  stack->size = stack_size;
+  return 0;
+}
+
+void free_stack(stack_info_t *stack) {
+  if (stack->base != NULL) {
+    if (munmap(stack->base, stack->size) == -1) {
+      perror("Failed to free stack");
+    }
+    stack->base = NULL;
+    stack->size = 0;
+  }
+}
+
+/**
+ * The auxiliary vector is copied from the pager's own, so the entries that
+ * describe the executable still point at the pager. Static glibc locates its
+ * PT_TLS through AT_PHDR, so the guest must see its own program headers.
+ */
+void patch_auxv(Elf64_auxv_t *vectors, int aux_entries) {
+  Elf64_Addr phdr_addr = 0;
+  for (int i = 0; i < elf_header.e_phnum; i++) {
+    if (ph[i].p_type == PT_LOAD && elf_header.e_phoff >= ph[i].p_offset &&
+        elf_header.e_phoff < ph[i].p_offset + ph[i].p_filesz) {
+      phdr_addr = ph[i].p_vaddr + (elf_header.e_phoff - ph[i].p_offset);
+      break;
+    }
+  }
+
+  for (int i = 0; i < aux_entries; i++) {
+    switch (vectors[i].a_type) {
+    case AT_PHDR:
+      if (phdr_addr != 0) {
+        vectors[i].a_un.a_val = phdr_addr;
+      }
+      break;
+    case AT_PHENT:
+      vectors[i].a_un.a_val = elf_header.e_phentsize;
+      break;
+    case AT_PHNUM:
+      vectors[i].a_un.a_val = elf_header.e_phnum;
+      break;
+    case AT_ENTRY:
+      vectors[i].a_un.a_val = elf_header.e_entry;
+      break;
+    }
+  }
+}
+
+int setup_the_stack(int argc, char *argv[], char *envp[],
+                    Elf64_Ehdr *elf_header) {
+  stack_info_t stack;
+  void *desired_addr = (void *)0x7000000;
+  size_t stack_size_kb = DEFAULT_STACK_SIZE_KB;
+
+  // allocate the stack
+  if (allocate_stack(&stack, stack_size_kb, desired_addr) == -1) {
+    fprintf(stderr, "Failed to allocate stack\n");
+    return 1;
+  }
+
+  TRACE(guest_trace, TR_STACK, stack.base, argc);
+  printf("Stack allocated successfully:\n");
+  printf("  Base address: %p\n", stack.base);
+  printf("  Size: %zu bytes\n", stack.size);
+
+  void *stack_top = (void *)(stack.base + stack.size);
+  int num_env_vars = count_env_vars();
+  printf("Number of environment variables: %d\n", num_env_vars);
+
+  // Allocate memory for env_vars strings
+  size_t env_vars_total_len = 0;
+  for (int i = 0; envp[i] != NULL; i++) {
+    env_vars_total_len += strlen(envp[i]) + 1;
+  }
+  char *env_vars_buffer = (char *)malloc(env_vars_total_len);
+  char *env_vars_ptr = env_vars_buffer;
+  for (int i = 0; envp[i] != NULL; i++) {
+    size_t len = strlen(envp[i]);
+    memcpy(env_vars_ptr, envp[i], len + 1);
+    envp[i] = env_vars_ptr;
+    env_vars_ptr += len + 1;
+  }
+
+  // Allocate memory for cmd_args strings
+  size_t cmd_args_total_len = 0;
+  for (int i = 0; i < argc; i++) {
+    cmd_args_total_len += strlen(argv[i]) + 1;
+  }
+  char *cmd_args_buffer = (char *)malloc(cmd_args_total_len);
+  char *cmd_args_ptr = cmd_args_buffer;
+  for (int i = 0; i < argc; i++) {
+    size_t len = strlen(argv[i]);
+    memcpy(cmd_args_ptr, argv[i], len + 1);
+    argv[i] = cmd_args_ptr;
+    cmd_args_ptr += len + 1;
+  }
+
+  // calculate the address of auxv using pointer arithmetic
+  Elf64_auxv_t *auxv = (Elf64_auxv_t *)(envp + num_env_vars + 1);
+
+  // count the number of auxiliary vector entries
+  int aux_entries = count_auxv_entries(auxv);
+
+  printf("Number of auxiliary vector entries: %d\n", aux_entries);
+
+  // Copy the AT_NULL terminator along with the entries, leaving room for
+  // the hint mailbox's entry ahead of it
+  Elf64_auxv_t *vectors =
+      (Elf64_auxv_t *)malloc((aux_entries + 2) * sizeof(Elf64_auxv_t));
+  if (vectors == NULL) {
+    perror("Failed to allocate auxiliary vector");
+    return -1;
+  }
+  memset(vectors, 0, (aux_entries + 2) * sizeof(Elf64_auxv_t));
+
+  Elf64_auxv_t *auxv_ptr = (Elf64_auxv_t *)auxv;
+  memcpy(vectors, auxv_ptr, (aux_entries + 1) * sizeof(Elf64_auxv_t));
+  patch_auxv(vectors, aux_entries);
+  if (hint_mailbox != NULL) {
+    vectors[aux_entries].a_type = AT_PAGER_HINTS;
+    vectors[aux_entries].a_un.a_val = (uintptr_t)hint_mailbox;
+    aux_entries++;
+  }
+  size_t stack_ptr = (size_t)stack_top;
+  stack_ptr -= (aux_entries + 1) * sizeof(Elf64_auxv_t);
+  stack_ptr -= (argc + num_env_vars + 2) * sizeof(char *);
+
+  stack_top =
+      (char **)((stack_ptr & ~(STACK_ALIGNMENT - 1)) & ~(STACK_ALIGNMENT - 1));
+
+  Elf64_Addr stack_top_addr = (Elf64_Addr)stack_top;
+  *(long *)stack_top = (long)argc;
+  stack_top += sizeof(long);
+
+  char **argv_ptr = (char **)stack_top;
+  stack_top += sizeof(char *) * argc;
+
+  argv_ptr[0] = cmd_args_buffer;
+  cmd_args_buffer +=
+      strlen(cmd_args_buffer) + 1; 
+  *(char **)stack_top = NULL;
+  stack_top += sizeof(char *);
+
+  char **envp_ptr = (char **)stack_top;
+  stack_top += sizeof(char *) * num_env_vars;
+
+  // Direct manipulation of env_vars_buffer within the loop
+  for (int i = 0; i < num_env_vars - 1; ++i) {
+    envp_ptr[i] = env_vars_buffer;
+    env_vars_buffer +=
+        strlen(env_vars_buffer) + 1;  
+  }
+
+  envp_ptr[num_env_vars - 1] = NULL;
+
+  memcpy(stack_top, vectors, sizeof(Elf64_auxv_t) * (aux_entries + 1));
+  stack_top += sizeof(Elf64_auxv_t) * (aux_entries + 1);
+
+  stack_check((void *)stack_top_addr, argc, (char **)argv_ptr);
+  printf("Stack setup completed\n");
+
+  TRACE(guest_trace, TR_ENTER_GUEST, e_entry, stack_top_addr);
+  printf("Beginning to execute assembly code\n");
+
+  // // using the neat trick described in handout:
+  // // will use the ret instruction to perform a return, which will pop the
+  // // address from the top of the stack and jump to that address.
+  asm("xor %rax, %rax");
+  asm("xor %rbx, %rbx");
+  asm("xor %rcx, %rcx");
+  asm("xor %rdx, %rdx");
+  asm("mov %0, %%rsp" : : "r"(stack_top_addr));
+  asm("push %0" : : "r"(e_entry));
+  asm("ret");
+
+  free_stack(&stack);
+
+  return 0;
+}
+
+
+int count_auxv_entries(Elf64_auxv_t *auxv) {
+  int count = 0;
+  while (auxv->a_type != AT_NULL) {
+    count++;
+    auxv++;
+  }
+  return count;
+}
+
+int count_env_vars_recursive(char **env) {
+  if (*env == NULL) {
+    return 0;
+  }
+
+  return 1 + count_env_vars_recursive(env + 1);
+}
+
+int count_env_vars() { return count_env_vars_recursive(environ); }
@@ -0,0 +1,48 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "pager_map.h"
+
+/*
+ * Checksums a file read through pager_map, as an example of the library:
+ *
+ *   mapsum <file> [policy] [max-resident-pages]
+ *
+ * Prints the same sum however the file is paged, which makes it a quick check
+ * of a policy with and without a cap on the pages kept present.
+ */
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 4) {
+        printf("Usage: %s <file> [policy] [max-resident-pages]\n", argv[0]);
+        return 1;
+    }
+    struct stat st;
+    if (stat(argv[1], &st) == -1) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (st.st_size == 0) {
+        printf("0 bytes, sum 0\n");
+        return 0;
+    }
+    const uint8_t *data = pager_map(argv[1], st.st_size, argc > 2 ? argv[2] : NULL);
+    if (data == NULL) {
+        perror("pager_map");
+        return 1;
+    }
+    if (argc > 3 && pager_set_limit(strtoul(argv[3], NULL, 0)) != 0) {
+        perror("pager_set_limit");
+        return 1;
+    }
+
+    uint64_t sum = 0;
+    for (off_t i = 0; i < st.st_size; i++) {
+        sum = sum * 31 + data[i];
+    }
+    printf("%lld bytes, sum %016llx\n", (long long)st.st_size, (unsigned long long)sum);
+    return pager_unmap((void *)data) == 0 ? 0 : 1;
+}
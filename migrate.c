@@ -0,0 +1,638 @@
+#define _GNU_SOURCE
+#include "migrate.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <asm/prctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+// Raised on the destination to load the guest's registers through sigreturn
+#define MIG_RESUME_SIGNAL (SIGRTMAX - 3)
+
+#define MIG_THREAD_STACK_SIZE (256UL << 10)
+#define MIG_MAPS_BUF_SIZE (1UL << 20)
+#define MIG_XSTATE_MAX (16UL << 10)
+
+// pagemap entry bits, see Documentation/admin-guide/mm/pagemap.rst
+#define PM_PRESENT (1ULL << 63)
+#define PM_SWAPPED (1ULL << 62)
+
+// Software-reserved bytes at the end of the legacy FXSAVE area, see checkpoint.c
+#define FP_XSTATE_MAGIC1 0x46505853U
+#define FP_SW_BYTES_OFFSET 464
+
+typedef struct {
+    uint32_t magic1;
+    uint32_t extended_size;
+} fp_sw_bytes_t;
+
+typedef struct {
+    uintptr_t start;
+    size_t npages;
+    unsigned char *sent;    // source only: one flag per page, set once it went out
+} mig_range_t;
+
+static size_t page_size;
+static int fault_sock = -1;
+static int push_sock = -1;
+
+// Source state
+static int listen_fd = -1;
+static int mem_fd = -1;
+static int pagemap_fd = -1;
+static int start_pipe[2];
+static migrate_page_fn pager_page;
+static ckpt_range_t *ranges;
+static mig_range_t src[MIG_MAX_RANGES];
+static int nsrc;
+static char *fault_buf;
+static char *push_buf;
+static char *page_buf;
+static char *maps_buf;
+static uintptr_t last_request;
+static unsigned long request_seq;
+static unsigned long pushed, pushed_zero, served;
+static int push_done;
+
+// Destination state
+static char xstate[MIG_XSTATE_MAX] __attribute__((aligned(64)));
+static mig_state_t *resume_state;
+
+static uint64_t now_ns(clockid_t clock) {
+    // Raw syscall: on the destination the vDSO moves to where the guest wants it
+    struct timespec ts;
+    syscall(SYS_clock_gettime, clock, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Writes a message to stdout without stdio, which the guest thread may be in.
+static void report(const char *fmt, ...) {
+    char msg[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    write(STDOUT_FILENO, msg, len < sizeof(msg) ? len : sizeof(msg) - 1);
+}
+
+static int send_pages(int sock, uintptr_t vaddr, uint32_t npages, uint32_t kind, void *data) {
+    mig_pages_t msg = { vaddr, npages, kind };
+    struct iovec iov[2] = {
+        { &msg, sizeof(msg) },
+        { data, kind == MIG_DATA ? npages * page_size : 0 },
+    };
+    struct msghdr mh = { .msg_iov = iov, .msg_iovlen = 2 };
+    return sendmsg(sock, &mh, MSG_NOSIGNAL) == (ssize_t)(sizeof(msg) + iov[1].iov_len) ? 0 : -1;
+}
+
+static int receive_pages(int sock, mig_pages_t *msg, void *buf, size_t buf_size) {
+    struct iovec iov[2] = { { msg, sizeof(*msg) }, { buf, buf_size } };
+    struct msghdr mh = { .msg_iov = iov, .msg_iovlen = 2 };
+    ssize_t n = recvmsg(sock, &mh, 0);
+    if (n < (ssize_t)sizeof(*msg) || (mh.msg_flags & MSG_TRUNC)) {
+        return -1;
+    }
+    if (msg->kind == MIG_DATA && n != (ssize_t)(sizeof(*msg) + msg->npages * page_size)) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Looks up a kernel special mapping by name in /proc/self/maps. With
+ * `overlap` set, instead reports whether anything other than the mapping at
+ * `ignore` overlaps [start, end). Returns 1 if found, 0 if not, -1 on error.
+ */
+static int scan_maps(const char *name, uintptr_t *start, uintptr_t *end, int overlap, uintptr_t ignore) {
+    int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    size_t len = 0;
+    ssize_t n;
+    while (len < MIG_MAPS_BUF_SIZE - 1 && (n = read(fd, maps_buf + len, MIG_MAPS_BUF_SIZE - 1 - len)) > 0) {
+        len += n;
+    }
+    close(fd);
+    maps_buf[len] = '\0';
+
+    for (char *line = maps_buf; *line != '\0';) {
+        char *eol = strchr(line, '\n');
+        if (eol != NULL) {
+            *eol = '\0';
+        }
+        char *p = line;
+        uintptr_t lo = strtoul(p, &p, 16);
+        uintptr_t hi = strtoul(p + 1, &p, 16);
+        char *special = strchr(p, '[');
+        if (overlap) {
+            if (lo != ignore && lo < *end && hi > *start) {
+                return 1;
+            }
+        } else if (special != NULL && strcmp(special, name) == 0) {
+            *start = lo;
+            *end = hi;
+            return 1;
+        }
+        if (eol == NULL) {
+            break;
+        }
+        line = eol + 1;
+    }
+    return 0;
+}
+
+static const char *special_names[] = {"[vdso]", "[vvar]", "[vvar_vclock]"};
+
+// Records where the kernel put the vDSO and its data pages in this process.
+static void find_specials(mig_state_t *state) {
+    for (int i = 0; i < sizeof(special_names) / sizeof(special_names[0]); i++) {
+        mig_special_t *sp = &state->special[state->nspecial];
+        uintptr_t start, end;
+        if (scan_maps(special_names[i], &start, &end, 0, 0) == 1) {
+            sp->start = start;
+            sp->end = end;
+            strcpy(sp->name, special_names[i]);
+            state->nspecial++;
+        }
+    }
+}
+
+static mig_range_t *find_range(uintptr_t page) {
+    for (int r = 0; r < nsrc; r++) {
+        if (page >= src[r].start && page < src[r].start + src[r].npages * page_size) {
+            return &src[r];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Fills `buf` with the guest page at `page` and returns MIG_DATA, or returns
+ * MIG_ZERO for a page that was never touched. `entry` is its pagemap entry.
+ */
+static int read_guest_page(uintptr_t page, uint64_t entry, char *buf) {
+    ssize_t n = pager_page(page, buf);
+    if (n >= 0) {
+        return n > 0 ? MIG_DATA : MIG_ZERO;
+    }
+    if (!(entry & (PM_PRESENT | PM_SWAPPED))) {
+        return MIG_ZERO;
+    }
+    // /proc/self/mem reads through whatever protection the guest set
+    if (pread(mem_fd, buf, page_size, page) != page_size) {
+        memset(buf, 0, page_size);
+    }
+    return MIG_DATA;
+}
+
+// Finds the next page nobody has sent yet, scanning forward from (*r, *idx)
+// and wrapping around once. Returns 0 once every page is out.
+static int next_unsent(int *r, size_t *idx) {
+    if (nsrc == 0) {
+        return 0;
+    }
+    for (int n = 0; n <= nsrc; n++) {
+        int cur = (*r + n) % nsrc;
+        for (size_t i = n == 0 ? *idx : 0; i < src[cur].npages; i++) {
+            if (!__atomic_load_n(&src[cur].sent[i], __ATOMIC_ACQUIRE)) {
+                *r = cur;
+                *idx = i;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Streams every page the destination has not asked for yet, in runs of up to
+ * MIG_BATCH data pages or any number of zero pages. Like the background
+ * populator, it jumps to just after the destination's latest fault.
+ */
+static void *push_thread(void *arg) {
+    char c;
+    if (read(start_pipe[0], &c, 1) != 1) {
+        return NULL;
+    }
+
+    static uint64_t entries[512];
+    uintptr_t cached = 0;
+    unsigned long seen_seq = 0;
+    uintptr_t run_start = 0;
+    uint32_t run_len = 0, run_kind = MIG_DATA;
+    int r = 0;
+    size_t idx = 0;
+    int failed = 0;
+
+    while (!failed) {
+        unsigned long seq = __atomic_load_n(&request_seq, __ATOMIC_ACQUIRE);
+        if (seq != seen_seq) {
+            seen_seq = seq;
+            uintptr_t page = __atomic_load_n(&last_request, __ATOMIC_RELAXED);
+            mig_range_t *range = find_range(page);
+            if (range != NULL) {
+                r = range - src;
+                idx = (page - range->start) / page_size + 1;
+            }
+        }
+        if (!next_unsent(&r, &idx)) {
+            break;
+        }
+
+        uintptr_t page = src[r].start + idx * page_size;
+        idx++;
+        if (__atomic_exchange_n(&src[r].sent[idx - 1], 1, __ATOMIC_ACQ_REL)) {
+            continue;
+        }
+
+        // pagemap is read 512 entries at a time
+        uintptr_t chunk = page & ~(512 * page_size - 1);
+        if (chunk != cached) {
+            memset(entries, 0, sizeof(entries));
+            pread(pagemap_fd, entries, sizeof(entries), chunk / page_size * sizeof(uint64_t));
+            cached = chunk;
+        }
+        uint64_t entry = entries[(page - chunk) / page_size];
+
+        int kind = read_guest_page(page, entry, page_buf);
+        int full = run_kind == MIG_DATA && run_len == MIG_BATCH;
+        if (run_len > 0 && (kind != run_kind || page != run_start + run_len * page_size || full)) {
+            failed = send_pages(push_sock, run_start, run_len, run_kind, push_buf) != 0;
+            run_len = 0;
+        }
+        if (run_len == 0) {
+            run_start = page;
+            run_kind = kind;
+        }
+        if (kind == MIG_DATA) {
+            memcpy(push_buf + run_len * page_size, page_buf, page_size);
+        }
+        run_len++;
+        pushed++;
+        pushed_zero += kind == MIG_ZERO;
+    }
+
+    if (!failed && run_len > 0) {
+        failed = send_pages(push_sock, run_start, run_len, run_kind, push_buf) != 0;
+    }
+    if (!failed) {
+        send_pages(push_sock, 0, 0, MIG_DONE, NULL);
+    }
+    __atomic_store_n(&push_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static int accept_channel(uint32_t channel) {
+    int sock = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (sock < 0) {
+        return -1;
+    }
+    mig_hello_t hello;
+    if (recv(sock, &hello, sizeof(hello), 0) != sizeof(hello) || hello.magic != MIG_MAGIC ||
+        hello.channel != channel) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * Stops the guest and sends the destination what it needs to resume it. The
+ * guest stays parked from here on, unless sending fails before the
+ * destination could have started it.
+ */
+static int hand_over() {
+    mig_state_t state;
+    memset(&state, 0, sizeof(state));
+    uint64_t begin = now_ns(CLOCK_MONOTONIC);
+    if (checkpoint_stop_guest(&state.regs) != 0) {
+        report("Migration refused: guest did not stop\n");
+        return -1;
+    }
+
+    int count = checkpoint_guest_ranges(ranges, MIG_MAX_RANGES);
+    const void *area;
+    size_t area_size = checkpoint_guest_xstate(&area);
+    find_specials(&state);
+    // The guest's libc remembers the break even before the heap has grown
+    uintptr_t heap_end;
+    state.brk = syscall(SYS_brk, 0);
+    if (scan_maps("[heap]", &state.start_brk, &heap_end, 0, 0) != 1) {
+        state.start_brk = state.brk;
+    }
+    state.magic = MIG_MAGIC;
+    state.page_size = page_size;
+    state.nranges = count;
+    state.xstate_size = area_size;
+
+    if (count < 0 || send(fault_sock, &state, sizeof(state), MSG_NOSIGNAL) != sizeof(state) ||
+        send(fault_sock, ranges, count * sizeof(ckpt_range_t), MSG_NOSIGNAL) != count * sizeof(ckpt_range_t) ||
+        send(fault_sock, area, area_size, MSG_NOSIGNAL) != area_size) {
+        report("Migration aborted: could not send guest state\n");
+        checkpoint_resume_guest();
+        return -1;
+    }
+
+    nsrc = 0;
+    for (int i = 0; i < count; i++) {
+        size_t npages = (ranges[i].end - ranges[i].start) / page_size;
+        unsigned char *sent = mmap(NULL, npages, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (sent == MAP_FAILED) {
+            // Too late to take the guest back; the destination may be running it
+            report("Migration failed: out of memory for page tracking\n");
+            exit(1);
+        }
+        src[nsrc].start = ranges[i].start;
+        src[nsrc].npages = npages;
+        src[nsrc].sent = sent;
+        nsrc++;
+    }
+
+    report("Guest handed over: %d ranges, %zu bytes of state, stopped for %.3f ms\n", count,
+           sizeof(state) + count * sizeof(ckpt_range_t) + area_size, (now_ns(CLOCK_MONOTONIC) - begin) / 1e6);
+    return 0;
+}
+
+// Answers the destination's page requests until it hangs up.
+static void serve_faults() {
+    static uint64_t entry;
+    mig_request_t req;
+    while (recv(fault_sock, &req, sizeof(req), 0) == sizeof(req)) {
+        uintptr_t page = req.vaddr & ~(page_size - 1);
+        mig_range_t *range = find_range(page);
+        int kind = MIG_ZERO;
+        if (range != NULL) {
+            __atomic_store_n(&range->sent[(page - range->start) / page_size], 1, __ATOMIC_RELEASE);
+            entry = 0;
+            pread(pagemap_fd, &entry, sizeof(entry), page / page_size * sizeof(uint64_t));
+            kind = read_guest_page(page, entry, fault_buf);
+        }
+        if (send_pages(fault_sock, page, 1, kind, fault_buf) != 0) {
+            break;
+        }
+        __atomic_store_n(&last_request, page, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&request_seq, 1, __ATOMIC_RELEASE);
+        served++;
+    }
+}
+
+static void *source_thread(void *arg) {
+    uint64_t begin = 0;
+    for (;;) {
+        fault_sock = accept_channel(MIG_CHANNEL_FAULT);
+        if (fault_sock < 0) {
+            continue;
+        }
+        begin = now_ns(CLOCK_MONOTONIC);
+        if (hand_over() == 0) {
+            break;
+        }
+        close(fault_sock);
+    }
+
+    while ((push_sock = accept_channel(MIG_CHANNEL_PUSH)) < 0) {
+    }
+    write(start_pipe[1], "", 1);
+    serve_faults();
+    while (!__atomic_load_n(&push_done, __ATOMIC_ACQUIRE)) {
+        usleep(1000);
+    }
+
+    report("Migration complete: %lu pages pushed (%lu zero), %lu served on demand, %.3f ms\n", pushed,
+           pushed_zero, served, (now_ns(CLOCK_MONOTONIC) - begin) / 1e6);
+    exit(0);
+}
+
+static int start_thread_on(void *(*fn)(void *), void *stack) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, MIG_THREAD_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&thread, &attr, fn, NULL);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        fprintf(stderr, "Failed to start migration thread: %s\n", strerror(err));
+        return 1;
+    }
+    return 0;
+}
+
+int migrate_listen(const char *path, int uffd, migrate_page_fn read_page) {
+    page_size = sysconf(_SC_PAGE_SIZE);
+    pager_page = read_page;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Migration socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listen_fd, 2) == -1) {
+        perror("Failed to listen for migration");
+        return 1;
+    }
+
+    mem_fd = open("/proc/self/mem", O_RDONLY | O_CLOEXEC);
+    pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (mem_fd < 0 || pagemap_fd < 0 || pipe2(start_pipe, O_CLOEXEC) == -1) {
+        perror("Failed to open migration files");
+        return 1;
+    }
+
+    // Like the checkpoint buffers, all of this exists before the pager's
+    // mappings are recorded, so none of it is sent as guest memory.
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    ranges = mmap(NULL, MIG_MAX_RANGES * sizeof(ckpt_range_t), PROT_READ | PROT_WRITE, flags, -1, 0);
+    fault_buf = mmap(NULL, page_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    push_buf = mmap(NULL, MIG_BATCH * page_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    page_buf = mmap(NULL, page_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    maps_buf = mmap(NULL, MIG_MAPS_BUF_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+    void *source_stack = mmap(NULL, MIG_THREAD_STACK_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+    void *push_stack = mmap(NULL, MIG_THREAD_STACK_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (ranges == MAP_FAILED || fault_buf == MAP_FAILED || push_buf == MAP_FAILED || page_buf == MAP_FAILED ||
+        maps_buf == MAP_FAILED || source_stack == MAP_FAILED || push_stack == MAP_FAILED) {
+        perror("Failed to allocate migration buffers");
+        return 1;
+    }
+    if (start_thread_on(source_thread, source_stack) != 0 || start_thread_on(push_thread, push_stack) != 0) {
+        return 1;
+    }
+    if (checkpoint_attach(uffd) != 0) {
+        return 1;
+    }
+
+    printf("Waiting for a migration destination on %s\n", path);
+    return 0;
+}
+
+static int connect_channel(const char *path, uint32_t channel) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        return -1;
+    }
+    mig_hello_t hello = { MIG_MAGIC, channel };
+    if (send(sock, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello)) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int migrate_connect(const char *path, mig_state_t *state, ckpt_range_t **out_ranges) {
+    page_size = sysconf(_SC_PAGE_SIZE);
+    maps_buf = mmap(NULL, MIG_MAPS_BUF_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    ranges = mmap(NULL, MIG_MAX_RANGES * sizeof(ckpt_range_t), PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (maps_buf == MAP_FAILED || ranges == MAP_FAILED) {
+        perror("Failed to allocate migration buffers");
+        return 1;
+    }
+
+    fault_sock = connect_channel(path, MIG_CHANNEL_FAULT);
+    if (fault_sock < 0) {
+        perror("Failed to connect to migration source");
+        return 1;
+    }
+    if (recv(fault_sock, state, sizeof(*state), 0) != sizeof(*state) || state->magic != MIG_MAGIC) {
+        fprintf(stderr, "Migration source sent no guest state\n");
+        return 1;
+    }
+    if (state->page_size != page_size || state->nranges > MIG_MAX_RANGES || state->xstate_size > MIG_XSTATE_MAX) {
+        fprintf(stderr, "Migration source is incompatible with this host\n");
+        return 1;
+    }
+    size_t ranges_size = state->nranges * sizeof(ckpt_range_t);
+    if (recv(fault_sock, ranges, ranges_size, 0) != ranges_size ||
+        recv(fault_sock, xstate, state->xstate_size, 0) != state->xstate_size) {
+        fprintf(stderr, "Failed to receive guest state\n");
+        return 1;
+    }
+
+    push_sock = connect_channel(path, MIG_CHANNEL_PUSH);
+    if (push_sock < 0) {
+        perror("Failed to open migration push channel");
+        return 1;
+    }
+    *out_ranges = ranges;
+    return 0;
+}
+
+ssize_t migrate_fetch_page(uintptr_t page, void *dst) {
+    mig_request_t req = { page };
+    mig_pages_t msg;
+    if (send(fault_sock, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req) ||
+        receive_pages(fault_sock, &msg, dst, page_size) != 0 || msg.vaddr != page) {
+        return -1;
+    }
+    if (msg.kind == MIG_ZERO) {
+        memset(dst, 0, page_size);
+        return 0;
+    }
+    return page_size;
+}
+
+int migrate_receive_pages(mig_pages_t *msg, void *buf) {
+    return receive_pages(push_sock, msg, buf, MIG_BATCH * page_size);
+}
+
+void migrate_finish() {
+    close(push_sock);
+    close(fault_sock);
+}
+
+int migrate_adopt_process(mig_state_t *state) {
+    for (int i = 0; i < state->nspecial; i++) {
+        mig_special_t *sp = &state->special[i];
+        uintptr_t start, end;
+        if (scan_maps(sp->name, &start, &end, 0, 0) != 1 || end - start != sp->end - sp->start) {
+            fprintf(stderr, "Cannot recreate %s for the migrated guest\n", sp->name);
+            return 1;
+        }
+        if (start == sp->start) {
+            continue;
+        }
+        uintptr_t target_start = sp->start, target_end = sp->end;
+        if (scan_maps(NULL, &target_start, &target_end, 1, start) != 0 ||
+            mremap((void *)start, end - start, end - start, MREMAP_MAYMOVE | MREMAP_FIXED,
+                   (void *)sp->start) == MAP_FAILED) {
+            fprintf(stderr, "Cannot move %s to %p for the migrated guest\n", sp->name, (void *)sp->start);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int migrate_adopt_brk(mig_state_t *state) {
+    // Only with CAP_SYS_RESOURCE
+    if (prctl(PR_SET_MM, PR_SET_MM_START_BRK, state->start_brk, 0, 0) == 0 &&
+        prctl(PR_SET_MM, PR_SET_MM_BRK, state->brk, 0, 0) == 0) {
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * Runs on the pager's thread, which becomes the guest's thread when this
+ * returns. Everything but fs comes back through the signal frame. Once fs
+ * points at the guest's TLS, nothing here may touch the pager's.
+ */
+static void resume_handler(int sig, siginfo_t *info, void *ucontext) {
+    ucontext_t *uc = (ucontext_t *)ucontext;
+    for (int i = 0; i < __NGREG; i++) {
+        uc->uc_mcontext.gregs[i] = resume_state->regs.gregs[i];
+    }
+
+    char *fp = (char *)uc->uc_mcontext.fpregs;
+    fp_sw_bytes_t *ours = (fp_sw_bytes_t *)(fp + FP_SW_BYTES_OFFSET);
+    fp_sw_bytes_t *theirs = (fp_sw_bytes_t *)(xstate + FP_SW_BYTES_OFFSET);
+    if (ours->magic1 == FP_XSTATE_MAGIC1 && theirs->magic1 == FP_XSTATE_MAGIC1 &&
+        ours->extended_size == theirs->extended_size && theirs->extended_size == resume_state->xstate_size) {
+        memcpy(fp, xstate, resume_state->xstate_size);
+    } else {
+        // Different XSAVE layout: restore the legacy x87/SSE state only
+        memcpy(fp, &resume_state->regs.fpregs, FP_SW_BYTES_OFFSET - 48);
+    }
+    sigemptyset(&uc->uc_sigmask);
+    syscall(SYS_arch_prctl, ARCH_SET_FS, resume_state->regs.fs_base);
+}
+
+void migrate_resume_guest(mig_state_t *state) {
+    resume_state = state;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = resume_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigfillset(&sa.sa_mask);
+    if (sigaction(MIG_RESUME_SIGNAL, &sa, NULL) == -1) {
+        perror("Failed to set up resume signal");
+        exit(1);
+    }
+    syscall(SYS_tgkill, getpid(), gettid(), MIG_RESUME_SIGNAL);
+
+    fprintf(stderr, "Failed to resume migrated guest\n");
+    exit(1);
+}
@@ -0,0 +1,129 @@
+#ifndef MIGRATE_H
+#define MIGRATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "checkpoint.h"
+
+/*
+ * Post-copy migration of a running guest between two pagers.
+ *
+ * The source pager listens on a Unix socket. When the destination connects,
+ * the source stops the guest and sends only what it needs to resume it: its
+ * registers, its memory layout, and where the brk heap and vDSO were. The
+ * destination reserves every range, restores the registers and runs the guest
+ * straight away. Pages are then demand-fetched through the destination's
+ * fault path, while the source pushes everything else in the background, so
+ * the time the guest is stopped does not grow with its memory size.
+ *
+ * Both sides use SOCK_SEQPACKET, so every message arrives whole. The
+ * destination opens two connections: a fault channel for synchronous page
+ * requests, and a push channel the source streams pages into.
+ *
+ * Fault channel: mig_hello_t, then the source replies with mig_state_t, the
+ * ckpt_range_t array and the XSAVE area. After that every mig_request_t is
+ * answered with a mig_pages_t for that page, followed by its data unless it
+ * is a zero page.
+ *
+ * Push channel: mig_hello_t, then mig_pages_t messages until MIG_DONE. Every
+ * page has been sent on one of the channels by then.
+ */
+
+#define MIG_MAGIC 0x3147494d    // "MIG1"
+
+#define MIG_CHANNEL_FAULT 0
+#define MIG_CHANNEL_PUSH 1
+
+#define MIG_DATA 0              // npages pages of data follow in the same message
+#define MIG_ZERO 1              // npages zero pages, nothing follows
+#define MIG_DONE 2              // every page has been sent
+
+// Pages sent in one push message
+#define MIG_BATCH 16
+
+#define MIG_MAX_RANGES 4096
+#define MIG_MAX_SPECIAL 4
+
+typedef struct {
+    uint32_t magic;
+    uint32_t channel;
+} mig_hello_t;
+
+// A kernel-provided mapping ([vdso], [vvar], ...) the guest holds pointers into
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    char name[16];
+} mig_special_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t page_size;
+    uint64_t nranges;
+    uint64_t xstate_size;
+    uint64_t start_brk;
+    uint64_t brk;
+    uint32_t nspecial;
+    mig_special_t special[MIG_MAX_SPECIAL];
+    ckpt_header_t regs;         // registers and fs base; timestamp_ns is the stop time
+} mig_state_t;
+
+typedef struct {
+    uint64_t vaddr;
+} mig_request_t;
+
+typedef struct {
+    uint64_t vaddr;
+    uint32_t npages;
+    uint32_t kind;              // MIG_DATA, MIG_ZERO or MIG_DONE
+} mig_pages_t;
+
+/**
+ * Reads a page that the pager manages but may not have installed. Fills `dst`
+ * (one page) and returns the number of bytes read, 0 for a zero page, or -1
+ * if the page is simply in memory (or not the pager's), so it is read from
+ * there.
+ */
+typedef ssize_t (*migrate_page_fn)(uintptr_t page, void *dst);
+
+/**
+ * Source side. Waits on `path` for a destination, then hands the guest over
+ * and exits once every page has been sent. Must be called on the guest's
+ * thread right before jumping to the guest, like checkpoint_start, and after
+ * the pager's ranges were added with checkpoint_add_range.
+ */
+int migrate_listen(const char *path, int uffd, migrate_page_fn read_page);
+
+// Destination side: connects to a source and receives the guest's state.
+int migrate_connect(const char *path, mig_state_t *state, ckpt_range_t **ranges);
+
+// Fetches one page over the fault channel. Returns the number of data bytes
+// (0 for a zero page, with `dst` cleared), or -1.
+ssize_t migrate_fetch_page(uintptr_t page, void *dst);
+
+// Receives the next push message; `buf` must hold MIG_BATCH pages.
+int migrate_receive_pages(mig_pages_t *msg, void *buf);
+
+// Closes both channels; the source exits once it sees them go.
+void migrate_finish();
+
+/**
+ * Moves the destination's vDSO to where the guest expects it. Run after the
+ * guest's ranges are reserved. From here on, pager code must not call vDSO
+ * functions (clock_gettime and friends).
+ */
+int migrate_adopt_process(mig_state_t *state);
+
+/**
+ * Makes the guest's break the kernel's, which takes CAP_SYS_RESOURCE.
+ * Returns 0, after which pager code must not call malloc, or -1 if the
+ * kernel keeps this pager's break.
+ */
+int migrate_adopt_brk(mig_state_t *state);
+
+// Restores the guest's registers and continues it. Does not return.
+void migrate_resume_guest(mig_state_t *state);
+
+#endif
@@ -0,0 +1,253 @@
+#define _GNU_SOURCE
+#include "mrc.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define MRC_HASH_BITS 24
+#define MRC_HASH_RANGE (1u << MRC_HASH_BITS)
+#define MRC_TABLE (2 * MRC_MAX_PAGES)   // hash table slots, a power of two
+#define MRC_CLOCK (4 * MRC_MAX_PAGES)   // timestamps handed out before renumbering
+#define MRC_BUCKETS 256
+#define MRC_NONE UINT32_MAX
+
+typedef struct {
+    uintptr_t page;
+    uint32_t hash;
+    uint32_t time;                  // of the last reference
+} mrc_entry_t;
+
+typedef struct {
+    uint32_t threshold;             // pages hashing below it are tracked
+    uint32_t npages;
+    uint32_t clock;
+    uint64_t samples;               // references to tracked pages
+    double refs;                    // estimated references to all pages
+    double cold;                    // the part of refs that were first references
+    double hist[MRC_BUCKETS];       // the rest, by reuse distance bucket
+    mrc_entry_t entries[MRC_MAX_PAGES];
+    uint32_t table[MRC_TABLE];      // entry by page, linear probing
+    uint32_t owner[MRC_CLOCK];      // entry by time of last reference
+    uint32_t tree[MRC_CLOCK + 1];   // Fenwick tree: tracked pages by time
+} mrc_state_t;
+
+static mrc_state_t *mrc;
+static volatile sig_atomic_t report_requested;
+
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Distances below 4 get a bucket each; after that every power of two is
+// split in four, so powers of two always start a bucket
+static int bucket(uint64_t d) {
+    if (d < 4) {
+        return d;
+    }
+    int k = 63 - __builtin_clzll(d);
+    int b = 4 + (k - 2) * 4 + ((d >> (k - 2)) & 3);
+    return b < MRC_BUCKETS ? b : MRC_BUCKETS - 1;
+}
+
+static void tree_add(uint32_t time, int delta) {
+    for (uint32_t i = time + 1; i <= MRC_CLOCK; i += i & -i) {
+        mrc->tree[i] += delta;
+    }
+}
+
+// Tracked pages last referenced before `time`
+static uint32_t tree_count(uint32_t time) {
+    uint32_t n = 0;
+    for (uint32_t i = time; i > 0; i -= i & -i) {
+        n += mrc->tree[i];
+    }
+    return n;
+}
+
+static uint32_t *table_slot(uintptr_t page) {
+    uint32_t i = mix(page) & (MRC_TABLE - 1);
+    while (mrc->table[i] != MRC_NONE && mrc->entries[mrc->table[i]].page != page) {
+        i = (i + 1) & (MRC_TABLE - 1);
+    }
+    return &mrc->table[i];
+}
+
+static void table_remove(uintptr_t page) {
+    uint32_t hole = table_slot(page) - mrc->table;
+    mrc->table[hole] = MRC_NONE;
+    // Shift later entries of the probe run back, so lookups never stop early
+    for (uint32_t i = (hole + 1) & (MRC_TABLE - 1); mrc->table[i] != MRC_NONE; i = (i + 1) & (MRC_TABLE - 1)) {
+        uint32_t home = mix(mrc->entries[mrc->table[i]].page) & (MRC_TABLE - 1);
+        if (((i - home) & (MRC_TABLE - 1)) >= ((i - hole) & (MRC_TABLE - 1))) {
+            mrc->table[hole] = mrc->table[i];
+            mrc->table[i] = MRC_NONE;
+            hole = i;
+        }
+    }
+}
+
+static void forget_time(uint32_t e) {
+    tree_add(mrc->entries[e].time, -1);
+    mrc->owner[mrc->entries[e].time] = MRC_NONE;
+}
+
+static void remove_entry(uint32_t e) {
+    forget_time(e);
+    table_remove(mrc->entries[e].page);
+    uint32_t last = --mrc->npages;
+    if (e != last) {
+        mrc->entries[e] = mrc->entries[last];
+        *table_slot(mrc->entries[e].page) = e;
+        mrc->owner[mrc->entries[e].time] = e;
+    }
+}
+
+// Makes room for a page by lowering the threshold past the largest hash.
+// Returns 0 if `hash` is still tracked afterwards.
+static int shrink_sample(uint32_t hash) {
+    uint32_t largest = hash;
+    for (uint32_t e = 0; e < mrc->npages; e++) {
+        if (mrc->entries[e].hash > largest) {
+            largest = mrc->entries[e].hash;
+        }
+    }
+    mrc->threshold = largest;
+    for (uint32_t e = 0; e < mrc->npages;) {
+        if (mrc->entries[e].hash >= largest) {
+            remove_entry(e);
+        } else {
+            e++;
+        }
+    }
+    return hash < largest ? 0 : -1;
+}
+
+// Packs the timestamps back into [0, npages), oldest first
+static void renumber() {
+    uint32_t next = 0;
+    for (uint32_t t = 0; t < MRC_CLOCK; t++) {
+        uint32_t e = mrc->owner[t];
+        if (e != MRC_NONE) {
+            mrc->owner[t] = MRC_NONE;
+            mrc->owner[next] = e;
+            mrc->entries[e].time = next++;
+        }
+    }
+    memset(mrc->tree, 0, sizeof(mrc->tree));
+    for (uint32_t t = 0; t < next; t++) {
+        tree_add(t, 1);
+    }
+    mrc->clock = next;
+}
+
+static void request_report(int sig) {
+    (void)sig;
+    report_requested = 1;
+}
+
+int mrc_init() {
+    mrc = mmap(NULL, sizeof(mrc_state_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mrc == MAP_FAILED) {
+        perror("Failed to allocate the miss-ratio curve");
+        return -1;
+    }
+    mrc->threshold = MRC_HASH_RANGE;
+    memset(mrc->table, 0xff, sizeof(mrc->table));
+    memset(mrc->owner, 0xff, sizeof(mrc->owner));
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_report;
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGUSR1, &sa, NULL) == -1) {
+        perror("Failed to set up SIGUSR1");
+        return -1;
+    }
+    return 0;
+}
+
+void mrc_access(uintptr_t page) {
+    uint32_t hash = mix(page) >> (64 - MRC_HASH_BITS);
+    if (hash >= mrc->threshold) {
+        return;
+    }
+    // Each tracked page stands for this many pages, and its references for
+    // this many references
+    double scale = (double)MRC_HASH_RANGE / mrc->threshold;
+    mrc->samples++;
+    mrc->refs += scale;
+
+    uint32_t *slot = table_slot(page);
+    uint32_t e = *slot;
+    if (e != MRC_NONE) {
+        // Reuse distance: tracked pages referenced since this one was
+        uint32_t since = mrc->npages - tree_count(mrc->entries[e].time + 1);
+        forget_time(e);
+        mrc->hist[bucket(since * scale)] += scale;
+    } else {
+        mrc->cold += scale;
+        if (mrc->npages == MRC_MAX_PAGES) {
+            if (shrink_sample(hash) != 0) {
+                return;
+            }
+            slot = table_slot(page);
+        }
+        e = mrc->npages;
+        mrc->entries[e].page = page;
+        mrc->entries[e].hash = hash;
+        *slot = e;
+        __atomic_store_n(&mrc->npages, e + 1, __ATOMIC_RELEASE);
+    }
+
+    if (mrc->clock == MRC_CLOCK) {
+        renumber();
+    }
+    mrc->entries[e].time = mrc->clock;
+    mrc->owner[mrc->clock] = e;
+    tree_add(mrc->clock++, 1);
+}
+
+size_t mrc_sampled(uintptr_t *pages, size_t max) {
+    size_t n = __atomic_load_n(&mrc->npages, __ATOMIC_ACQUIRE);
+    if (n > max) {
+        n = max;
+    }
+    for (size_t i = 0; i < n; i++) {
+        pages[i] = __atomic_load_n(&mrc->entries[i].page, __ATOMIC_RELAXED);
+    }
+    return n;
+}
+
+int mrc_requested() {
+    int requested = report_requested;
+    report_requested = 0;
+    return requested;
+}
+
+void mrc_report() {
+    printf("Miss-ratio curve: %lu references to %u tracked pages, about %.0f in all (%.2f%% sampled)\n",
+           mrc->samples, mrc->npages, mrc->refs, 100.0 * mrc->threshold / MRC_HASH_RANGE);
+    if (mrc->refs == 0.0) {
+        return;
+    }
+    printf("  %14s %16s %10s\n", "resident pages", "expected faults", "miss ratio");
+    // LRU with `size` pages misses every reference whose reuse distance is
+    // at least `size`
+    for (uint64_t size = 1; size < (1ULL << 40); size *= 2) {
+        double misses = mrc->cold, beyond = 0.0;
+        for (int b = bucket(size); b < MRC_BUCKETS; b++) {
+            beyond += mrc->hist[b];
+        }
+        misses += beyond;
+        printf("  %14lu %16.0f %9.2f%%\n", size, misses, 100.0 * misses / mrc->refs);
+        if (beyond == 0.0) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef MRC_H
+#define MRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Online miss-ratio curve, set by --mrc: how many faults the guest would
+ * have taken under LRU with each number of resident pages, which is what
+ * --max-resident caps. It only covers the pages --max-resident limits, the
+ * read-only ones of the executable.
+ *
+ * References come from faults, plus access sampling: every MRC_ARM_MS a
+ * pager thread protects the tracked pages that are present, and the fault
+ * handler records the next access to each before re-enabling it. That needs
+ * mprotect mode; with userfaultfd only faults, refaults after an eviction
+ * included, are seen.
+ *
+ * Reuse distances are estimated SHARDS-style: a page is tracked only if a
+ * hash of its address falls under a threshold, and distances between tracked
+ * pages are scaled up by the sampling rate. The sample starts with every page
+ * and is capped at MRC_MAX_PAGES by lowering the threshold, so memory use
+ * stays constant however large the guest is.
+ */
+
+#define MRC_MAX_PAGES 4096
+#define MRC_ARM_MS 20
+
+/**
+ * Sets up the curve in memory a forked reporter can read, and makes SIGUSR1
+ * ask for it to be printed. Returns 0, or -1 on failure.
+ */
+int mrc_init();
+
+/**
+ * Counts a reference to `page`. Only called by the one thread that resolves
+ * faults.
+ */
+void mrc_access(uintptr_t page);
+
+/**
+ * Copies up to `max` of the tracked pages into `pages` and returns how many
+ * it copied. Safe on any thread; a page that was just dropped from the sample
+ * may still show up.
+ */
+size_t mrc_sampled(uintptr_t *pages, size_t max);
+
+// Whether SIGUSR1 asked for the curve since the last call
+int mrc_requested();
+
+// Prints the curve so far. Not for the guest's thread.
+void mrc_report();
+
+#endif
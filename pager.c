@@ -0,0 +1,2678 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/auxv.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/personality.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <linux/userfaultfd.h>
+
+#include "checkpoint.h"
+#include "dedup.h"
+#include "psi.h"
+#include "heap.h"
+#include "hint.h"
+#include "image.h"
+#include "migrate.h"
+#include "mrc.h"
+#include "pager.h"
+#include "perf.h"
+#include "remote.h"
+#include "startup.h"
+#include "zeropool.h"
+
+#define PAGE_SIZE 4096
+
+// Pages the populator claims, fills and enables with a single call
+#define POPULATE_BATCH 16
+
+// Eager loading splits a segment into chunks of this many pages, read by up
+// to LOAD_MAX_WORKERS threads at once
+#define LOAD_CHUNK_PAGES 256
+#define LOAD_MAX_WORKERS 8
+
+segment_state_t *segments;
+int num_segments;
+int max_segments;
+
+// Every segment is reserved as one mapping at load time and faults only change
+// contents and protections inside it, so the number of VMAs follows the number
+// of segments instead of the number of pages touched.
+#define FAULTS_MPROTECT 0   // PROT_NONE reservation, SIGSEGV, enabled with mprotect
+#define FAULTS_UFFD 1       // accessible reservation, userfaultfd, UFFDIO_COPY
+int fault_mode = FAULTS_MPROTECT;
+int uffd = -1;              // shard 0's; the one checkpoints and migration use
+
+// Set by --uffd-threads=N: N threads serve faults, each from a userfaultfd of
+// its own that holds every Nth UFFD_STRIPE of the guest's address space
+#define UFFD_MAX_SHARDS 64
+_Static_assert(UFFD_MAX_SHARDS + 4 <= STATS_MAX_THREADS, "every fault thread needs a stats slot");
+_Static_assert(UFFD_MAX_SHARDS + 2 <= TRACE_MAX_RINGS, "every fault thread needs a trace ring");
+#define UFFD_STRIPE (2UL << 20)
+int uffd_shards = 1;
+int uffds[UFFD_MAX_SHARDS];
+// Set by --uffd-busy-poll: the fault threads spin on their userfaultfd rather
+// than sleep in poll, each on a CPU of its own
+int uffd_busy_poll = 0;
+unsigned char uffd_spins[UFFD_MAX_SHARDS];  // the threads that got a CPU to spin on
+// Serialises the policy's and the curve's bookkeeping between fault threads
+pthread_mutex_t policy_lock = PTHREAD_MUTEX_INITIALIZER;
+int mem_fd = -1;            // /proc/self/mem, lets pager threads fill PROT_NONE pages
+
+// Set by --background: a pager thread installs the remaining pages while the
+// guest runs.
+int background_populate = 0;
+unsigned long fault_seq;        // bumped on every fault
+int last_fault_segment = -1;    // segment of the most recent fault
+unsigned long fault_installs;   // pages installed on behalf of a fault
+
+// Set by --checkpoint=FILE
+char *checkpoint_path = NULL;
+unsigned checkpoint_interval_ms = 1000;
+
+// Set by --migrate-listen=SOCKET (source) and --migrate-from=SOCKET (destination)
+char *migrate_listen_path = NULL;
+char *migrate_from_path = NULL;
+
+// Set by --page-server=SOCKET: file pages come from a page server, not pread
+char *page_server_path = NULL;
+
+// Pages of a page-aligned image are mapped from it instead of copied, unless
+// checkpoints, migration or a page server need the guest in anonymous memory
+int map_image = 0;
+
+// Set by --stats: counters are published for pagerstat
+int publish_stats = 0;
+char *trace_path = NULL;
+stats_thread_t *guest_stats;
+trace_ring_t *guest_trace;
+
+// Set by --policy=NAME, or the pager's default
+pager_policy_t *policy;
+
+// Set by --max-resident=PAGES: once more read-only file pages than that are
+// present, the policy picks some to evict
+unsigned long max_resident = 0;
+unsigned long resident_pages;   // installed pages of evictable segments
+
+// Set by --heap: the guest's brk and anonymous mmap memory become pager
+// regions, paged like its segments
+int manage_heap = 0;
+
+// Set by --prepopulate: the pages the guest will likely touch before main are
+// installed before it starts, and a breakpoint on main reports how many of
+// them it used
+int prepopulate = 0;
+#define STARTUP_MAX_PAGES 4096
+uintptr_t startup_main;         // 0 once the breakpoint is gone, or if there is none
+unsigned char startup_main_byte;
+uint64_t startup_faults;        // faults of all threads when the guest started
+size_t startup_installed;
+
+// Set by --perf: hardware and kernel counters for the guest are printed when
+// it exits
+int count_perf = 0;
+
+// Set by --dedup[=NAME]: pages identical to ones in the store NAME, which
+// other pagers may share, are merged with them
+char *dedup_store = NULL;
+
+// Set by --reclaim[=MS]: once the host's tasks stall on memory for MS out of
+// every second, cold guest pages are demoted until the pressure clears
+unsigned reclaim_stall_ms = 0;
+#define RECLAIM_DEFAULT_STALL_MS 100
+#define RECLAIM_INTERVAL_MS 1000        // a page armed this long ago and not touched since is cold
+#define RECLAIM_CALM_PCT 1.0            // "some avg10" under which the pressure counts as cleared
+
+// Set by --hints: the guest can post access hints to a mailbox page, see hint.h
+int serve_hints = 0;
+
+// Set by --zero-pool[=PAGES]: zero-fill faults take pages a pager thread
+// allocated and zeroed ahead of time, see zeropool.h
+size_t zero_pool_pages = 0;
+
+// Set by --fault-profile=FILE: every fault the guest takes is appended to
+// FILE, kind and address, for faultorder to map back to functions
+int profile_fd = -1;
+
+// Set by --mrc: a miss-ratio curve of the read-only file pages is kept and
+// printed on SIGUSR1 and when the guest exits
+int build_mrc = 0;
+#define HEAP_BRK_PAGES (1UL << 18)      // 1 GiB the guest's break can grow into
+#define HEAP_MAX_REGIONS 256            // mmap regions at once; more go to the kernel
+segment_state_t *brk_segment;
+// Bytes of the guest's thread control block above fs that pager code reads
+#define GUEST_TCB_PREFETCH 4096
+uintptr_t guest_brk;
+uintptr_t guest_brk_floor;      // the break never goes below this
+// Held while heap regions change, and while the deduplicator or reclaimer scans one
+pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int open_userfaultfd() {
+    for (int i = 0; i < uffd_shards; i++) {
+        uffds[i] = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+        if (uffds[i] == -1) {
+            return -1;
+        }
+
+        // Checkpoints add write-protection on top of the missing-page faults,
+        // and --zero-pool moves pages in
+        struct uffdio_api api = { .api = UFFD_API, .features = (checkpoint_path ? CKPT_UFFD_FEATURES : 0) |
+                                                               (zero_pool_pages > 0 ? UFFD_FEATURE_MOVE : 0) };
+        if (ioctl(uffds[i], UFFDIO_API, &api) == -1) {
+            close(uffds[i]);
+            if (zero_pool_pages > 0) {
+                printf("No UFFDIO_MOVE before Linux 6.8, zero-fill faults go without the pool\n");
+                zero_pool_pages = 0;
+                i--;
+                continue;
+            }
+            return -1;
+        }
+    }
+    uffd = uffds[0];
+    fault_mode = FAULTS_UFFD;
+    return 0;
+}
+
+// The userfaultfd that serves `addr`
+int uffd_for(uintptr_t addr) {
+    return uffds[(addr / UFFD_STRIPE) % uffd_shards];
+}
+
+// The end of the stripe `at` lies in, or `end` if that comes first
+uintptr_t stripe_end(uintptr_t at, uintptr_t end) {
+    uintptr_t next = uffd_shards > 1 ? (at / UFFD_STRIPE + 1) * UFFD_STRIPE : end;
+    return next < end ? next : end;
+}
+
+// Registers [start, start + len) for missing-page faults, each stripe with its shard
+int uffd_register(uintptr_t start, size_t len) {
+    for (uintptr_t at = start, end; at < start + len; at = end) {
+        end = stripe_end(at, start + len);
+        struct uffdio_register reg = { .range = { .start = at, .len = end - at }, .mode = UFFDIO_REGISTER_MODE_MISSING };
+        if (ioctl(uffd_for(at), UFFDIO_REGISTER, &reg) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Fills [start, start + len) with the contents of `buf` through UFFDIO_COPY,
+ * or with zeroes if `buf` is NULL, and wakes whoever faulted on it. Pages
+ * already there are left as they are.
+ */
+int uffd_fill(uintptr_t start, size_t len, const char *buf) {
+    for (uintptr_t at = start, end; at < start + len; at = end) {
+        end = stripe_end(at, start + len);
+        struct uffdio_copy copy = { .dst = at, .src = (uintptr_t)buf + (at - start), .len = end - at, .mode = 0 };
+        struct uffdio_zeropage zero = { .range = { .start = at, .len = end - at }, .mode = 0 };
+        int rc = buf != NULL ? ioctl(uffd_for(at), UFFDIO_COPY, &copy) : ioctl(uffd_for(at), UFFDIO_ZEROPAGE, &zero);
+        if (rc == -1 && errno != EEXIST) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Wakes guest threads waiting on faults in [start, start + len)
+void uffd_wake(uintptr_t start, size_t len) {
+    for (uintptr_t at = start, end; at < start + len; at = end) {
+        end = stripe_end(at, start + len);
+        struct uffdio_range range = { .start = at, .len = end - at };
+        ioctl(uffd_for(at), UFFDIO_WAKE, &range);
+    }
+}
+
+/**
+ * Reserves the whole of `seg` now; nothing in it is accessible until a fault
+ * fills it, except through userfaultfd which traps instead. Ranges that are
+ * PROT_NONE for good are just reserved. A `seg->start` of 0 lets the kernel
+ * pick the address.
+ */
+int reserve_segment(segment_state_t *seg, size_t page_size) {
+    int prot = fault_mode == FAULTS_UFFD ? seg->prot : PROT_NONE;
+    void *region = mmap((void *)seg->start, seg->npages * page_size, prot,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+                            (seg->start != 0 ? MAP_FIXED_NOREPLACE : 0), -1, 0);
+    if (region == MAP_FAILED) {
+        perror("Failed to reserve segment");
+        return 1;
+    }
+    seg->start = (uintptr_t)region;
+
+    if (fault_mode == FAULTS_UFFD && seg->prot != PROT_NONE) {
+        if (uffd_register(seg->start, seg->npages * page_size) == -1) {
+            perror("Failed to register segment with userfaultfd");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Puts [page, page + len) of `seg` back the way reserve_segment left it
+int rereserve_pages(segment_state_t *seg, uintptr_t page, size_t len) {
+    int prot = fault_mode == FAULTS_UFFD ? seg->prot : PROT_NONE;
+    if (mmap((void *)page, len, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) ==
+        MAP_FAILED) {
+        return -1;
+    }
+    if (fault_mode == FAULTS_UFFD) {
+        return uffd_register(page, len);
+    }
+    return 0;
+}
+
+int init_segment_state() {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+
+    max_segments = elf_header.e_phnum + (manage_heap ? HEAP_MAX_REGIONS + 1 : 0);
+    segments = (segment_state_t *)calloc(max_segments, sizeof(segment_state_t));
+    if (segments == NULL) {
+        perror("Failed to allocate segment state");
+        return 1;
+    }
+
+    for (int i = 0; i < elf_header.e_phnum; i++) {
+        if (ph[i].p_type != PT_LOAD || ph[i].p_memsz == 0) {
+            continue;
+        }
+        segment_state_t *seg = &segments[num_segments];
+        uintptr_t end = (ph[i].p_vaddr + ph[i].p_memsz + page_size - 1) & ~(page_size - 1);
+        seg->phdr_index = i;
+        seg->start = ph[i].p_vaddr & ~(page_size - 1);
+        seg->npages = (end - seg->start) / page_size;
+        seg->prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+        seg->state = (unsigned char *)calloc(seg->npages, 1);
+        if (seg->state == NULL) {
+            perror("Failed to allocate page state");
+            return 1;
+        }
+        if (reserve_segment(seg, page_size) != 0) {
+            return 1;
+        }
+        stats_add_region(seg->start, end, ((ph[i].p_flags & PF_R) ? PROT_READ : 0) |
+                                          ((ph[i].p_flags & PF_W) ? PROT_WRITE : 0) |
+                                          ((ph[i].p_flags & PF_X) ? PROT_EXEC : 0));
+        TRACE(guest_trace, TR_RESERVE, seg->start, seg->npages);
+        printf("Reserved segment [%d]: %p - %p (%zu pages)\n", i, (void *)seg->start,
+               (void *)end, seg->npages);
+        num_segments++;
+    }
+    return 0;
+}
+
+// Returns the segment whose pages cover `addr`, or NULL.
+segment_state_t *find_segment(uintptr_t addr) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    int n = __atomic_load_n(&num_segments, __ATOMIC_ACQUIRE);
+    for (int s = 0; s < n; s++) {
+        if (addr >= segments[s].start && addr < segments[s].start + segments[s].npages * page_size) {
+            return &segments[s];
+        }
+    }
+    return NULL;
+}
+
+// Appends a fault of STATS_FAULT_* `kind` to the --fault-profile
+void profile_fault(uintptr_t addr, int kind) {
+    if (profile_fd >= 0) {
+        char line[32];
+        int len = snprintf(line, sizeof(line), "%c %#lx\n", "rwx"[kind], addr);
+        write(profile_fd, line, len);
+    }
+}
+
+// Publishes a fault so the populator can follow the guest's locality.
+void note_fault(segment_state_t *seg, uintptr_t page) {
+    seg->last_fault = page;
+    last_fault_segment = seg - segments;
+    __atomic_add_fetch(&fault_seq, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Reads `len` bytes at `offset` of the executable into `dst`. A single pread
+ * may return short, and never returns more than about 2 GiB, so it carries
+ * on until everything is in. Returns 0, or -1 on an error or end of file.
+ */
+int read_file_range(char *dst, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n;
+        if (image_loaded()) {
+            // The page server, if any, serves the image's compressed blocks
+            n = image_pread(dst, len, offset, page_server_path != NULL ? remote_pread : NULL);
+        } else {
+            n = page_server_path != NULL ? remote_pread(dst, len, offset) : pread(global_fd, dst, len, offset);
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        dst += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/**
+ * Reads the file-backed part of the `count` segment pages starting at `page`
+ * into `dst`. Bytes outside [p_vaddr, p_vaddr + p_filesz) are left untouched,
+ * so callers must pass zeroed memory. Returns the number of bytes read, or -1.
+ */
+ssize_t read_segment_pages(Elf64_Phdr *phdr, uintptr_t page, size_t count, char *dst, size_t page_size) {
+    uintptr_t file_end = phdr->p_vaddr + phdr->p_filesz;
+    uintptr_t lo = page > phdr->p_vaddr ? page : phdr->p_vaddr;
+    uintptr_t hi = page + count * page_size < file_end ? page + count * page_size : file_end;
+    if (lo >= hi) {
+        // pages lie entirely in the zero-filled (bss) part
+        return 0;
+    }
+
+    size_t len = hi - lo;
+    if (read_file_range(dst + (lo - page), len, phdr->p_offset + (lo - phdr->p_vaddr)) != 0) {
+        return -1;
+    }
+    return len;
+}
+
+// Whether page `idx` of `seg` starts out as zeroes: heap pages, and the bss
+// pages past the file data of a segment
+int zero_fill_page(segment_state_t *seg, size_t idx) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    if (seg->phdr_index == SEGMENT_HEAP) {
+        return 1;
+    }
+    return seg->phdr_index >= 0 &&
+           seg->start + idx * page_size >= ph[seg->phdr_index].p_vaddr + ph[seg->phdr_index].p_filesz;
+}
+
+// Reads a page from wherever its segment comes from: the ELF file, or the
+// source pager of a migrated guest. Heap pages start out zero.
+ssize_t read_page(segment_state_t *seg, uintptr_t page, void *dst, size_t page_size) {
+    if (seg->phdr_index == SEGMENT_HEAP) {
+        return 0;
+    }
+    if (seg->phdr_index == SEGMENT_FILE) {
+        return file_read_pages(seg, page, 1, dst, page_size);
+    }
+    if (seg->phdr_index == SEGMENT_MIGRATED) {
+        return migrate_fetch_page(page, dst);
+    }
+    return read_segment_pages(&ph[seg->phdr_index], page, 1, dst, page_size);
+}
+
+// The protection page `idx` of `seg` gets while present: clean pages of a
+// mapped file stay read-only, so the first write to one is seen
+int present_prot(segment_state_t *seg, size_t idx) {
+    return seg->phdr_index == SEGMENT_FILE && !file_page_dirty(seg, idx) ? seg->prot & ~PROT_WRITE : seg->prot;
+}
+
+// Publishes `count` pages starting at page `idx` of `seg` as installed
+void mark_present(segment_state_t *seg, size_t idx, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        __atomic_store_n(&seg->state[idx + i], PAGE_PRESENT, __ATOMIC_RELEASE);
+    }
+    if (segment_evictable(seg)) {
+        __atomic_add_fetch(&resident_pages, count, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Makes `count` claimed pages starting at page `idx` of `seg` accessible with
+ * the contents in `buf`, or zero-filled if `buf` is NULL. The pages only
+ * become visible once complete: through UFFDIO_COPY, or by writing them via
+ * /proc/self/mem while they are still PROT_NONE and then enabling the whole
+ * run with one mprotect. Safe to call from any pager thread.
+ */
+int map_pages(segment_state_t *seg, size_t idx, size_t count, char *buf, size_t page_size) {
+    uintptr_t page = seg->start + idx * page_size;
+    size_t len = count * page_size;
+
+    if (fault_mode == FAULTS_UFFD) {
+        if (uffd_fill(page, len, buf) != 0) {
+            return -1;
+        }
+    } else {
+        // Pages nobody installed yet were never written, so they are still zero
+        if ((buf != NULL && pwrite(mem_fd, buf, len, (off_t)page) != len) ||
+            mprotect((void *)page, len, present_prot(seg, idx)) == -1) {
+            return -1;
+        }
+    }
+
+    mark_present(seg, idx, count);
+    return 0;
+}
+
+/**
+ * Maps `count` claimed pages starting at page `idx` of `seg` straight from a
+ * page-aligned image, without copying them. Returns 1 if they were mapped,
+ * 0 if they must be filled the usual way, or -1 on an error.
+ */
+int map_from_image(segment_state_t *seg, size_t idx, size_t count, size_t page_size) {
+    uintptr_t page = seg->start + idx * page_size;
+    size_t stored;
+    off_t offset = map_image && seg->phdr_index >= 0 ? image_page_offset(page, &stored) : -1;
+    if (offset < 0 || stored < count) {
+        return 0;
+    }
+    if (mmap((void *)page, count * page_size, seg->prot, MAP_PRIVATE | MAP_FIXED, image_fd(), offset) ==
+        MAP_FAILED) {
+        if (errno != EACCES && errno != EPERM) {
+            return -1;
+        }
+        // On a noexec mount, say: the reservation is untouched, so copy instead
+        map_image = 0;
+        char msg[] = "Cannot map pages of the image, copying them instead\n";
+        write(STDERR_FILENO, msg, sizeof(msg) - 1);
+        return 0;
+    }
+    if (fault_mode == FAULTS_UFFD) {
+        // The guest may be waiting on the range the mapping replaced
+        uffd_wake(page, count * page_size);
+    }
+    mark_present(seg, idx, count);
+    return 1;
+}
+
+/**
+ * Fills `count` claimed pages starting at page `idx` of `seg` and makes them
+ * accessible. `buf` is scratch space of at least `count` pages. Returns the
+ * number of bytes read from the file, or -1.
+ */
+ssize_t install_pages(segment_state_t *seg, size_t idx, size_t count, char *buf, size_t page_size) {
+    uintptr_t page = seg->start + idx * page_size;
+    ssize_t total = 0;
+
+    // The page a guest thread is waiting on, if it is one of zeroes
+    if (count == 1 && zero_pool_pages > 0 && fault_mode == FAULTS_UFFD && zero_fill_page(seg, idx) &&
+        zeropool_move(uffd_for(page), page, seg->prot) == 0) {
+        mark_present(seg, idx, 1);
+        return 0;
+    }
+    if (seg->phdr_index == SEGMENT_HEAP) {
+        // Nothing to copy: zero pages, or untouched anonymous ones
+        return map_pages(seg, idx, count, NULL, page_size) == 0 ? 0 : -1;
+    }
+    int mapped = map_from_image(seg, idx, count, page_size);
+    if (mapped != 0) {
+        // Nothing was read: the pages come from the page cache as they are
+        return mapped > 0 ? 0 : -1;
+    }
+
+    if (page_server_path != NULL && !image_loaded() && seg->phdr_index >= 0 && count > 1) {
+        // Ask for the whole run at once instead of one round trip per page
+        Elf64_Phdr *phdr = &ph[seg->phdr_index];
+        uintptr_t lo = page > phdr->p_vaddr ? page : phdr->p_vaddr;
+        uintptr_t hi = page + count * page_size;
+        if (hi > phdr->p_vaddr + phdr->p_filesz) {
+            hi = phdr->p_vaddr + phdr->p_filesz;
+        }
+        if (lo < hi) {
+            remote_prefetch(phdr->p_offset + (lo - phdr->p_vaddr), hi - lo);
+        }
+    }
+    memset(buf, 0, count * page_size);
+    if (seg->phdr_index >= 0) {
+        // File pages are contiguous in the file too: one read for the run
+        total = read_segment_pages(&ph[seg->phdr_index], page, count, buf, page_size);
+        if (total < 0) {
+            return -1;
+        }
+    } else if (seg->phdr_index == SEGMENT_FILE) {
+        total = file_read_pages(seg, page, count, buf, page_size);
+        if (total < 0) {
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < count && seg->phdr_index < 0 && seg->phdr_index != SEGMENT_FILE; i++) {
+        ssize_t n = read_page(seg, page + i * page_size, buf + i * page_size, page_size);
+        if (n < 0) {
+            return -1;
+        }
+        total += n;
+    }
+    if (map_pages(seg, idx, count, buf, page_size) != 0) {
+        return -1;
+    }
+    return total;
+}
+
+/**
+ * Installs one claimed page for the thread that is about to use it: the guest
+ * inside its fault handler, or the pager before the guest starts. Nobody else
+ * can observe the page half-filled then, so in mprotect mode it is enabled
+ * first and read into directly. Exits the pager on failure, since the guest
+ * cannot continue without the page. Returns the number of file bytes read.
+ */
+ssize_t install_page_now(segment_state_t *seg, uintptr_t page, size_t page_size) {
+    char scratch[PAGE_SIZE];
+    ssize_t read_size;
+
+    int mapped = map_from_image(seg, (page - seg->start) / page_size, 1, page_size);
+    if (mapped != 0) {
+        if (mapped < 0) {
+            perror("Failed to map image page");
+            exit(1);
+        }
+        return 0;
+    }
+    // Other threads of an application may read a mapped file's page meanwhile
+    if (fault_mode == FAULTS_UFFD || seg->phdr_index == SEGMENT_FILE) {
+        read_size = install_pages(seg, (page - seg->start) / page_size, 1, scratch, page_size);
+    } else {
+        if (mprotect((void *)page, page_size, seg->prot | PROT_WRITE) == -1) {
+            perror("Failed to enable segment page");
+            exit(1);
+        }
+        read_size = read_page(seg, page, (void *)page, page_size);
+        if (!(seg->prot & PROT_WRITE)) {
+            mprotect((void *)page, page_size, seg->prot);
+        }
+        __atomic_store_n(&seg->state[(page - seg->start) / page_size], PAGE_PRESENT, __ATOMIC_RELEASE);
+        if (segment_evictable(seg)) {
+            __atomic_add_fetch(&resident_pages, 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (read_size < 0) {
+        perror("Failed to read segment data");
+        exit(1);
+    }
+    return read_size;
+}
+
+size_t install_now(segment_state_t *seg, size_t idx, size_t count) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    size_t installed = 0;
+    for (size_t i = idx; i < idx + count && i < seg->npages; i++) {
+        unsigned char expected = PAGE_ABSENT;
+        if (__atomic_compare_exchange_n(&seg->state[i], &expected, PAGE_INSTALLING, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            install_page_now(seg, seg->start + i * page_size, page_size);
+            installed++;
+        }
+    }
+    return installed;
+}
+
+int segment_evictable(segment_state_t *seg) {
+    // Dirty pages of a mapped file are written back before they go
+    return (seg->phdr_index >= 0 && !(ph[seg->phdr_index].p_flags & PF_W)) || seg->phdr_index == SEGMENT_FILE;
+}
+
+/**
+ * Drops the contents of a claimed page and reserves it again as absent.
+ * Disabled first in mprotect mode, so the page cannot be read half-dropped;
+ * with userfaultfd the dropped page simply faults as missing again. A page
+ * mapped from the image would just be read back from it, and is reserved
+ * again instead, as is one merged by --dedup. A dirty page of a mapped file
+ * is written back first.
+ */
+int drop_page(segment_state_t *seg, uintptr_t page) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    if (seg->phdr_index == SEGMENT_FILE && file_write_back(seg, (page - seg->start) / page_size) != 0) {
+        return -1;
+    }
+    if (map_image || dedup_store != NULL ? rereserve_pages(seg, page, page_size) == -1
+                  : (fault_mode == FAULTS_MPROTECT && mprotect((void *)page, page_size, PROT_NONE) == -1) ||
+                        madvise((void *)page, page_size, MADV_DONTNEED) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Drops a present page of an evictable segment; the next access faults it
+ * back in from the executable. A fault that finds the page being dropped
+ * waits for it to go absent, then faults again.
+ */
+int evict_page(segment_state_t *seg, size_t idx) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    uintptr_t page = seg->start + idx * page_size;
+    unsigned char expected = PAGE_PRESENT;
+    if (!segment_evictable(seg) ||
+        !__atomic_compare_exchange_n(&seg->state[idx], &expected, PAGE_INSTALLING, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    if (drop_page(seg, page) != 0) {
+        __atomic_store_n(&seg->state[idx], PAGE_PRESENT, __ATOMIC_RELEASE);
+        return -1;
+    }
+    __atomic_store_n(&seg->state[idx], PAGE_ABSENT, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&resident_pages, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// Evicts pages the policy picks until the guest is back under --max-resident.
+void enforce_resident_limit(stats_thread_t *st) {
+    while (max_resident > 0 && __atomic_load_n(&resident_pages, __ATOMIC_RELAXED) > max_resident) {
+        segment_state_t *seg;
+        size_t idx;
+        if (policy->evict == NULL || policy->evict(&seg, &idx) != 0 || evict_page(seg, idx) != 0) {
+            return;
+        }
+        st->pages_evicted++;
+    }
+}
+
+/**
+ * Re-enables a page the MRC sampler or the reclaimer protected, and counts
+ * the access that faulted on it for --mrc. Returns 0 if the page was not
+ * armed.
+ */
+int access_armed_page(segment_state_t *seg, size_t idx) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    uintptr_t page = seg->start + idx * page_size;
+    unsigned char expected = PAGE_ARMED;
+    if (!__atomic_compare_exchange_n(&seg->state[idx], &expected, PAGE_INSTALLING, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    if (mprotect((void *)page, page_size, present_prot(seg, idx)) == -1) {
+        perror("Failed to re-enable sampled page");
+        exit(1);
+    }
+    __atomic_store_n(&seg->state[idx], PAGE_PRESENT, __ATOMIC_RELEASE);
+    if (build_mrc) {
+        mrc_access(page);
+    }
+    return 1;
+}
+
+/**
+ * Access sampling for --mrc: protects the present pages the curve tracks,
+ * so the next access to each faults and is counted. Only read-only file
+ * pages are armed, the same ones --max-resident drops, and only in mprotect
+ * mode; userfaultfd cannot make a present page fault on reads. Also prints
+ * the curve when SIGUSR1 asks for it.
+ */
+void *mrc_sample_thread(void *arg) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    uintptr_t *pages = malloc(MRC_MAX_PAGES * sizeof(uintptr_t));
+    if (pages == NULL) {
+        perror("Failed to allocate sampled page list");
+        return NULL;
+    }
+    for (;;) {
+        usleep(MRC_ARM_MS * 1000);
+        if (mrc_requested()) {
+            mrc_report();
+            fflush(stdout);
+        }
+        if (fault_mode != FAULTS_MPROTECT) {
+            continue;
+        }
+        size_t n = mrc_sampled(pages, MRC_MAX_PAGES);
+        for (size_t i = 0; i < n; i++) {
+            segment_state_t *seg = find_segment(pages[i]);
+            if (seg == NULL || !segment_evictable(seg)) {
+                continue;
+            }
+            size_t idx = (pages[i] - seg->start) / page_size;
+            unsigned char expected = PAGE_PRESENT;
+            if (!__atomic_compare_exchange_n(&seg->state[idx], &expected, PAGE_INSTALLING, 0,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                continue;
+            }
+            int armed = mprotect((void *)pages[i], page_size, PROT_NONE) == 0;
+            __atomic_store_n(&seg->state[idx], armed ? PAGE_ARMED : PAGE_PRESENT, __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Offers a claimed page to the store, if its hash is still `hash`, and maps
+ * the store's copy over it once the store holds one. The page is made
+ * read-only first, so the guest cannot change it between the comparison and
+ * the mapping: a write meanwhile faults and waits for the page like any
+ * other install, then gets its own copy. `*slot` is as for dedup_find.
+ * Returns what dedup_find did, or -1 if the page changed or could not be
+ * mapped.
+ */
+int merge_page(segment_state_t *seg, uintptr_t page, uint64_t hash, int *slot) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    int rc = -1;
+    if (mprotect((void *)page, page_size, seg->prot & ~PROT_WRITE) == 0 &&
+        dedup_hash((void *)page, page_size) == hash) {
+        rc = dedup_find((void *)page, hash, slot);
+        if ((rc == DEDUP_FOUND || rc == DEDUP_ADDED) &&
+            mmap((void *)page, page_size, seg->prot, MAP_PRIVATE | MAP_FIXED, dedup_fd(), dedup_offset(*slot)) ==
+                MAP_FAILED) {
+            dedup_put(*slot);
+            rc = -1;
+        }
+    }
+    if (rc != DEDUP_FOUND && rc != DEDUP_ADDED) {
+        mprotect((void *)page, page_size, seg->prot);
+    }
+    return rc;
+}
+
+typedef struct {
+    uintptr_t start;
+    size_t npages;
+    uint64_t *hashes;       // of each page at the last pass, 0 if not present
+    unsigned char *merged;  // DEDUP_* below
+    int *slots;             // the store slot, or the note, of each page that is not private
+} dedup_scan_t;
+
+#define DEDUP_PRIVATE 0
+#define DEDUP_SEEN 1        // its hash is noted, nothing mapped
+#define DEDUP_MOVED 2       // merged into a slot it filled itself
+#define DEDUP_SHARED 3      // merged with a page the store already had
+
+// Lets go of the store's slot behind page `idx`, which is private again
+void dedup_unmerge(dedup_scan_t *scan, size_t idx, unsigned long *saved) {
+    if (scan->merged[idx] == DEDUP_SEEN) {
+        dedup_forget(scan->slots[idx]);
+    } else if (scan->merged[idx] != DEDUP_PRIVATE) {
+        dedup_put(scan->slots[idx]);
+    }
+    *saved -= scan->merged[idx] == DEDUP_SHARED;
+    scan->merged[idx] = DEDUP_PRIVATE;
+    scan->slots[idx] = -1;
+}
+
+/**
+ * Deduplication for --dedup: every DEDUP_INTERVAL_MS, hashes the present
+ * pages of every segment, and offers the ones that have not changed since
+ * the last pass to the store. Pages that keep changing are left alone, and a
+ * page that is written to or dropped gives its slot back.
+ */
+void *dedup_thread(void *arg) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    dedup_scan_t *scans = calloc(max_segments, sizeof(dedup_scan_t));
+    unsigned long saved = 0;
+    int full = 0;
+    if (scans == NULL) {
+        perror("Failed to allocate dedup state");
+        return NULL;
+    }
+    for (;;) {
+        usleep(DEDUP_INTERVAL_MS * 1000);
+        size_t merged = 0, no_room = 0;
+        int n = __atomic_load_n(&num_segments, __ATOMIC_ACQUIRE);
+        for (int s = 0; s < n; s++) {
+            segment_state_t *seg = &segments[s];
+            dedup_scan_t *scan = &scans[s];
+            pthread_mutex_lock(&heap_lock);
+            if (scan->start != seg->start || scan->npages != seg->npages) {
+                // A new segment, or a heap region in a reused slot: the old one is unmapped
+                for (size_t idx = 0; idx < scan->npages; idx++) {
+                    dedup_unmerge(scan, idx, &saved);
+                }
+                free(scan->hashes);
+                free(scan->merged);
+                free(scan->slots);
+                scan->start = seg->start;
+                scan->npages = seg->npages;
+                scan->hashes = calloc(seg->npages, sizeof(uint64_t));
+                scan->merged = calloc(seg->npages, 1);
+                scan->slots = malloc(seg->npages * sizeof(int));
+                if (scan->hashes == NULL || scan->merged == NULL || scan->slots == NULL) {
+                    scan->npages = 0;
+                }
+                for (size_t idx = 0; idx < scan->npages; idx++) {
+                    scan->slots[idx] = -1;
+                }
+            }
+            for (size_t idx = 0; idx < scan->npages && (seg->prot & PROT_READ); idx++) {
+                unsigned char expected = PAGE_PRESENT;
+                if (!__atomic_compare_exchange_n(&seg->state[idx], &expected, PAGE_INSTALLING, 0,
+                                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                    // Dropped: an armed page is still mapped from the store
+                    if (expected == PAGE_ABSENT) {
+                        dedup_unmerge(scan, idx, &saved);
+                    }
+                    scan->hashes[idx] = 0;
+                    continue;
+                }
+                uintptr_t page = seg->start + idx * page_size;
+                uint64_t hash = dedup_hash((void *)page, page_size);
+                if (hash != scan->hashes[idx]) {
+                    // Written to since: the guest has its own copy again
+                    dedup_unmerge(scan, idx, &saved);
+                } else if (scan->merged[idx] == DEDUP_PRIVATE || scan->merged[idx] == DEDUP_SEEN) {
+                    int seen = scan->slots[idx];
+                    int slot = seen;
+                    int rc = merge_page(seg, page, hash, &slot);
+                    if (rc == DEDUP_FOUND || rc == DEDUP_ADDED) {
+                        scan->merged[idx] = rc == DEDUP_FOUND ? DEDUP_SHARED : DEDUP_MOVED;
+                        saved += rc == DEDUP_FOUND;
+                        merged++;
+                    } else if (rc == DEDUP_NOTED) {
+                        scan->merged[idx] = DEDUP_SEEN;
+                    } else {
+                        scan->merged[idx] = DEDUP_PRIVATE;
+                        slot = -1;
+                    }
+                    // A note another pager turned into a page is the page's slot now
+                    if (seen >= 0 && seen != slot) {
+                        dedup_forget(seen);
+                    }
+                    scan->slots[idx] = slot;
+                    no_room += rc == DEDUP_FULL;
+                }
+                scan->hashes[idx] = hash;
+                __atomic_store_n(&seg->state[idx], PAGE_PRESENT, __ATOMIC_RELEASE);
+            }
+            pthread_mutex_unlock(&heap_lock);
+        }
+        if (no_room > 0 && !full) {
+            fprintf(stderr, "Dedup store /dev/shm/%s is full: %zu shared pages stay private until slots are "
+                    "freed\n", dedup_store, no_room);
+        }
+        full = no_room > 0;
+        if (merged > 0) {
+            printf("Deduplicated %zu pages; %lu KiB saved in all\n", merged, saved * page_size / 1024);
+            fflush(stdout);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Demotes a page the reclaimer found cold, claimed from armed. Clean pages of
+ * the executable are dropped, to be read back on their next fault. The rest
+ * may be dirty and are paged out to swap instead, compressed there if zswap
+ * or zram is set up, and stay armed so the next access is still seen.
+ * Returns 1 if the page was demoted now, 0 if it already was or cannot be.
+ */
+int demote_page(segment_state_t *seg, size_t idx) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    uintptr_t page = seg->start + idx * page_size;
+    if (segment_evictable(seg)) {
+        if (drop_page(seg, page) != 0) {
+            __atomic_store_n(&seg->state[idx], PAGE_ARMED, __ATOMIC_RELEASE);
+            return 0;
+        }
+        __atomic_store_n(&seg->state[idx], PAGE_ABSENT, __ATOMIC_RELEASE);
+        __atomic_sub_fetch(&resident_pages, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    // Without swap the kernel keeps anonymous pages however cold they are
+    unsigned char before = 0, after = 0;
+    int demoted = mincore((void *)page, page_size, &before) == 0 && (before & 1) &&
+                  madvise((void *)page, page_size, MADV_PAGEOUT) == 0 &&
+                  mincore((void *)page, page_size, &after) == 0 && !(after & 1);
+    __atomic_store_n(&seg->state[idx], PAGE_ARMED, __ATOMIC_RELEASE);
+    return demoted;
+}
+
+/**
+ * Static glibc puts the guest's TLS and thread descriptor at the start of its
+ * break, and the fault handler reads them through fs on the guest's thread.
+ * Reclaim leaves the pages below the returned address alone, or the handler
+ * would fault inside itself.
+ */
+uintptr_t guest_tls_end() {
+    size_t tls_size = 0;
+    for (int i = 0; i < elf_header.e_phnum; i++) {
+        if (ph[i].p_type == PT_TLS) {
+            tls_size = ph[i].p_memsz + ph[i].p_align;
+        }
+    }
+    return brk_segment != NULL ? brk_segment->start + tls_size + GUEST_TCB_PREFETCH : 0;
+}
+
+/**
+ * One pass of --reclaim over every segment. In mprotect mode, present pages
+ * are armed like the MRC sampler's, and pages still armed from the last pass
+ * have gone a whole interval untouched and are demoted. userfaultfd cannot
+ * make a present page fault, so there every present page is only marked cold
+ * for the kernel, which then reclaims the guest's pages before other work's.
+ */
+void reclaim_pass(size_t *dropped, size_t *paged_out) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    uintptr_t tls_end = guest_tls_end();
+    int n = __atomic_load_n(&num_segments, __ATOMIC_ACQUIRE);
+    for (int s = 0; s < n; s++) {
+        segment_state_t *seg = &segments[s];
+        pthread_mutex_lock(&heap_lock);
+        for (size_t idx = 0; idx < seg->npages; idx++) {
+            uintptr_t page = seg->start + idx * page_size;
+            if (seg == brk_segment && page < tls_end) {
+                continue;
+            }
+            unsigned char expected = fault_mode == FAULTS_MPROTECT ? PAGE_ARMED : PAGE_PRESENT;
+            if (!__atomic_compare_exchange_n(&seg->state[idx], &expected, PAGE_INSTALLING, 0,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                if (expected != PAGE_PRESENT) {
+                    continue;
+                }
+                // Present: arm it, to see whether it is still untouched next pass
+                if (!__atomic_compare_exchange_n(&seg->state[idx], &expected, PAGE_INSTALLING, 0,
+                                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                    continue;
+                }
+                int armed = mprotect((void *)page, page_size, PROT_NONE) == 0;
+                __atomic_store_n(&seg->state[idx], armed ? PAGE_ARMED : PAGE_PRESENT, __ATOMIC_RELEASE);
+            } else if (fault_mode == FAULTS_MPROTECT) {
+                int demoted = demote_page(seg, idx);
+                *dropped += demoted && segment_evictable(seg);
+                *paged_out += demoted && !segment_evictable(seg);
+            } else {
+                madvise((void *)page, page_size, MADV_COLD);
+                __atomic_store_n(&seg->state[idx], PAGE_PRESENT, __ATOMIC_RELEASE);
+            }
+        }
+        pthread_mutex_unlock(&heap_lock);
+    }
+}
+
+// Re-enables the pages reclaim armed, so a calm guest stops faulting on them
+void reclaim_disarm() {
+    int n = __atomic_load_n(&num_segments, __ATOMIC_ACQUIRE);
+    for (int s = 0; s < n; s++) {
+        pthread_mutex_lock(&heap_lock);
+        for (size_t idx = 0; idx < segments[s].npages; idx++) {
+            // Not counted as accesses for --mrc: nothing touched them
+            unsigned char expected = PAGE_ARMED;
+            if (__atomic_compare_exchange_n(&segments[s].state[idx], &expected, PAGE_INSTALLING, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                size_t page_size = sysconf(_SC_PAGE_SIZE);
+                mprotect((void *)(segments[s].start + idx * page_size), page_size, present_prot(&segments[s], idx));
+                __atomic_store_n(&segments[s].state[idx], PAGE_PRESENT, __ATOMIC_RELEASE);
+            }
+        }
+        pthread_mutex_unlock(&heap_lock);
+    }
+}
+
+/**
+ * Reclaim for --reclaim: sleeps on the memory pressure trigger, then runs a
+ * pass every RECLAIM_INTERVAL_MS until the trigger has stopped firing and
+ * the ten-second stall average is back under RECLAIM_CALM_PCT.
+ */
+void *reclaim_thread(void *arg) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    size_t dropped = 0, paged_out = 0;
+    int pressured = 0;
+    for (;;) {
+        if (pressured) {
+            usleep(RECLAIM_INTERVAL_MS * 1000);
+        }
+        int fired = psi_wait(pressured ? 0 : -1);
+        if (fired < 0) {
+            perror("Lost the memory pressure trigger");
+            return NULL;
+        }
+        if (!pressured && fired) {
+            pressured = 1;
+            dropped = paged_out = 0;
+            printf("Memory pressure (some avg10=%.2f%%): demoting cold guest pages\n", psi_some_avg10());
+            fflush(stdout);
+        }
+        if (!pressured) {
+            continue;
+        }
+        reclaim_pass(&dropped, &paged_out);
+        double avg10 = psi_some_avg10();
+        if (!fired && avg10 < RECLAIM_CALM_PCT) {
+            pressured = 0;
+            // The sampler's armed pages are its own to re-enable
+            if (!build_mrc) {
+                reclaim_disarm();
+            }
+            printf("Memory pressure cleared (some avg10=%.2f%%): %zu KiB dropped, %zu KiB paged out\n", avg10,
+                   dropped * page_size / 1024, paged_out * page_size / 1024);
+            fflush(stdout);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Installs the extra pages the policy wants along with a fault on page `idx`,
+ * or the guest's --hints ask for, then makes room if that went over the
+ * resident limit.
+ */
+void fault_around(segment_state_t *seg, size_t idx, stats_thread_t *st) {
+    size_t count = policy->fault_around != NULL ? policy->fault_around(seg, idx) : 1;
+    count = hint_fault_around(seg->start + idx * sysconf(_SC_PAGE_SIZE), count);
+    // Under a resident limit, keep fault-around from evicting the very pages
+    // it is meant to save faults on
+    if (max_resident > 0 && segment_evictable(seg) && count > max_resident / 2) {
+        count = max_resident / 2 > 0 ? max_resident / 2 : 1;
+    }
+    if (count > 1) {
+        size_t extra = install_now(seg, idx + 1, count - 1);
+        st->pages_installed += extra;
+        st->pages_prefetched += extra;
+    }
+    enforce_resident_limit(st);
+}
+
+/**
+ * Static glibc applies RELRO itself with mprotect, which would otherwise
+ * protect pages that hold nothing yet. Install those pages up front.
+ */
+void install_relro_pages() {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+
+    for (int i = 0; i < elf_header.e_phnum; i++) {
+        if (ph[i].p_type != PT_GNU_RELRO) {
+            continue;
+        }
+        uintptr_t lo = ph[i].p_vaddr & ~(page_size - 1);
+        uintptr_t hi = ph[i].p_vaddr + ph[i].p_memsz;
+        for (uintptr_t page = lo; page < hi; page += page_size) {
+            segment_state_t *seg = find_segment(page);
+            if (seg != NULL && seg->state[(page - seg->start) / page_size] == PAGE_ABSENT) {
+                guest_stats->bytes_read += install_page_now(seg, page, page_size);
+                guest_stats->pages_installed++;
+                guest_stats->pages_prefetched++;
+            }
+        }
+        printf("Installed RELRO pages: %p - %p\n", (void *)lo, (void *)hi);
+    }
+}
+
+void segv_handler(int sig, siginfo_t *info, void *ucontext) {
+    // Set when a fault on a present page was retried once already
+    static void *retried_addr;
+
+    uint64_t begin = stats_now();
+
+    // Access the faulting address from the siginfo_t structure
+    void *fault_addr = info->si_addr;
+
+    // Determine the system's page size for memory mapping
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+
+    // Calculate the page-aligned address of the faulting page
+    uintptr_t page_aligned_fault_addr = (uintptr_t)fault_addr & ~(page_size - 1);
+    segment_state_t *seg = find_segment(page_aligned_fault_addr);
+
+    if (seg != NULL) {
+        size_t idx = (page_aligned_fault_addr - seg->start) / page_size;
+        unsigned char *state = &seg->state[idx];
+        // Access sampling for --mrc, not a fault the guest would take otherwise
+        if (access_armed_page(seg, idx)) {
+            profile_fault((uintptr_t)fault_addr, stats_segv_kind(info, ucontext));
+            guest_stats->handler_ns += stats_now() - begin;
+            return;
+        }
+        // The first write to a clean page of a mapped file
+        if (seg->phdr_index == SEGMENT_FILE && stats_segv_kind(info, ucontext) == STATS_FAULT_WRITE &&
+            file_write_fault(seg, idx)) {
+            guest_stats->handler_ns += stats_now() - begin;
+            return;
+        }
+        note_fault(seg, page_aligned_fault_addr);
+        profile_fault((uintptr_t)fault_addr, stats_segv_kind(info, ucontext));
+        stats_fault(guest_stats, page_aligned_fault_addr, stats_segv_kind(info, ucontext));
+        TRACE(guest_trace, TR_FAULT, fault_addr, stats_segv_kind(info, ucontext));
+
+        unsigned char expected = PAGE_ABSENT;
+        if (__atomic_compare_exchange_n(state, &expected, PAGE_INSTALLING, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            ssize_t read_size = install_page_now(seg, page_aligned_fault_addr, page_size);
+            fault_installs++;
+            if (zero_pool_pages > 0 && zero_fill_page(seg, idx)) {
+                zeropool_used();
+            }
+            retried_addr = NULL;
+            if (build_mrc && segment_evictable(seg)) {
+                mrc_access(page_aligned_fault_addr);
+            }
+            guest_stats->pages_installed++;
+            if (seg->phdr_index >= 0) {
+                guest_stats->bytes_read += read_size;
+            }
+            // An application's threads fault at once; a guest has one
+            if (mapped_files > 0) {
+                pthread_mutex_lock(&policy_lock);
+            }
+            fault_around(seg, idx, guest_stats);
+            if (mapped_files > 0) {
+                pthread_mutex_unlock(&policy_lock);
+            }
+            guest_stats->handler_ns += stats_now() - begin;
+            TRACE(guest_trace, TR_INSTALL, page_aligned_fault_addr, read_size);
+            return;
+        }
+
+        // Another pager thread owns this page; wait for it to land, then retry the access
+        TRACE(guest_trace, TR_WAIT, page_aligned_fault_addr, expected);
+        unsigned char now;
+        while ((now = __atomic_load_n(state, __ATOMIC_ACQUIRE)) != PAGE_PRESENT) {
+            // An armed page, or one the reclaimer dropped: the retried access
+            // faults on it afresh
+            if (access_armed_page(seg, idx) || now == PAGE_ABSENT) {
+                guest_stats->handler_ns += stats_now() - begin;
+                return;
+            }
+            sched_yield();
+        }
+        if (expected == PAGE_INSTALLING || retried_addr != fault_addr) {
+            // The page may have been enabled after the fault was raised
+            retried_addr = fault_addr;
+            guest_stats->handler_ns += stats_now() - begin;
+            TRACE(guest_trace, TR_RETRY, page_aligned_fault_addr, expected);
+            return;
+        }
+        // The page was present and faulted again: a genuine access violation
+    }
+
+    if (mapped_files > 0) {
+        // The application's own bug: let it crash as it would have
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+    fprintf(stderr, "Invalid memory access at address: %p\n", fault_addr);
+    fprintf(stderr, "Fault address does not fall within any loadable segment\n");
+    exit(1);
+}
+
+// void force_seg_fault() {
+//   int *zero = NULL;
+//   return *zero;
+// }
+
+void setup_signal_handler() {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(struct sigaction));
+  sa.sa_sigaction = segv_handler;
+  // Runs on the alternate stack when there is one: a migrated guest's stack
+  // is not there yet either
+  sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  if (sigaction(SIGSEGV, &sa, NULL) == -1) {
+    perror("Failed to set up signal handler");
+    exit(1);
+  }
+}
+
+/**
+ * Serves the guest's userfaultfd faults on the shard `arg`. The guest thread
+ * stays blocked in the kernel until the page is copied in, so the pager never
+ * runs on the guest's stack in this mode.
+ */
+void *uffd_service_thread(void *arg) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    int shard = (intptr_t)arg;
+    int fd = uffds[shard];
+    char name[16];
+    snprintf(name, sizeof(name), uffd_shards > 1 ? "uffd%d" : "uffd", shard);
+    stats_thread_t *st = stats_thread(name);
+    trace_ring_t *tr = trace_thread(name);
+    char *buf = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (buf == MAP_FAILED) {
+        perror("Failed to allocate userfaultfd buffer");
+        exit(1);
+    }
+
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    for (;;) {
+        // Busy-polling, the read simply fails until a fault is queued
+        if (!uffd_spins[shard] && poll(&pfd, 1, -1) == -1) {
+            continue;
+        }
+        struct uffd_msg msg;
+        if (read(fd, &msg, sizeof(msg)) != sizeof(msg) || msg.event != UFFD_EVENT_PAGEFAULT) {
+            continue;
+        }
+        if (msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP) {
+            checkpoint_write_fault(msg.arg.pagefault.address);
+            continue;
+        }
+
+        uint64_t begin = stats_now();
+        uintptr_t page = msg.arg.pagefault.address & ~(page_size - 1);
+        segment_state_t *seg = find_segment(page);
+        if (seg == NULL) {
+            continue;
+        }
+        note_fault(seg, page);
+        profile_fault(msg.arg.pagefault.address,
+                      (msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WRITE) ? STATS_FAULT_WRITE : STATS_FAULT_READ);
+        stats_fault(st, page, (msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WRITE) ? STATS_FAULT_WRITE
+                                                                                    : STATS_FAULT_READ);
+        TRACE(tr, TR_FAULT, msg.arg.pagefault.address,
+              (msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WRITE) ? STATS_FAULT_WRITE : STATS_FAULT_READ);
+
+        size_t idx = (page - seg->start) / page_size;
+        unsigned char expected = PAGE_ABSENT;
+        if (__atomic_compare_exchange_n(&seg->state[idx], &expected, PAGE_INSTALLING, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            ssize_t read_size = install_pages(seg, idx, 1, buf, page_size);
+            if (read_size < 0) {
+                perror("Failed to install segment page");
+                exit(1);
+            }
+            __atomic_add_fetch(&fault_installs, 1, __ATOMIC_RELAXED);
+            st->pages_installed++;
+            if (seg->phdr_index >= 0) {
+                st->bytes_read += read_size;
+            }
+            if (uffd_shards > 1) {
+                pthread_mutex_lock(&policy_lock);
+            }
+            if (build_mrc && segment_evictable(seg)) {
+                mrc_access(page);
+            }
+            fault_around(seg, idx, st);
+            if (uffd_shards > 1) {
+                pthread_mutex_unlock(&policy_lock);
+            }
+            st->handler_ns += stats_now() - begin;
+            TRACE(tr, TR_INSTALL, page, read_size);
+            continue;
+        }
+
+        // The populator's UFFDIO_COPY wakes the guest; make sure of it once the page is in
+        TRACE(tr, TR_WAIT, page, expected);
+        unsigned char now;
+        while ((now = __atomic_load_n(&seg->state[idx], __ATOMIC_ACQUIRE)) != PAGE_PRESENT) {
+            // Dropped for a DONTNEED hint while the guest already faulted on it
+            expected = PAGE_ABSENT;
+            if (now == PAGE_ABSENT && __atomic_compare_exchange_n(&seg->state[idx], &expected, PAGE_INSTALLING, 0,
+                                                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                if (install_pages(seg, idx, 1, buf, page_size) < 0) {
+                    perror("Failed to install segment page");
+                    exit(1);
+                }
+                break;
+            }
+            sched_yield();
+        }
+        uffd_wake(page, page_size);
+        st->handler_ns += stats_now() - begin;
+    }
+    return NULL;
+}
+
+/**
+ * Installs the absent pages [first, end) of `seg` for a WILLNEED hint, in
+ * runs of up to POPULATE_BATCH pages through `buf`. Under --max-resident no
+ * more than half the limit is installed, as with fault-around.
+ */
+void hint_install(segment_state_t *seg, size_t first, size_t end, char *buf, stats_thread_t *st) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    size_t budget = max_resident > 0 && segment_evictable(seg) ? max_resident / 2 : end - first;
+    for (size_t idx = first; idx < end && budget > 0;) {
+        size_t count = claim_run(seg, idx, end - idx < POPULATE_BATCH ? end - idx : POPULATE_BATCH);
+        if (count == 0) {
+            idx++;
+            continue;
+        }
+        ssize_t read_size = install_pages(seg, idx, count, buf, page_size);
+        if (read_size < 0) {
+            // Leave them to the fault handler
+            for (size_t i = 0; i < count; i++) {
+                __atomic_store_n(&seg->state[idx + i], PAGE_ABSENT, __ATOMIC_RELEASE);
+            }
+            return;
+        }
+        st->pages_installed += count;
+        st->pages_prefetched += count;
+        st->bytes_read += read_size;
+        budget = count < budget ? budget - count : 0;
+        idx += count;
+    }
+}
+
+/**
+ * Gives back the present pages [first, end) of `seg` for a DONTNEED hint.
+ * Clean file pages are dropped and read back on their next fault. Any other
+ * page may hold data only the guest has, so it is paged out instead, which
+ * needs swap; the hint never changes what the guest reads.
+ */
+void hint_release(segment_state_t *seg, size_t first, size_t end, stats_thread_t *st) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    if (!segment_evictable(seg)) {
+        madvise((void *)(seg->start + first * page_size), (end - first) * page_size, MADV_PAGEOUT);
+        return;
+    }
+    for (size_t idx = first; idx < end; idx++) {
+        if (evict_page(seg, idx) == 0) {
+            st->pages_evicted++;
+        }
+    }
+}
+
+/**
+ * Acts on the guest's --hints. WILLNEED and DONTNEED ranges are handled right
+ * here in every segment they overlap; SEQUENTIAL, RANDOM and NORMAL are
+ * remembered for fault_around. Runs alongside the guest's libc, so it must
+ * not touch malloc or stdio.
+ */
+void *hint_thread(void *arg) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    stats_thread_t *st = stats_thread("hints");
+    char *buf = mmap(NULL, POPULATE_BATCH * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (buf == MAP_FAILED) {
+        perror("Failed to allocate hint buffer");
+        exit(1);
+    }
+
+    hint_record_t hint;
+    for (;;) {
+        if (!hint_next(&hint, -1)) {
+            continue;
+        }
+        if (hint.advice != HINT_WILLNEED && hint.advice != HINT_DONTNEED) {
+            hint_note_range(&hint);
+            continue;
+        }
+        uintptr_t lo = hint.addr & ~(page_size - 1);
+        uintptr_t hi = hint.len < UINTPTR_MAX - hint.addr ? hint.addr + hint.len : UINTPTR_MAX;
+        int n = __atomic_load_n(&num_segments, __ATOMIC_ACQUIRE);
+        for (int s = 0; s < n; s++) {
+            segment_state_t *seg = &segments[s];
+            // Heap regions stay put while this is held
+            pthread_mutex_lock(&heap_lock);
+            uintptr_t seg_end = seg->start + seg->npages * page_size;
+            if (seg->npages > 0 && lo < seg_end && hi > seg->start) {
+                size_t first = lo > seg->start ? (lo - seg->start) / page_size : 0;
+                size_t end = hi < seg_end ? (hi - seg->start + page_size - 1) / page_size : seg->npages;
+                if (hint.advice == HINT_WILLNEED) {
+                    hint_install(seg, first, end, buf, st);
+                } else {
+                    hint_release(seg, first, end, st);
+                }
+            }
+            pthread_mutex_unlock(&heap_lock);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * mprotect mode's zero pool: faults in the next zero_pool_pages zero-fill
+ * pages after the guest's latest fault while they are still PROT_NONE and
+ * absent, through /proc/self/mem. The kernel has allocated and zeroed them
+ * by the time the guest gets there, so its fault only has to enable them.
+ * Heap pages past the break are left alone, since the guest cannot reach them.
+ */
+void prefault_zero_pages() {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    int s = __atomic_load_n(&last_fault_segment, __ATOMIC_ACQUIRE);
+    if (s < 0) {
+        return;
+    }
+    pthread_mutex_lock(&heap_lock);
+    segment_state_t *seg = &segments[s];
+    size_t end = seg->npages;
+    if (seg == brk_segment && (guest_brk - seg->start + page_size - 1) / page_size < end) {
+        end = (guest_brk - seg->start + page_size - 1) / page_size;
+    }
+    size_t idx = seg->last_fault >= seg->start ? (seg->last_fault - seg->start) / page_size + 1 : 0;
+    for (size_t n = 0; idx < end && n < zero_pool_pages; idx++) {
+        unsigned char expected = PAGE_ABSENT;
+        if (!zero_fill_page(seg, idx) ||
+            !__atomic_compare_exchange_n(&seg->state[idx], &expected, PAGE_INSTALLING, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        // A fault meanwhile waits for the page to go absent again, then retries
+        void *page = (void *)(seg->start + idx * page_size);
+        unsigned char resident = 0;
+        char zero = 0;
+        if (mincore(page, page_size, &resident) == 0 && !(resident & 1)) {
+            pwrite(mem_fd, &zero, 1, (off_t)(uintptr_t)page);
+        }
+        __atomic_store_n(&seg->state[idx], PAGE_ABSENT, __ATOMIC_RELEASE);
+        n++;
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+// Keeps the --zero-pool topped up. Must not touch malloc or stdio.
+void *zero_refill_thread(void *arg) {
+    for (;;) {
+        zeropool_wait(ZEROPOOL_IDLE_MS);
+        if (fault_mode == FAULTS_MPROTECT) {
+            prefault_zero_pages();
+        }
+        zeropool_refill();
+    }
+    return NULL;
+}
+
+// Returns the first absent page at or after `from`, wrapping around once, or
+// seg->npages if every page of the segment is already installed.
+size_t next_absent_page(segment_state_t *seg, size_t from) {
+    for (size_t n = 0; n < seg->npages; n++) {
+        size_t idx = (from + n) % seg->npages;
+        if (__atomic_load_n(&seg->state[idx], __ATOMIC_ACQUIRE) == PAGE_ABSENT) {
+            return idx;
+        }
+    }
+    return seg->npages;
+}
+
+// Claims up to `max` consecutive absent pages starting at `idx` and returns
+// how many were claimed.
+size_t claim_run(segment_state_t *seg, size_t idx, size_t max) {
+    size_t n = 0;
+    while (n < max && idx + n < seg->npages) {
+        unsigned char expected = PAGE_ABSENT;
+        if (!__atomic_compare_exchange_n(&seg->state[idx + n], &expected, PAGE_INSTALLING, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+typedef struct {
+    segment_state_t *seg;
+    size_t next;                // first page of the next chunk to hand out
+    size_t end;
+    size_t installed;
+    size_t bytes_read;
+} load_job_t;
+
+/**
+ * Loads chunks of a segment until none are left. In mprotect mode the whole
+ * range is writable while loading, so the file is read straight into the
+ * guest's memory; with userfaultfd it goes through a buffer and UFFDIO_COPY.
+ */
+void *load_worker(void *arg) {
+    load_job_t *job = arg;
+    segment_state_t *seg = job->seg;
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    char *buf = NULL;
+    if (fault_mode == FAULTS_UFFD) {
+        buf = mmap(NULL, LOAD_CHUNK_PAGES * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (buf == MAP_FAILED) {
+            perror("Failed to allocate load buffer");
+            exit(1);
+        }
+    }
+
+    size_t chunk;
+    while ((chunk = __atomic_fetch_add(&job->next, LOAD_CHUNK_PAGES, __ATOMIC_RELAXED)) < job->end) {
+        size_t chunk_end = chunk + LOAD_CHUNK_PAGES < job->end ? chunk + LOAD_CHUNK_PAGES : job->end;
+        for (size_t idx = chunk; idx < chunk_end;) {
+            size_t n = claim_run(seg, idx, chunk_end - idx);
+            if (n == 0) {
+                idx++;
+                continue;
+            }
+            uintptr_t page = seg->start + idx * page_size;
+            ssize_t read_size;
+            if (fault_mode == FAULTS_UFFD) {
+                read_size = install_pages(seg, idx, n, buf, page_size);
+            } else {
+                read_size = read_segment_pages(&ph[seg->phdr_index], page, n, (char *)page, page_size);
+                for (size_t i = 0; i < n; i++) {
+                    __atomic_store_n(&seg->state[idx + i], PAGE_PRESENT, __ATOMIC_RELEASE);
+                }
+                if (segment_evictable(seg)) {
+                    __atomic_add_fetch(&resident_pages, n, __ATOMIC_RELAXED);
+                }
+            }
+            if (read_size < 0) {
+                perror("Failed to read segment data");
+                exit(1);
+            }
+            __atomic_add_fetch(&job->installed, n, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&job->bytes_read, read_size, __ATOMIC_RELAXED);
+            idx += n;
+        }
+    }
+    if (buf != NULL) {
+        munmap(buf, LOAD_CHUNK_PAGES * page_size);
+    }
+    return NULL;
+}
+
+size_t install_parallel(segment_state_t *seg, size_t idx, size_t count) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    if (idx >= seg->npages) {
+        return 0;
+    }
+    if (count > seg->npages - idx) {
+        count = seg->npages - idx;
+    }
+    if (seg->phdr_index < 0) {
+        return install_now(seg, idx, count);
+    }
+    // Cold reads wait on the disk rather than the CPU, so the pool is sized
+    // by the work, not the CPU count
+    size_t workers = (count + LOAD_CHUNK_PAGES - 1) / LOAD_CHUNK_PAGES;
+    if (workers > LOAD_MAX_WORKERS) {
+        workers = LOAD_MAX_WORKERS;
+    }
+
+    // The guest is not running, so the range can stay writable until loaded
+    void *start = (void *)(seg->start + idx * page_size);
+    if (fault_mode == FAULTS_MPROTECT && mprotect(start, count * page_size, seg->prot | PROT_WRITE) == -1) {
+        perror("Failed to enable segment for loading");
+        exit(1);
+    }
+    TRACE(guest_trace, TR_LOAD_SEGMENT, seg->start + idx * page_size, count * page_size);
+    load_job_t job = { .seg = seg, .next = idx, .end = idx + count };
+    pthread_t threads[LOAD_MAX_WORKERS];
+    size_t started = 0;
+    // This thread is one of the workers
+    while (started + 1 < workers && pthread_create(&threads[started], NULL, load_worker, &job) == 0) {
+        started++;
+    }
+    load_worker(&job);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (fault_mode == FAULTS_MPROTECT && mprotect(start, count * page_size, seg->prot) == -1) {
+        perror("Failed to protect loaded segment");
+        exit(1);
+    }
+    guest_stats->bytes_read += job.bytes_read;
+    printf("Loaded segment [%d] pages %zu - %zu with %zu threads\n", seg->phdr_index, idx, idx + count,
+           started + 1);
+    return job.installed;
+}
+
+// Counts the mappings in /proc/self/maps without using stdio or malloc.
+int count_vmas() {
+    int fd = open("/proc/self/maps", O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    char buf[4096];
+    ssize_t n;
+    int lines = 0;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            lines += buf[i] == '\n';
+        }
+    }
+    close(fd);
+    return lines;
+}
+
+/**
+ * Background populator: eagerly installs every page the guest has not faulted
+ * on yet, in runs of up to POPULATE_BATCH pages. Segments are visited in the
+ * policy's prefetch_rank() order, but whenever the guest faults the populator jumps
+ * to just after that fault, since the guest is likely to keep walking forward
+ * from there.
+ *
+ * This thread runs concurrently with the guest's libc, so it must not touch
+ * malloc or stdio.
+ */
+void *populate_thread(void *arg) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    stats_thread_t *st = stats_thread("populator");
+    trace_ring_t *tr = trace_thread("populator");
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    char *buf = mmap(NULL, POPULATE_BATCH * page_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANON, -1, 0);
+    int order[num_segments > 0 ? num_segments : 1];
+    int nordered = 0;
+    for (int i = 0; i < num_segments; i++) {
+        if (segments[i].phdr_index == SEGMENT_HEAP) {
+            continue;
+        }
+        int j = nordered++;
+        while (j > 0 && policy->prefetch_rank(&segments[order[j - 1]]) >
+                            policy->prefetch_rank(&segments[i])) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    unsigned long installed = 0, seen_seq = 0;
+    int failed = buf == MAP_FAILED;
+    int k = 0;
+    segment_state_t *seg = nordered > 0 && !failed ? &segments[order[0]] : NULL;
+    size_t cursor = 0;
+
+    while (seg != NULL) {
+        unsigned long seq = __atomic_load_n(&fault_seq, __ATOMIC_ACQUIRE);
+        // Heap regions come and go with the guest's mmap and munmap, and
+        // are never populated in the background
+        if (seq != seen_seq && segments[last_fault_segment].phdr_index != SEGMENT_HEAP) {
+            seen_seq = seq;
+            seg = &segments[last_fault_segment];
+            cursor = (seg->last_fault - seg->start) / page_size + 1;
+        }
+
+        size_t idx = next_absent_page(seg, cursor);
+        if (idx == seg->npages) {
+            // This segment is complete; move on to the next one in priority order
+            seg = NULL;
+            for (; k < nordered && seg == NULL; k++) {
+                if (next_absent_page(&segments[order[k]], 0) < segments[order[k]].npages) {
+                    seg = &segments[order[k]];
+                }
+            }
+            cursor = 0;
+            continue;
+        }
+
+        size_t count = claim_run(seg, idx, POPULATE_BATCH);
+        TRACE(tr, TR_POPULATE, seg->start + idx * page_size, count);
+        ssize_t read_size = count > 0 ? install_pages(seg, idx, count, buf, page_size) : 0;
+        if (read_size < 0) {
+            // Leave the rest to the fault handler
+            for (size_t i = 0; i < count; i++) {
+                __atomic_store_n(&seg->state[idx + i], PAGE_ABSENT, __ATOMIC_RELEASE);
+            }
+            failed = 1;
+            break;
+        }
+        installed += count;
+        st->pages_installed += count;
+        st->pages_prefetched += count;
+        st->bytes_read += read_size;
+        cursor = idx + (count > 0 ? count : 1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    char msg[256];
+    int len = snprintf(msg, sizeof(msg),
+                       "Background population %s: %lu pages installed, %lu by faults, %d VMAs, %.3f ms\n",
+                       failed ? "stopped early" : "complete", installed,
+                       __atomic_load_n(&fault_installs, __ATOMIC_RELAXED), count_vmas(),
+                       (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6);
+    write(STDOUT_FILENO, msg, len);
+    return NULL;
+}
+
+/**
+ * Pins the populator to a CPU other than the one the guest is running on, and
+ * keeps the guest where it is. With a single usable CPU both just share it.
+ */
+void pin_to_spare_cpu(pthread_t thread) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1 || CPU_COUNT(&allowed) < 2) {
+    printf("No spare CPU for the populator, sharing the guest's CPU\n");
+    return;
+  }
+
+  int guest_cpu = sched_getcpu();
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (cpu == guest_cpu || !CPU_ISSET(cpu, &allowed)) {
+      continue;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    // Only the populator is pinned: the guest inherits this thread's affinity
+    pthread_setaffinity_np(thread, sizeof(set), &set);
+    printf("Populator pinned to CPU %d, guest started on CPU %d\n", cpu, guest_cpu);
+    return;
+  }
+}
+
+int start_thread(void *(*fn)(void *), pthread_t *thread) {
+  int err = pthread_create(thread, NULL, fn, NULL);
+  if (err != 0) {
+    fprintf(stderr, "Failed to start pager thread: %s\n", strerror(err));
+    return 1;
+  }
+  pthread_detach(*thread);
+  return 0;
+}
+
+/**
+ * Starts a fault thread for each userfaultfd shard. Busy-polling ones are
+ * pinned to CPUs of their own, away from the one the guest starts on. Once
+ * there are no CPUs to spare the rest sleep in poll after all: spinning on a
+ * CPU the guest needs would only slow it down.
+ */
+int start_uffd_service() {
+  cpu_set_t allowed;
+  int guest_cpu = sched_getcpu();
+  int cpu = -1;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+    CPU_ZERO(&allowed);
+  }
+  for (int i = 0; i < uffd_shards; i++) {
+    while (uffd_busy_poll && ++cpu < CPU_SETSIZE && (cpu == guest_cpu || !CPU_ISSET(cpu, &allowed))) {
+    }
+    uffd_spins[i] = uffd_busy_poll && cpu < CPU_SETSIZE;
+    if (uffd_busy_poll && !uffd_spins[i]) {
+      printf("No spare CPU for fault thread %d to spin on, it polls instead\n", i);
+    }
+
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, uffd_service_thread, (void *)(intptr_t)i);
+    if (err != 0) {
+      fprintf(stderr, "Failed to start fault thread: %s\n", strerror(err));
+      return 1;
+    }
+    pthread_detach(thread);
+    if (uffd_spins[i]) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      pthread_setaffinity_np(thread, sizeof(set), &set);
+      printf("Fault thread %d spinning on CPU %d\n", i, cpu);
+    }
+  }
+  return 0;
+}
+
+int start_populator() {
+  pthread_t thread;
+  if (fault_mode == FAULTS_MPROTECT) {
+    mem_fd = open("/proc/self/mem", O_RDWR | O_CLOEXEC);
+    if (mem_fd < 0) {
+      perror("Failed to open /proc/self/mem, background population disabled");
+      return 0;
+    }
+  }
+  if (start_thread(populate_thread, &thread) != 0) {
+    return 1;
+  }
+  pin_to_spare_cpu(thread);
+  return 0;
+}
+
+int start_hint_service() {
+  pthread_t thread;
+  if (fault_mode == FAULTS_MPROTECT && mem_fd < 0 && (mem_fd = open("/proc/self/mem", O_RDWR | O_CLOEXEC)) < 0) {
+    perror("Failed to open /proc/self/mem");
+    return 1;
+  }
+  if (hint_open() != 0 || start_thread(hint_thread, &thread) != 0) {
+    return 1;
+  }
+  printf("Hint mailbox at %p\n", (void *)hint_mailbox);
+  return 0;
+}
+
+int start_zero_pool() {
+  pthread_t thread;
+  if (fault_mode == FAULTS_MPROTECT && mem_fd < 0 && (mem_fd = open("/proc/self/mem", O_RDWR | O_CLOEXEC)) < 0) {
+    perror("Failed to open /proc/self/mem");
+    return 1;
+  }
+  // ELF segments are reserved RWX in uffd mode, and heap regions are mostly RW
+  int prots[] = { PROT_READ | PROT_WRITE | PROT_EXEC, PROT_READ | PROT_WRITE };
+  if (zeropool_open(zero_pool_pages, prots, fault_mode == FAULTS_UFFD ? 2 : 0) != 0) {
+    perror("Failed to map the zero pool");
+    return 1;
+  }
+  if (start_thread(zero_refill_thread, &thread) != 0) {
+    return 1;
+  }
+  printf("Zero pool of %zu pages, %s\n", zero_pool_pages,
+         fault_mode == FAULTS_UFFD ? "moved in with UFFDIO_MOVE" : "faulted in ahead of the guest");
+  return 0;
+}
+
+int add_checkpoint_ranges() {
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+  int uffd_mode = fault_mode == FAULTS_UFFD ? UFFDIO_REGISTER_MODE_MISSING : 0;
+
+  for (int s = 0; s < num_segments; s++) {
+    if (checkpoint_add_range(segments[s].start, segments[s].npages * page_size, segments[s].prot, uffd_mode) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int start_checkpoints() {
+  if (checkpoint_interval_ms == 0) {
+    fprintf(stderr, "Checkpoint interval must be positive\n");
+    return 1;
+  }
+  if (add_checkpoint_ranges() != 0) {
+    return 1;
+  }
+  return checkpoint_start(checkpoint_path, checkpoint_interval_ms,
+                          fault_mode == FAULTS_UFFD ? uffd : -1);
+}
+
+/**
+ * Hands a page to the migration source. Pages the guest never touched are read
+ * from the ELF file; for everything else, returns -1 so the page is read from
+ * memory.
+ */
+ssize_t read_migrating_page(uintptr_t page, void *dst) {
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+  segment_state_t *seg = find_segment(page);
+  if (seg == NULL || seg->phdr_index < 0) {
+    return -1;
+  }
+
+  unsigned char *state = &seg->state[(page - seg->start) / page_size];
+  while (__atomic_load_n(state, __ATOMIC_ACQUIRE) == PAGE_INSTALLING) {
+    sched_yield();
+  }
+  if (__atomic_load_n(state, __ATOMIC_ACQUIRE) == PAGE_PRESENT) {
+    return -1;
+  }
+  memset(dst, 0, page_size);
+  return read_segment_pages(&ph[seg->phdr_index], page, 1, dst, page_size);
+}
+
+int start_migration_source() {
+  if (add_checkpoint_ranges() != 0) {
+    return 1;
+  }
+  return migrate_listen(migrate_listen_path, fault_mode == FAULTS_UFFD ? uffd : -1, read_migrating_page);
+}
+
+// Builds one segment per range of a migrated guest. Nothing is installed yet;
+// every page is fetched from the source or pushed by it.
+int init_migrated_segments(ckpt_range_t *ranges, int nranges) {
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+
+  // One more for the break, if the pager has to serve it
+  segments = (segment_state_t *)calloc(nranges + 1, sizeof(segment_state_t));
+  if (segments == NULL) {
+    perror("Failed to allocate segment state");
+    return 1;
+  }
+  max_segments = nranges + 1;
+  for (int r = 0; r < nranges; r++) {
+    segment_state_t *seg = &segments[num_segments];
+    seg->phdr_index = SEGMENT_MIGRATED;
+    seg->start = ranges[r].start;
+    seg->npages = (ranges[r].end - ranges[r].start) / page_size;
+    seg->prot = ranges[r].prot;
+    seg->state = (unsigned char *)calloc(seg->npages, 1);
+    if (seg->state == NULL) {
+      perror("Failed to allocate page state");
+      return 1;
+    }
+    stats_add_region(seg->start, ranges[r].end, seg->prot);
+    if (seg->prot == PROT_NONE) {
+      // Guard pages: nothing to fetch, and any access is the guest's own fault
+      memset(seg->state, PAGE_PRESENT, seg->npages);
+    }
+    if (reserve_segment(seg, page_size) != 0) {
+      fprintf(stderr, "Guest range %p - %p is taken in this pager\n", (void *)ranges[r].start,
+              (void *)ranges[r].end);
+      return 1;
+    }
+    num_segments++;
+  }
+  return 0;
+}
+
+/**
+ * Installs the pages the migration source pushes while the guest runs. Once
+ * the source has sent everything and the last fetches have landed, both
+ * channels are closed, which lets the source exit.
+ */
+void *migrate_receive_thread(void *arg) {
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+  stats_thread_t *st = stats_thread("migrate");
+  char *buf = mmap(NULL, MIG_BATCH * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  unsigned long received = 0;
+  int failed = buf == MAP_FAILED;
+  mig_pages_t msg;
+
+  while (!failed) {
+    if (migrate_receive_pages(&msg, buf) != 0) {
+      failed = 1;
+      break;
+    }
+    if (msg.kind == MIG_DONE) {
+      break;
+    }
+    for (size_t i = 0; i < msg.npages;) {
+      uintptr_t page = msg.vaddr + i * page_size;
+      segment_state_t *seg = find_segment(page);
+      size_t idx = seg != NULL ? (page - seg->start) / page_size : 0;
+      size_t count = seg != NULL ? claim_run(seg, idx, msg.npages - i) : 0;
+      if (count == 0) {
+        // Fetched on a fault already
+        i++;
+        continue;
+      }
+      if (map_pages(seg, idx, count, msg.kind == MIG_DATA ? buf + i * page_size : NULL, page_size) != 0) {
+        failed = 1;
+        break;
+      }
+      received += count;
+      st->pages_installed += count;
+      st->pages_prefetched += count;
+      i += count;
+    }
+  }
+
+  if (!failed) {
+    for (int s = 0; s < num_segments; s++) {
+      for (size_t idx = 0; idx < segments[s].npages; idx++) {
+        while (__atomic_load_n(&segments[s].state[idx], __ATOMIC_ACQUIRE) != PAGE_PRESENT) {
+          sched_yield();
+        }
+      }
+    }
+    migrate_finish();
+  }
+
+  char report[256];
+  int len = snprintf(report, sizeof(report), "Migration %s: %lu pages pushed, %lu fetched on fault\n",
+                     failed ? "push channel lost" : "complete", received,
+                     __atomic_load_n(&fault_installs, __ATOMIC_RELAXED));
+  write(STDOUT_FILENO, report, len);
+  return NULL;
+}
+
+/**
+ * Pager code that runs on the guest's thread (the fault handler) finds its
+ * stack canary, thread descriptor and TLS variables through the guest's fs.
+ * Those pages must be present before the guest runs, or the fault handler
+ * would fault on them itself.
+ */
+void prefetch_guest_tls(uintptr_t fs_base) {
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+  Elf64_Phdr *phdr = (Elf64_Phdr *)getauxval(AT_PHDR);
+  size_t tls_size = 0;
+  for (int i = 0; phdr != NULL && i < getauxval(AT_PHNUM); i++) {
+    if (phdr[i].p_type == PT_TLS) {
+      tls_size = (phdr[i].p_memsz + phdr[i].p_align - 1) & ~(phdr[i].p_align - 1);
+    }
+  }
+
+  uintptr_t lo = (fs_base - tls_size) & ~(page_size - 1);
+  for (uintptr_t page = lo; page < fs_base + GUEST_TCB_PREFETCH; page += page_size) {
+    segment_state_t *seg = find_segment(page);
+    if (seg == NULL) {
+      continue;
+    }
+    unsigned char expected = PAGE_ABSENT;
+    if (__atomic_compare_exchange_n(&seg->state[(page - seg->start) / page_size], &expected, PAGE_INSTALLING, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      install_page_now(seg, page, page_size);
+      guest_stats->pages_installed++;
+      guest_stats->pages_prefetched++;
+    }
+  }
+}
+
+/**
+ * Destination side of a migration: receives the guest's registers and layout,
+ * reserves its ranges and continues it right away. Pages follow on demand and
+ * in the background.
+ */
+/**
+ * Drops the pages among the `count` starting at page `idx` of a heap region.
+ * They read back as zero if the guest touches them again.
+ */
+int release_heap_pages(segment_state_t *seg, size_t idx, size_t count) {
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+  void *start = (void *)(seg->start + idx * page_size);
+  // Pages merged by --dedup would read back as the store's copy
+  if (dedup_store != NULL) {
+    if (rereserve_pages(seg, (uintptr_t)start, count * page_size) == -1) {
+      return -1;
+    }
+  } else if ((fault_mode == FAULTS_MPROTECT && mprotect(start, count * page_size, PROT_NONE) == -1) ||
+             madvise(start, count * page_size, MADV_DONTNEED) == -1) {
+    return -1;
+  }
+  memset(seg->state + idx, PAGE_ABSENT, count);
+  return 0;
+}
+
+/**
+ * Reserves a heap region of `npages` at `start`, or wherever the kernel likes
+ * if `start` is 0, in a free segment slot. Returns NULL if there is no slot
+ * or no room.
+ *
+ * Only the thread serving the guest's system calls adds and removes heap
+ * regions, and the guest is blocked in the call meanwhile, so none of their
+ * pages can be faulting. The populator leaves heap regions alone.
+ */
+segment_state_t *add_heap_region(uintptr_t start, size_t npages, int prot) {
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+  segment_state_t *seg = NULL;
+  for (int s = 0; s < num_segments && seg == NULL; s++) {
+    if (segments[s].phdr_index == SEGMENT_HEAP && segments[s].npages == 0) {
+      seg = &segments[s];
+    }
+  }
+  int append = seg == NULL;
+  if (append) {
+    if (num_segments == max_segments) {
+      return NULL;
+    }
+    seg = &segments[num_segments];
+  }
+
+  seg->phdr_index = SEGMENT_HEAP;
+  seg->start = start;
+  seg->npages = npages;
+  seg->prot = prot;
+  seg->last_fault = 0;
+  seg->state = (unsigned char *)calloc(npages, 1);
+  if (seg->state == NULL || reserve_segment(seg, page_size) != 0) {
+    free(seg->state);
+    seg->state = NULL;
+    seg->npages = 0;
+    return NULL;
+  }
+  if (append) {
+    __atomic_store_n(&num_segments, num_segments + 1, __ATOMIC_RELEASE);
+  }
+  printf("Heap region [%ld]: %p - %p (%zu pages)\n", (long)(seg - segments), (void *)seg->start,
+         (void *)(seg->start + npages * page_size), npages);
+  return seg;
+}
+
+/**
+ * Serves a guest brk, mmap, munmap or mremap intercepted by heap.c. The break
+ * moves within brk_segment. Private anonymous mmaps become heap regions;
+ * everything else, such as file mappings or fixed addresses, is left to the
+ * kernel. Unmapping part of a region only drops its pages: the range stays
+ * reserved and reads back as zero. Heap regions cannot be moved, so mremap
+ * fails on them and glibc's realloc falls back to copying.
+ */
+int serve_heap_syscall(int nr, const uint64_t args[6], long *result) {
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+
+  if (nr == SYS_brk) {
+    uintptr_t addr = args[0];
+    uintptr_t end = brk_segment->start + brk_segment->npages * page_size;
+    if (addr >= guest_brk_floor && addr <= end) {
+      uintptr_t keep = (addr + page_size - 1) & ~(page_size - 1);
+      uintptr_t used = (guest_brk + page_size - 1) & ~(page_size - 1);
+      if (keep < used) {
+        release_heap_pages(brk_segment, (keep - brk_segment->start) / page_size,
+                           (used - keep) / page_size);
+      }
+      guest_brk = addr;
+    }
+    // Like the kernel, a break that cannot move returns the current one
+    *result = guest_brk;
+    return 1;
+  }
+
+  if (nr == SYS_mmap) {
+    int prot = args[2], flags = args[3];
+    if (args[0] != 0 || args[1] == 0 || prot == PROT_NONE || (flags & MAP_TYPE) != MAP_PRIVATE ||
+        !(flags & MAP_ANONYMOUS) ||
+        (flags & (MAP_FIXED | MAP_FIXED_NOREPLACE | MAP_GROWSDOWN | MAP_HUGETLB))) {
+      return 0;
+    }
+    segment_state_t *seg = add_heap_region(0, (args[1] + page_size - 1) / page_size, prot);
+    if (seg == NULL) {
+      return 0;
+    }
+    *result = seg->start;
+    return 1;
+  }
+
+  // munmap and mremap: only what touches a heap region is ours
+  uintptr_t addr = args[0];
+  uintptr_t addr_end = addr + ((args[1] + page_size - 1) & ~(page_size - 1));
+  int handled = 0;
+  *result = 0;
+  for (int s = 0; s < num_segments; s++) {
+    segment_state_t *seg = &segments[s];
+    uintptr_t end = seg->start + seg->npages * page_size;
+    if (seg->phdr_index != SEGMENT_HEAP || seg == brk_segment || seg->npages == 0 ||
+        addr >= end || addr_end <= seg->start) {
+      continue;
+    }
+    handled = 1;
+    if (nr != SYS_munmap) {
+      *result = -ENOMEM;
+      return 1;
+    }
+    if (addr & (page_size - 1)) {
+      *result = -EINVAL;
+      return 1;
+    }
+    uintptr_t lo = addr > seg->start ? addr : seg->start;
+    uintptr_t hi = addr_end < end ? addr_end : end;
+    if (lo == seg->start && hi == end) {
+      munmap((void *)seg->start, end - seg->start);
+      free(seg->state);
+      seg->state = NULL;
+      seg->npages = 0;
+    } else {
+      release_heap_pages(seg, (lo - seg->start) / page_size, (hi - lo) / page_size);
+    }
+  }
+  return handled;
+}
+
+int heap_syscall(int nr, const uint64_t args[6], long *result) {
+  pthread_mutex_lock(&heap_lock);
+  int handled = serve_heap_syscall(nr, args, result);
+  pthread_mutex_unlock(&heap_lock);
+  return handled;
+}
+
+// The guest's break starts right after its highest segment, as the kernel's would.
+int init_heap() {
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+  uintptr_t start = 0;
+  for (int s = 0; s < num_segments; s++) {
+    uintptr_t end = segments[s].start + segments[s].npages * page_size;
+    start = end > start ? end : start;
+  }
+  brk_segment = add_heap_region(start, HEAP_BRK_PAGES, PROT_READ | PROT_WRITE);
+  if (brk_segment == NULL) {
+    fprintf(stderr, "No room for the guest's heap after %p\n", (void *)start);
+    return 1;
+  }
+  guest_brk = guest_brk_floor = brk_segment->start;
+  return 0;
+}
+
+// Intercepts the guest's memory calls; only calls from its executable segments count.
+int start_heap_interception() {
+  uintptr_t text_start = UINTPTR_MAX, text_end = 0;
+  for (int s = 0; s < num_segments; s++) {
+    segment_state_t *seg = &segments[s];
+    if (seg->phdr_index < 0 || !(ph[seg->phdr_index].p_flags & PF_X)) {
+      continue;
+    }
+    uintptr_t end = ph[seg->phdr_index].p_vaddr + ph[seg->phdr_index].p_memsz;
+    text_start = seg->start < text_start ? seg->start : text_start;
+    text_end = end > text_end ? end : text_end;
+  }
+  return heap_intercept(text_start, text_end, heap_syscall);
+}
+
+// Passes a migrated guest's brk calls to the heap handler, and leaves the rest to the kernel
+int migrated_brk_syscall(int nr, const uint64_t args[6], long *result) {
+  return nr == SYS_brk ? heap_syscall(nr, args, result) : 0;
+}
+
+/**
+ * Serves the brk calls of a migrated guest whose break the kernel could not
+ * take over. The kernel's break is this pager's, and a guest brk call that
+ * reached it would grow this pager's heap under the guest's malloc, and the
+ * guest's heap under the pager's. Instead, the break continues from the
+ * source's in a heap region placed right after it, and never goes below it.
+ */
+int serve_migrated_brk(mig_state_t *state) {
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+  uintptr_t start = (state->brk + page_size - 1) & ~(page_size - 1);
+  brk_segment = add_heap_region(start, HEAP_BRK_PAGES, PROT_READ | PROT_WRITE);
+  if (brk_segment == NULL) {
+    fprintf(stderr, "No room for the migrated guest's heap after %p\n", (void *)start);
+    return 1;
+  }
+  guest_brk = guest_brk_floor = state->brk;
+
+  uintptr_t text_start = UINTPTR_MAX, text_end = 0;
+  for (int s = 0; s < num_segments; s++) {
+    segment_state_t *seg = &segments[s];
+    if (seg->phdr_index == SEGMENT_MIGRATED && (seg->prot & PROT_EXEC)) {
+      text_start = seg->start < text_start ? seg->start : text_start;
+      text_end = seg->start + seg->npages * page_size > text_end ? seg->start + seg->npages * page_size : text_end;
+    }
+  }
+  printf("The kernel keeps this pager's break; serving the guest's from %p\n", (void *)state->brk);
+  return heap_intercept(text_start, text_end, migrated_brk_syscall);
+}
+
+int run_migrated_guest() {
+  mig_state_t state;
+  ckpt_range_t *ranges;
+  pthread_t thread;
+
+  if (migrate_connect(migrate_from_path, &state, &ranges) != 0) {
+    return 1;
+  }
+  if (init_migrated_segments(ranges, state.nranges) != 0) {
+    return 1;
+  }
+  printf("Received guest from %s: %d ranges\n", migrate_from_path, num_segments);
+
+  stack_t ss = { .ss_size = SIGSTKSZ * 4, .ss_flags = 0 };
+  ss.ss_sp = mmap(NULL, ss.ss_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (ss.ss_sp == MAP_FAILED || sigaltstack(&ss, NULL) == -1) {
+    perror("Failed to set up signal stack");
+    return 1;
+  }
+  setup_signal_handler();
+  if (fault_mode == FAULTS_UFFD && start_uffd_service() != 0) {
+    return 1;
+  }
+  if (fault_mode == FAULTS_MPROTECT && (mem_fd = open("/proc/self/mem", O_RDWR | O_CLOEXEC)) < 0) {
+    perror("Failed to open /proc/self/mem");
+    return 1;
+  }
+  if (start_thread(migrate_receive_thread, &thread) != 0) {
+    return 1;
+  }
+  prefetch_guest_tls(state.regs.fs_base);
+  if (migrate_adopt_process(&state) != 0) {
+    return 1;
+  }
+  if (migrate_adopt_brk(&state) != 0 && serve_migrated_brk(&state) != 0) {
+    return 1;
+  }
+
+  struct timespec now;
+  syscall(SYS_clock_gettime, CLOCK_REALTIME, &now);
+  printf("Resuming migrated guest at %p, %.3f ms after it was stopped\n",
+         (void *)state.regs.gregs[REG_RIP],
+         ((now.tv_sec * 1000000000ULL + now.tv_nsec) - state.regs.timestamp_ns) / 1e6);
+  fflush(stdout);
+  migrate_resume_guest(&state);
+  return 1;
+}
+
+// Sums the faults every thread has counted so far
+uint64_t total_faults() {
+  stats_shm_t *shm = stats_segment();
+  uint64_t n = 0;
+  for (unsigned t = 0; t < __atomic_load_n(&shm->nthreads, __ATOMIC_ACQUIRE) && t < STATS_MAX_THREADS; t++) {
+    for (int r = 0; r < STATS_MAX_REGIONS; r++) {
+      for (int k = 0; k < STATS_FAULT_KINDS; k++) {
+        n += shm->threads[t].faults[r][k];
+      }
+    }
+  }
+  return n;
+}
+
+/**
+ * Installs the pages startup_pages() predicts and marks them MADV_DONTDUMP.
+ * The flag only matters to core dumps, but it keeps them in VMAs of their
+ * own, so /proc/self/smaps can tell later how many of them the guest used.
+ */
+void prepopulate_startup() {
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+  uintptr_t *pages = malloc(STARTUP_MAX_PAGES * sizeof(uintptr_t));
+  if (pages == NULL) {
+    perror("Failed to allocate startup pages");
+    return;
+  }
+  uintptr_t main_addr;
+  size_t n = startup_pages(pages, STARTUP_MAX_PAGES, &main_addr);
+  for (size_t i = 0; i < n; i++) {
+    segment_state_t *seg = find_segment(pages[i]);
+    if (seg != NULL && install_now(seg, (pages[i] - seg->start) / page_size, 1) == 1) {
+      madvise((void *)pages[i], page_size, MADV_DONTDUMP);
+      startup_installed++;
+    }
+  }
+  free(pages);
+  guest_stats->pages_installed += startup_installed;
+  guest_stats->pages_prefetched += startup_installed;
+  printf("Prepopulated %zu startup pages (%zu predicted, the rest were present)\n", startup_installed, n);
+  if (startup_installed > 0) {
+    startup_main = main_addr;
+  }
+}
+
+// Pages the guest referenced in the prepopulated VMAs since clear_refs. Runs
+// on the guest's thread, so it parses /proc/self/smaps without stdio.
+size_t count_startup_pages_used() {
+  int fd = open("/proc/self/smaps", O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  char buf[4096], line[512];
+  size_t len = 0, referenced_kb = 0, used_kb = 0;
+  int in_segment = 0;
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    for (ssize_t i = 0; i < n; i++) {
+      if (buf[i] != '\n') {
+        if (len < sizeof(line) - 1) {
+          line[len++] = buf[i];
+        }
+        continue;
+      }
+      line[len] = '\0';
+      len = 0;
+      if (strncmp(line, "Referenced:", 11) == 0) {
+        referenced_kb = 0;
+        for (char *c = line + 11; *c != '\0'; c++) {
+          if (*c >= '0' && *c <= '9') {
+            referenced_kb = referenced_kb * 10 + (*c - '0');
+          }
+        }
+      } else if (strncmp(line, "VmFlags:", 8) == 0) {
+        if (in_segment && strstr(line, " dd") != NULL) {
+          used_kb += referenced_kb;
+        }
+      } else {
+        // A mapping's header line: "start-end perms offset dev inode path"
+        uintptr_t start = 0;
+        char *c = line;
+        for (; (*c >= '0' && *c <= '9') || (*c >= 'a' && *c <= 'f'); c++) {
+          start = start * 16 + (*c <= '9' ? *c - '0' : *c - 'a' + 10);
+        }
+        if (c > line && *c == '-') {
+          in_segment = find_segment(start) != NULL;
+          referenced_kb = 0;
+        }
+      }
+    }
+  }
+  close(fd);
+  return used_kb * 1024 / sysconf(_SC_PAGE_SIZE);
+}
+
+// The guest reached main: take the breakpoint out and report start-up
+void startup_trap(int sig, siginfo_t *info, void *ucontext) {
+  greg_t *gregs = ((ucontext_t *)ucontext)->uc_mcontext.gregs;
+  if (startup_main == 0 || (uintptr_t)gregs[REG_RIP] != startup_main + 1) {
+    fprintf(stderr, "Unexpected SIGTRAP at %p\n", (void *)gregs[REG_RIP]);
+    exit(1);
+  }
+  if (pwrite(mem_fd, &startup_main_byte, 1, (off_t)startup_main) != 1) {
+    perror("Failed to remove the breakpoint on main");
+    exit(1);
+  }
+  gregs[REG_RIP] = startup_main;
+  startup_main = 0;
+
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+  size_t used = count_startup_pages_used();
+  for (int s = 0; s < num_segments; s++) {
+    madvise((void *)segments[s].start, segments[s].npages * page_size, MADV_DODUMP);
+  }
+  printf("Reached main after %lu faults; %zu of %zu prepopulated pages were used\n",
+         total_faults() - startup_faults, used, startup_installed);
+  fflush(stdout);
+}
+
+/**
+ * Plants a breakpoint on main and clears the referenced bits of every page,
+ * so startup_trap can tell which prepopulated pages the start-up used.
+ */
+void watch_startup() {
+  if (mem_fd < 0 && (mem_fd = open("/proc/self/mem", O_RDWR | O_CLOEXEC)) < 0) {
+    perror("Failed to open /proc/self/mem, not watching start-up");
+    return;
+  }
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = startup_trap;
+  sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  unsigned char int3 = 0xcc;
+  int fd = open("/proc/self/clear_refs", O_WRONLY);
+  if (fd < 0 || sigaction(SIGTRAP, &sa, NULL) == -1 ||
+      pread(mem_fd, &startup_main_byte, 1, (off_t)startup_main) != 1 ||
+      pwrite(mem_fd, &int3, 1, (off_t)startup_main) != 1) {
+    perror("Failed to set up a breakpoint on main");
+    startup_main = 0;
+  } else {
+    startup_faults = total_faults();
+    if (write(fd, "1", 1) != 1) {
+      perror("Failed to clear referenced bits");
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+/**
+ * Lets the policy install whatever it wants up front, once every segment is
+ * reserved and faults can be served.
+ */
+void setup_regions() {
+  if (policy->setup_region == NULL) {
+    return;
+  }
+  for (int s = 0; s < num_segments; s++) {
+    // The heap is only ever paged on demand; an eager 1 GiB break would be absurd
+    if (segments[s].phdr_index == SEGMENT_HEAP) {
+      continue;
+    }
+    size_t installed = 0;
+    policy->setup_region(&segments[s]);
+    for (size_t i = 0; i < segments[s].npages; i++) {
+      installed += segments[s].state[i] == PAGE_PRESENT;
+    }
+    guest_stats->pages_installed += installed;
+    guest_stats->pages_prefetched += installed;
+  }
+}
+
+int pager_main(int argc, char *argv[], char *envp[], const char *name, const char *default_policy) {
+  Elf64_Ehdr header;
+  int use_userfaultfd = 0;
+  char *exec_argv[argc + 1];
+  memcpy(exec_argv, argv, (argc + 1) * sizeof(char *));
+
+  // Options come before the executable
+  while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+    if (strcmp(argv[1], "--background") == 0) {
+      background_populate = 1;
+    } else if (strcmp(argv[1], "--uffd") == 0) {
+      use_userfaultfd = 1;
+    } else if (strncmp(argv[1], "--uffd-threads=", 15) == 0) {
+      use_userfaultfd = 1;
+      uffd_shards = atoi(argv[1] + 15);
+    } else if (strcmp(argv[1], "--uffd-busy-poll") == 0) {
+      use_userfaultfd = 1;
+      uffd_busy_poll = 1;
+    } else if (strncmp(argv[1], "--checkpoint=", 13) == 0) {
+      checkpoint_path = argv[1] + 13;
+    } else if (strncmp(argv[1], "--checkpoint-interval=", 22) == 0) {
+      checkpoint_interval_ms = atoi(argv[1] + 22);
+    } else if (strncmp(argv[1], "--migrate-listen=", 17) == 0) {
+      migrate_listen_path = argv[1] + 17;
+    } else if (strncmp(argv[1], "--migrate-from=", 15) == 0) {
+      migrate_from_path = argv[1] + 15;
+    } else if (strncmp(argv[1], "--page-server=", 14) == 0) {
+      page_server_path = argv[1] + 14;
+    } else if (strcmp(argv[1], "--stats") == 0) {
+      publish_stats = 1;
+    } else if (strncmp(argv[1], "--trace=", 8) == 0) {
+      trace_path = argv[1] + 8;
+    } else if (strncmp(argv[1], "--policy=", 9) == 0) {
+      default_policy = argv[1] + 9;
+    } else if (strncmp(argv[1], "--max-resident=", 15) == 0) {
+      max_resident = strtoul(argv[1] + 15, NULL, 0);
+    } else if (strcmp(argv[1], "--heap") == 0) {
+      manage_heap = 1;
+    } else if (strcmp(argv[1], "--perf") == 0) {
+      count_perf = 1;
+    } else if (strcmp(argv[1], "--zero-pool") == 0) {
+      zero_pool_pages = ZEROPOOL_DEFAULT_PAGES;
+    } else if (strncmp(argv[1], "--zero-pool=", 12) == 0) {
+      zero_pool_pages = strtoul(argv[1] + 12, NULL, 0);
+    } else if (strcmp(argv[1], "--hints") == 0) {
+      serve_hints = 1;
+    } else if (strncmp(argv[1], "--fault-profile=", 16) == 0) {
+      profile_fd = open(argv[1] + 16, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+      if (profile_fd < 0) {
+        perror(argv[1] + 16);
+        return 1;
+      }
+    } else if (strcmp(argv[1], "--mrc") == 0) {
+      build_mrc = 1;
+    } else if (strcmp(argv[1], "--prepopulate") == 0) {
+      prepopulate = 1;
+    } else if (strcmp(argv[1], "--dedup") == 0) {
+      dedup_store = DEDUP_DEFAULT_NAME;
+    } else if (strncmp(argv[1], "--dedup=", 8) == 0) {
+      dedup_store = argv[1] + 8;
+    } else if (strcmp(argv[1], "--reclaim") == 0) {
+      reclaim_stall_ms = RECLAIM_DEFAULT_STALL_MS;
+    } else if (strncmp(argv[1], "--reclaim=", 10) == 0) {
+      reclaim_stall_ms = atoi(argv[1] + 10);
+    } else {
+      fprintf(stderr, "Unknown option: %s\n", argv[1]);
+      return 1;
+    }
+    argv[1] = argv[0];
+    argv++;
+    argc--;
+  }
+
+  policy = find_policy(default_policy);
+  if (policy == NULL) {
+    fprintf(stderr, "Unknown policy: %s\n", default_policy);
+    list_policies();
+    return 1;
+  }
+  if (max_resident > 0 && (policy->evict == NULL || background_populate || checkpoint_path != NULL ||
+                           migrate_listen_path != NULL || migrate_from_path != NULL)) {
+    fprintf(stderr, "--max-resident needs an evicting policy and no background, checkpoint or migration\n");
+    return 1;
+  }
+  if (manage_heap && (checkpoint_path != NULL || migrate_listen_path != NULL || migrate_from_path != NULL)) {
+    fprintf(stderr, "--heap cannot be combined with checkpoint or migration\n");
+    return 1;
+  }
+  if (build_mrc && (checkpoint_path != NULL || migrate_listen_path != NULL || migrate_from_path != NULL)) {
+    fprintf(stderr, "--mrc cannot be combined with checkpoint or migration\n");
+    return 1;
+  }
+  if (dedup_store != NULL && (checkpoint_path != NULL || migrate_listen_path != NULL || migrate_from_path != NULL)) {
+    fprintf(stderr, "--dedup cannot be combined with checkpoint or migration\n");
+    return 1;
+  }
+  if (uffd_shards < 1 || uffd_shards > UFFD_MAX_SHARDS) {
+    fprintf(stderr, "--uffd-threads takes 1 to %d threads\n", UFFD_MAX_SHARDS);
+    return 1;
+  }
+  // Checkpoints and migration know of one userfaultfd only
+  if (uffd_shards > 1 && (checkpoint_path != NULL || migrate_listen_path != NULL || migrate_from_path != NULL)) {
+    fprintf(stderr, "--uffd-threads cannot be combined with checkpoint or migration\n");
+    return 1;
+  }
+  if (reclaim_stall_ms > 0 && (checkpoint_path != NULL || migrate_listen_path != NULL || migrate_from_path != NULL)) {
+    fprintf(stderr, "--reclaim cannot be combined with checkpoint or migration\n");
+    return 1;
+  }
+  if (zero_pool_pages > 0 && (checkpoint_path != NULL || migrate_listen_path != NULL || migrate_from_path != NULL)) {
+    fprintf(stderr, "--zero-pool cannot be combined with checkpoint or migration\n");
+    return 1;
+  }
+  // The mailbox is announced on the stack the guest starts with
+  if (serve_hints && (checkpoint_path != NULL || migrate_listen_path != NULL || migrate_from_path != NULL)) {
+    fprintf(stderr, "--hints cannot be combined with checkpoint or migration\n");
+    return 1;
+  }
+
+  if (migrate_from_path != NULL) {
+    // The guest arrives running; it has no executable or stack to set up here
+    if (background_populate || checkpoint_path != NULL || migrate_listen_path != NULL ||
+        page_server_path != NULL || count_perf || prepopulate) {
+      fprintf(stderr, "--migrate-from cannot be combined with other modes\n");
+      return 1;
+    }
+
+    // Without address randomization our heap starts right after our bss,
+    // below wherever the source's heap was randomized to, so it cannot
+    // overlap the guest's.
+    int persona = personality(0xffffffff);
+    if (!(persona & ADDR_NO_RANDOMIZE) && personality(persona | ADDR_NO_RANDOMIZE) != -1) {
+      execv("/proc/self/exe", exec_argv);
+      perror("Failed to restart without address randomization");
+    }
+    if (use_userfaultfd && open_userfaultfd() != 0) {
+      perror("userfaultfd unavailable, using mprotect");
+    }
+    stats_init(publish_stats, name, migrate_from_path);
+    guest_stats = stats_thread("guest");
+    if (trace_path != NULL && trace_open(trace_path, name) != 0) {
+      return 1;
+    }
+    guest_trace = trace_thread("guest");
+    return run_migrated_guest();
+  }
+
+  if (load_elf_binary(argc, argv, &header) != 0) {
+    return 1;
+  }
+  stats_init(publish_stats, name, argv[1]);
+  // The reporter forked for --perf and --mrc reads the curve after the guest exits
+  if (build_mrc && mrc_init() != 0) {
+    return 1;
+  }
+  if ((count_perf || build_mrc) && perf_start(count_perf, build_mrc ? mrc_report : NULL) != 0) {
+    return 1;
+  }
+  guest_stats = stats_thread("guest");
+  if (trace_path != NULL && trace_open(trace_path, name) != 0) {
+    return 1;
+  }
+  guest_trace = trace_thread("guest");
+  if (page_server_path != NULL) {
+    // Headers are read locally; every segment page comes from the server
+    struct stat st;
+    if (fstat(global_fd, &st) == -1 || remote_connect(page_server_path, st.st_size) != 0) {
+      return 1;
+    }
+  }
+  if (use_userfaultfd && open_userfaultfd() != 0) {
+    perror("userfaultfd unavailable, using mprotect");
+  }
+  map_image = image_loaded() && checkpoint_path == NULL && migrate_listen_path == NULL && page_server_path == NULL;
+  if (init_segment_state() != 0 || (manage_heap && init_heap() != 0)) {
+    return 1;
+  }
+  setup_signal_handler();
+  printf("Paging policy: %s\n", policy->name);
+
+  if (fault_mode == FAULTS_UFFD && start_uffd_service() != 0) {
+    return 1;
+  }
+  pthread_t mrc_thread;
+  if (build_mrc && start_thread(mrc_sample_thread, &mrc_thread) != 0) {
+    return 1;
+  }
+  pthread_t dedup;
+  if (dedup_store != NULL && (dedup_open(dedup_store) != 0 || start_thread(dedup_thread, &dedup) != 0)) {
+    return 1;
+  }
+  pthread_t reclaim;
+  if (reclaim_stall_ms > 0 && (psi_open(reclaim_stall_ms) != 0 || start_thread(reclaim_thread, &reclaim) != 0)) {
+    return 1;
+  }
+  if (serve_hints && start_hint_service() != 0) {
+    return 1;
+  }
+  if (zero_pool_pages > 0 && start_zero_pool() != 0) {
+    return 1;
+  }
+  setup_regions();
+  install_relro_pages();
+  if (prepopulate) {
+    prepopulate_startup();
+  }
+  if (background_populate && policy->prefetch_rank == NULL) {
+    printf("Policy %s has nothing to populate in the background\n", policy->name);
+  } else if (background_populate && start_populator() != 0) {
+    return 1;
+  }
+  // Migration buffers must exist before checkpointing records the pager's mappings
+  if (migrate_listen_path != NULL && start_migration_source() != 0) {
+    return 1;
+  }
+  if (checkpoint_path != NULL && start_checkpoints() != 0) {
+    return 1;
+  }
+  if (manage_heap && start_heap_interception() != 0) {
+    return 1;
+  }
+  // The guest exits without flushing the pager's stdio
+  fflush(stdout);
+  if (startup_main != 0) {
+    watch_startup();
+  }
+  if (count_perf) {
+    perf_enter_guest();
+  }
+  setup_the_stack(argc - 1, &argv[1], envp, &header);
+  return 0;
+}
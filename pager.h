@@ -0,0 +1,173 @@
+#ifndef PAGER_H
+#define PAGER_H
+
+#include <elf.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "stats.h"
+#include "trace.h"
+
+/*
+ * libpager: the loader and paging engine shared by apager, dpager and hpager.
+ * The three differ only in their default paging policy; any of them runs any
+ * policy with --policy=NAME, so strategies can be compared on the same binary
+ * and the same loader code.
+ */
+
+// ---- Loader (loader.c) ----
+
+extern Elf64_Addr e_entry;
+extern int global_fd;
+extern Elf64_Ehdr elf_header;
+extern Elf64_Phdr *ph;
+
+int load_elf_binary(int argc, char *argv[], Elf64_Ehdr *header);
+
+// Builds the guest's stack and jumps to its entry point. Only returns on failure.
+int setup_the_stack(int argc, char *argv[], char *envp[], Elf64_Ehdr *elf_header);
+
+int count_auxv_entries(Elf64_auxv_t *auxv);
+int count_env_vars();
+
+// ---- Engine (pager.c) ----
+
+// Page install states, shared by the fault handler and the background
+// populator. A page only ever moves ABSENT -> INSTALLING -> PRESENT, and only
+// whoever wins the ABSENT -> INSTALLING transition fills it. Eviction takes a
+// page back PRESENT -> INSTALLING -> ABSENT. --mrc access sampling arms a
+// page PRESENT -> INSTALLING -> ARMED, and the next fault on it takes it back
+// ARMED -> INSTALLING -> PRESENT without touching its contents.
+#define PAGE_ABSENT 0
+#define PAGE_INSTALLING 1
+#define PAGE_PRESENT 2
+#define PAGE_ARMED 3
+
+// Segments that do not come from a PT_LOAD header
+#define SEGMENT_MIGRATED -1     // a range of a guest migrated in from another pager
+#define SEGMENT_HEAP -2         // guest brk or anonymous mmap memory, served with --heap
+#define SEGMENT_FILE -3         // a data file an application mapped with pager_map
+
+typedef struct {
+    int phdr_index;         // index of the PT_LOAD header in ph[], or SEGMENT_*
+    uintptr_t start;        // page-aligned start of the segment
+    size_t npages;          // pages spanned by [p_vaddr, p_vaddr + p_memsz)
+    int prot;               // protection of installed pages
+    unsigned char *state;   // one PAGE_* entry per page
+    uintptr_t last_fault;   // most recent faulting page in this segment, 0 if none
+} segment_state_t;
+
+extern segment_state_t *segments;
+extern int num_segments;
+extern int max_segments;        // slots in segments[]; --heap adds regions while the guest runs
+
+extern stats_thread_t *guest_stats;     // the guest's thread: fault handler and start-up
+extern trace_ring_t *guest_trace;       // set by --trace=FILE in tracing builds
+
+/**
+ * Reads `len` bytes at `offset` of the executable, or from the page server,
+ * into `dst`, unpacking them if the executable is a compressed image.
+ * Returns 0, or -1 on an error or end of file.
+ */
+int read_file_range(char *dst, size_t len, off_t offset);
+
+/**
+ * Installs the absent pages among the `count` starting at page `idx` of `seg`
+ * from the calling thread, skipping any another thread already owns. Only for
+ * threads that resolve faults or run before the guest. Returns the number of
+ * pages installed.
+ */
+size_t install_now(segment_state_t *seg, size_t idx, size_t count);
+
+/**
+ * Like install_now, for large ranges: the pages are read in chunks by a
+ * small pool of threads, one pread per chunk. Only before the guest starts.
+ */
+size_t install_parallel(segment_state_t *seg, size_t idx, size_t count);
+
+// Whether pages of `seg` can be dropped and read back from the executable later
+int segment_evictable(segment_state_t *seg);
+
+// Reserves the whole of `seg`, every page absent. Returns 0, or 1 on failure.
+int reserve_segment(segment_state_t *seg, size_t page_size);
+
+// Claims up to `max` consecutive absent pages of `seg` from `idx` on; returns how many
+size_t claim_run(segment_state_t *seg, size_t idx, size_t max);
+
+/**
+ * Fills `count` claimed pages of `seg` from page `idx` through `buf`, scratch
+ * space of as many pages, and makes them present. Safe from any thread.
+ * Returns the bytes read, or -1.
+ */
+ssize_t install_pages(segment_state_t *seg, size_t idx, size_t count, char *buf, size_t page_size);
+
+void setup_signal_handler();
+
+extern int mem_fd;                      // /proc/self/mem, for filling pages others may be reading
+extern unsigned long max_resident;      // --max-resident, 0 for no cap
+extern unsigned long resident_pages;
+
+/**
+ * Runs a pager: parses the options, loads the executable named on the
+ * command line and starts it under `default_policy` unless --policy picks
+ * another. `name` identifies the pager in stats and traces.
+ */
+int pager_main(int argc, char *argv[], char *envp[], const char *name, const char *default_policy);
+
+// ---- Mapped data files (pager_map.c, see pager_map.h) ----
+
+extern int mapped_files;        // open mappings; their faults may come from any thread
+
+// Reads `count` pages from `page` of a mapped file into `dst`, leaving what is past its end
+ssize_t file_read_pages(segment_state_t *seg, uintptr_t page, size_t count, void *dst, size_t page_size);
+
+// Whether page `idx` of a mapped file was written since it was last read or written back
+int file_page_dirty(segment_state_t *seg, size_t idx);
+
+/**
+ * Handles a write fault on a present page of a mapped file, which is kept
+ * read-only while clean: marks it dirty and lets the write through. Returns
+ * 0 if the page was not present or the mapping is read-only.
+ */
+int file_write_fault(segment_state_t *seg, size_t idx);
+
+/**
+ * Writes a claimed page of a mapped file back if it is dirty, leaving it
+ * readable only. Returns 0, or -1 if it could not be written.
+ */
+int file_write_back(segment_state_t *seg, size_t idx);
+
+// ---- Paging policies (policy.c) ----
+
+/*
+ * What a policy decides; the engine does the work. Hooks left NULL fall back
+ * to plain demand paging.
+ */
+typedef struct {
+    const char *name;
+    const char *description;
+
+    // A segment was just reserved; install any of it up front.
+    void (*setup_region)(segment_state_t *seg);
+
+    // Pages to install for a fault on page `idx`, counting it.
+    size_t (*fault_around)(segment_state_t *seg, size_t idx);
+
+    // Order in which --background populates segments, lowest first.
+    int (*prefetch_rank)(segment_state_t *seg);
+
+    // Picks a present page to drop when --max-resident is exceeded. Returns
+    // 0 with *seg and *idx set, or -1 if nothing can go.
+    int (*evict)(segment_state_t **seg, size_t *idx);
+} pager_policy_t;
+
+extern pager_policy_t *policy;
+
+// Looks a policy up by name; NULL if there is none.
+pager_policy_t *find_policy(const char *name);
+
+// Prints the available policies to stderr.
+void list_policies();
+
+#endif
@@ -0,0 +1,299 @@
+#define _GNU_SOURCE
+#include "pager_map.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pager.h"
+
+typedef struct {
+    int fd;
+    size_t length;          // bytes of the file the mapping covers
+    unsigned char *dirty;   // one flag per page
+} mapped_file_t;
+
+// Indexed like segments[], which only ever holds mappings in an application
+static mapped_file_t files[PAGER_MAP_MAX_FILES];
+static int initialized;
+int mapped_files;
+
+// Held while mappings come and go
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static mapped_file_t *file_of(segment_state_t *seg) {
+    return &files[seg - segments];
+}
+
+// The mapping starting at `addr`, or NULL
+static segment_state_t *mapping_at(void *addr) {
+    for (int s = 0; initialized && s < num_segments; s++) {
+        if (segments[s].phdr_index == SEGMENT_FILE && segments[s].npages > 0 && segments[s].start == (uintptr_t)addr) {
+            return &segments[s];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Sets the engine up for mappings on the first call: segment slots, the
+ * policy, /proc/self/mem to fill pages other threads may be reading, stats
+ * for the fault handler, and the handler itself. Returns 0, or -1 with errno
+ * set, such as in a pager that already runs a guest.
+ */
+static int init_library(const char *policy_name) {
+    pager_policy_t *wanted = find_policy(policy_name != NULL ? policy_name : "demand");
+    if (wanted == NULL || (initialized && wanted != policy)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (initialized) {
+        return 0;
+    }
+    if (segments != NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+    mem_fd = open("/proc/self/mem", O_RDWR | O_CLOEXEC);
+    segments = calloc(PAGER_MAP_MAX_FILES, sizeof(segment_state_t));
+    if (mem_fd < 0 || segments == NULL) {
+        return -1;
+    }
+    max_segments = PAGER_MAP_MAX_FILES;
+    policy = wanted;
+    stats_init(0, "pager_map", "pager_map");
+    guest_stats = stats_thread("application");
+    setup_signal_handler();
+    initialized = 1;
+    return 0;
+}
+
+static void *map_file(const char *path, size_t length) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    int prot = PROT_READ | PROT_WRITE;
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0 && (errno == EACCES || errno == EROFS)) {
+        prot = PROT_READ;
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+
+    // A slot a mapping left behind, or a new one
+    int s = 0;
+    while (s < num_segments && segments[s].npages > 0) {
+        s++;
+    }
+    if (s == max_segments) {
+        close(fd);
+        errno = ENFILE;
+        return NULL;
+    }
+    segment_state_t *seg = &segments[s];
+    mapped_file_t *file = &files[s];
+    size_t npages = (length + page_size - 1) / page_size;
+    *seg = (segment_state_t){ .phdr_index = SEGMENT_FILE, .npages = npages, .prot = prot };
+    seg->state = calloc(npages, 1);
+    *file = (mapped_file_t){ .fd = fd, .length = length, .dirty = calloc(npages, 1) };
+    if (seg->state == NULL || file->dirty == NULL || reserve_segment(seg, page_size) != 0) {
+        int err = errno;
+        free(seg->state);
+        free(file->dirty);
+        seg->npages = 0;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    if (s == num_segments) {
+        __atomic_store_n(&num_segments, num_segments + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_add_fetch(&mapped_files, 1, __ATOMIC_RELAXED);
+    if (policy->setup_region != NULL) {
+        policy->setup_region(seg);
+    }
+    return (void *)seg->start;
+}
+
+void *pager_map(const char *path, size_t length, const char *policy_name) {
+    if (length == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    pthread_mutex_lock(&map_lock);
+    void *addr = init_library(policy_name) == 0 ? map_file(path, length) : NULL;
+    pthread_mutex_unlock(&map_lock);
+    return addr;
+}
+
+ssize_t file_read_pages(segment_state_t *seg, uintptr_t page, size_t count, void *dst, size_t page_size) {
+    mapped_file_t *file = file_of(seg);
+    size_t offset = page - seg->start;
+    size_t len = file->length - offset < count * page_size ? file->length - offset : count * page_size;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(file->fd, (char *)dst + done, len - done, offset + done);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            // Past the end of the file: zero, as the caller left it
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+int file_page_dirty(segment_state_t *seg, size_t idx) {
+    return __atomic_load_n(&file_of(seg)->dirty[idx], __ATOMIC_ACQUIRE);
+}
+
+int file_write_fault(segment_state_t *seg, size_t idx) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    unsigned char expected = PAGE_PRESENT;
+    if (!(seg->prot & PROT_WRITE) ||
+        !__atomic_compare_exchange_n(&seg->state[idx], &expected, PAGE_INSTALLING, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    __atomic_store_n(&file_of(seg)->dirty[idx], 1, __ATOMIC_RELEASE);
+    int enabled = mprotect((void *)(seg->start + idx * page_size), page_size, seg->prot) == 0;
+    __atomic_store_n(&seg->state[idx], PAGE_PRESENT, __ATOMIC_RELEASE);
+    return enabled;
+}
+
+int file_write_back(segment_state_t *seg, size_t idx) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    mapped_file_t *file = file_of(seg);
+    if (!file_page_dirty(seg, idx)) {
+        return 0;
+    }
+    // Read-only first: a write meanwhile waits for the page, and dirties it again
+    char *page = (char *)(seg->start + idx * page_size);
+    if (mprotect(page, page_size, seg->prot & ~PROT_WRITE) == -1) {
+        return -1;
+    }
+    __atomic_store_n(&file->dirty[idx], 0, __ATOMIC_RELEASE);
+    size_t offset = idx * page_size;
+    size_t len = file->length - offset < page_size ? file->length - offset : page_size;
+    for (size_t done = 0; done < len;) {
+        ssize_t n = pwrite(file->fd, page + done, len - done, offset + done);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            __atomic_store_n(&file->dirty[idx], 1, __ATOMIC_RELEASE);
+            mprotect(page, page_size, seg->prot);
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+long pager_prefetch(void *addr, size_t offset, size_t length) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    segment_state_t *seg = mapping_at(addr);
+    if (seg == NULL || offset > seg->npages * page_size) {
+        errno = EINVAL;
+        return -1;
+    }
+    char *buf = malloc(PAGER_PREFETCH_BATCH * page_size);
+    if (buf == NULL) {
+        return -1;
+    }
+    size_t end = (offset + length + page_size - 1) / page_size;
+    end = end < seg->npages ? end : seg->npages;
+    long installed = 0;
+    for (size_t idx = offset / page_size; idx < end;) {
+        size_t n = claim_run(seg, idx, end - idx < PAGER_PREFETCH_BATCH ? end - idx : PAGER_PREFETCH_BATCH);
+        if (n == 0) {
+            idx++;
+            continue;
+        }
+        if (install_pages(seg, idx, n, buf, page_size) < 0) {
+            // Let faults try again
+            memset(seg->state + idx, PAGE_ABSENT, n);
+            installed = -1;
+            break;
+        }
+        installed += n;
+        idx += n;
+    }
+    free(buf);
+    return installed;
+}
+
+int pager_sync(void *addr) {
+    segment_state_t *seg = mapping_at(addr);
+    if (seg == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    int rc = 0;
+    for (size_t idx = 0; idx < seg->npages; idx++) {
+        unsigned char expected = PAGE_PRESENT;
+        // A dirty page nobody can claim is being evicted, and written back by that
+        if (!file_page_dirty(seg, idx) ||
+            !__atomic_compare_exchange_n(&seg->state[idx], &expected, PAGE_INSTALLING, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        if (file_write_back(seg, idx) != 0) {
+            rc = -1;
+        }
+        __atomic_store_n(&seg->state[idx], PAGE_PRESENT, __ATOMIC_RELEASE);
+    }
+    if (fdatasync(file_of(seg)->fd) == -1 && errno != EINVAL) {
+        rc = -1;
+    }
+    return rc;
+}
+
+int pager_set_limit(size_t pages) {
+    if (pages > 0 && (policy == NULL || policy->evict == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+    max_resident = pages;
+    return 0;
+}
+
+int pager_unmap(void *addr) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    pthread_mutex_lock(&map_lock);
+    segment_state_t *seg = mapping_at(addr);
+    if (seg == NULL) {
+        pthread_mutex_unlock(&map_lock);
+        errno = EINVAL;
+        return -1;
+    }
+    int rc = pager_sync(addr);
+    int err = errno;
+    size_t present = 0;
+    for (size_t idx = 0; idx < seg->npages; idx++) {
+        present += seg->state[idx] == PAGE_PRESENT;
+    }
+    __atomic_sub_fetch(&resident_pages, present, __ATOMIC_RELAXED);
+    munmap((void *)seg->start, seg->npages * page_size);
+
+    mapped_file_t *file = file_of(seg);
+    __atomic_store_n(&seg->npages, 0, __ATOMIC_RELEASE);
+    close(file->fd);
+    free(file->dirty);
+    free(seg->state);
+    seg->state = NULL;
+    __atomic_sub_fetch(&mapped_files, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&map_lock);
+    errno = err;
+    return rc;
+}
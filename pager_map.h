@@ -0,0 +1,57 @@
+#ifndef PAGER_MAP_H
+#define PAGER_MAP_H
+
+#include <stddef.h>
+
+/*
+ * Demand paging of application data files through libpager's fault engine,
+ * for data sets the kernel's readahead and LRU serve badly.
+ *
+ * pager_map reserves an inaccessible region and pages the file into it as it
+ * is touched, the way dpager pages in a guest: a SIGSEGV handler claims the
+ * page, reads it from the file and enables it, installing as many more as the
+ * policy asks for. Clean pages stay read-only, so the first write to each is
+ * seen and the page remembered as dirty. Dirty pages are written back to the
+ * file by pager_sync, by pager_unmap, and before --max-resident style
+ * eviction drops them (see pager_set_limit).
+ *
+ * The process takes over SIGSEGV: faults outside every mapping crash it as
+ * before. Faults are served in mprotect mode, from whichever thread takes
+ * them. One policy serves every mapping of the process.
+ */
+
+#define PAGER_MAP_MAX_FILES 64
+#define PAGER_PREFETCH_BATCH 64     // pages read by one pread while prefetching
+
+/**
+ * Maps the first `length` bytes of the file at `path` for reading and
+ * writing, paged by the policy called `policy` (see list_policies; NULL for
+ * "demand"). Bytes past the end of the file read as zero, and writing them
+ * back extends it. Returns the mapping's address, or NULL with errno set.
+ */
+void *pager_map(const char *path, size_t length, const char *policy);
+
+/**
+ * Installs the absent pages of [offset, offset + length) of the mapping at
+ * `addr` now, from the calling thread, reading them in batches. Returns the
+ * number of pages installed, or -1 with errno set.
+ */
+long pager_prefetch(void *addr, size_t offset, size_t length);
+
+/**
+ * Writes the dirty pages of the mapping at `addr` back to its file and
+ * flushes the file. Returns 0, or -1 with errno set.
+ */
+int pager_sync(void *addr);
+
+/**
+ * Caps the pages of all mappings kept present at `pages`, 0 for no cap. Past
+ * the cap the policy picks pages to drop, dirty ones written back first.
+ * Returns 0, or -1 if the policy cannot evict.
+ */
+int pager_set_limit(size_t pages);
+
+// Writes the mapping at `addr` back and removes it. Returns 0, or -1 with errno set.
+int pager_unmap(void *addr);
+
+#endif
@@ -0,0 +1,244 @@
+#define _GNU_SOURCE
+#include <elf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "image.h"
+
+/*
+ * Packs an executable into an image (see image.h):
+ *
+ *   pagerpack [-a | -b block_size] <executable> <image>
+ *
+ * By default the image is compressed in blocks of 65536 bytes. Smaller blocks
+ * waste less on a fault but compress worse. Every block is decompressed
+ * again and compared before the image is written. With -a the image is
+ * page-aligned instead, so that pagers can map its pages rather than copy
+ * them.
+ */
+
+static int write_all(int fd, const void *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0) {
+            return -1;
+        }
+        buf = (const char *)buf + n;
+        len -= n;
+    }
+    return 0;
+}
+
+static uint8_t *read_file(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) == -1) {
+        perror(path);
+        return NULL;
+    }
+    uint8_t *data = malloc(st.st_size > 0 ? st.st_size : 1);
+    size_t done = 0;
+    while (data != NULL && done < (size_t)st.st_size) {
+        ssize_t n = read(fd, data + done, st.st_size - done);
+        if (n <= 0) {
+            perror(path);
+            free(data);
+            data = NULL;
+            break;
+        }
+        done += n;
+    }
+    close(fd);
+    *len = done;
+    return data;
+}
+
+static int write_image(const char *path, const void *data, size_t len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write_all(fd, data, len) != 0 || close(fd) != 0) {
+        perror(path);
+        return 1;
+    }
+    return 0;
+}
+
+// Adds the extent for executable bytes [pos, end) at image offset `offset`
+static int add_extent(image_aligned_t *img, uint64_t pos, uint64_t end, uint64_t offset) {
+    if (img->nextents == IMAGE_MAX_EXTENTS) {
+        fprintf(stderr, "Too many extents for a page-aligned image\n");
+        return -1;
+    }
+    img->extents[img->nextents++] = (image_extent_t){ pos, end - pos, offset };
+    return 0;
+}
+
+/**
+ * Writes a page-aligned image: each PT_LOAD segment's pages as they look in
+ * memory, then whatever of the executable no segment holds.
+ */
+static int pack_aligned(const uint8_t *elf, size_t len, const char *in_path, const char *out_path) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)elf;
+    if (len < sizeof(Elf64_Ehdr) || eh->e_phentsize != sizeof(Elf64_Phdr) ||
+        eh->e_phoff + eh->e_phnum * sizeof(Elf64_Phdr) > len) {
+        fprintf(stderr, "%s has no program headers\n", in_path);
+        return 1;
+    }
+    const Elf64_Phdr *phdrs = (const Elf64_Phdr *)(elf + eh->e_phoff);
+    // Region r describes segment load[r]
+    const Elf64_Phdr *load[IMAGE_MAX_REGIONS];
+
+    image_aligned_t *img = calloc(1, sizeof(image_aligned_t));
+    if (img == NULL) {
+        perror("Failed to allocate the image header");
+        return 1;
+    }
+    img->magic = IMAGE_ALIGNED_MAGIC;
+    img->page_size = page_size;
+    img->file_size = len;
+    uint64_t next = (sizeof(image_aligned_t) + page_size - 1) & ~(page_size - 1);
+    for (int i = 0; i < eh->e_phnum; i++) {
+        const Elf64_Phdr *p = &phdrs[i];
+        if (p->p_type != PT_LOAD || p->p_memsz == 0) {
+            continue;
+        }
+        if (img->nregions == IMAGE_MAX_REGIONS || p->p_filesz > p->p_memsz || p->p_offset + p->p_filesz > len) {
+            fprintf(stderr, "Cannot page-align segment %d of %s\n", i, in_path);
+            return 1;
+        }
+        image_region_t *region = &img->regions[img->nregions];
+        region->start = p->p_vaddr & ~(page_size - 1);
+        region->file_end = p->p_vaddr + p->p_filesz;
+        region->end = p->p_vaddr + p->p_memsz;
+        region->offset = next;
+        region->npages = p->p_filesz > 0 ? ((region->file_end + page_size - 1) & ~(page_size - 1)) / page_size -
+                                               region->start / page_size : 0;
+        next += region->npages * page_size;
+        load[img->nregions++] = p;
+    }
+
+    // Segment bytes come from their regions; the rest go after the regions
+    uint64_t tail = next;
+    for (uint64_t pos = 0; pos < len;) {
+        uint64_t end = len;
+        int found = -1;
+        for (uint32_t r = 0; r < img->nregions && found < 0; r++) {
+            const Elf64_Phdr *p = load[r];
+            if (pos >= p->p_offset && pos < p->p_offset + p->p_filesz) {
+                found = r;
+                end = p->p_offset + p->p_filesz;
+            } else if (p->p_filesz > 0 && p->p_offset > pos && p->p_offset < end) {
+                end = p->p_offset;
+            }
+        }
+        uint64_t offset = tail;
+        if (found >= 0) {
+            const Elf64_Phdr *p = load[found];
+            offset = img->regions[found].offset + (p->p_vaddr - img->regions[found].start) + (pos - p->p_offset);
+        } else {
+            tail += end - pos;
+        }
+        if (add_extent(img, pos, end, offset) != 0) {
+            return 1;
+        }
+        pos = end;
+    }
+
+    uint8_t *out = calloc(1, tail);
+    if (out == NULL) {
+        perror("Failed to allocate the image");
+        return 1;
+    }
+    memcpy(out, img, sizeof(image_aligned_t));
+    for (uint32_t e = 0; e < img->nextents; e++) {
+        memcpy(out + img->extents[e].offset, elf + img->extents[e].file_offset, img->extents[e].len);
+    }
+    if (write_image(out_path, out, tail) != 0) {
+        return 1;
+    }
+    printf("Packed %s into %s: %zu bytes to %lu, %u regions of %zu-byte pages\n", in_path, out_path, len, tail,
+           img->nregions, page_size);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t block_size = IMAGE_MAX_BLOCK;
+    int page_aligned = 0;
+    if (argc > 2 && strcmp(argv[1], "-b") == 0) {
+        block_size = atoi(argv[2]);
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    } else if (argc > 1 && strcmp(argv[1], "-a") == 0) {
+        page_aligned = 1;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    if (argc != 3 || block_size < IMAGE_MIN_BLOCK || block_size > IMAGE_MAX_BLOCK ||
+        (block_size & (block_size - 1)) != 0) {
+        printf("Usage: %s [-a | -b block_size] <executable> <image>\n", argv[0]);
+        printf("The block size is a power of two from %d to %d\n", IMAGE_MIN_BLOCK, IMAGE_MAX_BLOCK);
+        return 1;
+    }
+
+    size_t len;
+    uint8_t *elf = read_file(argv[1], &len);
+    if (elf == NULL) {
+        return 1;
+    }
+    if (len < SELFMAG || memcmp(elf, ELFMAG, SELFMAG) != 0) {
+        fprintf(stderr, "%s is not an ELF file\n", argv[1]);
+        return 1;
+    }
+    if (page_aligned) {
+        return pack_aligned(elf, len, argv[1], argv[2]);
+    }
+
+    image_header_t header = { IMAGE_MAGIC, block_size, len, (len + block_size - 1) / block_size };
+    uint64_t *index = malloc((header.nblocks + 1) * sizeof(uint64_t));
+    uint8_t *packed = malloc(len > 0 ? len : 1);
+    uint8_t *check = malloc(block_size);
+    if (index == NULL || packed == NULL || check == NULL) {
+        perror("Failed to allocate buffers");
+        return 1;
+    }
+
+    // Blocks follow the index, in order
+    size_t out = 0, compressed = 0;
+    index[0] = sizeof(header) + (header.nblocks + 1) * sizeof(uint64_t);
+    for (uint64_t b = 0; b < header.nblocks; b++) {
+        const uint8_t *src = elf + b * block_size;
+        size_t blen = len - b * block_size < block_size ? len - b * block_size : block_size;
+        // Blocks only worth keeping compressed if they shrink
+        size_t n = image_compress(src, blen, packed + out, blen - 1);
+        if (n > 0) {
+            if (image_decompress(packed + out, n, check, blen) != 0 || memcmp(check, src, blen) != 0) {
+                fprintf(stderr, "Block %lu does not decompress to its contents\n", b);
+                return 1;
+            }
+            compressed++;
+        } else {
+            memcpy(packed + out, src, blen);
+            n = blen;
+        }
+        out += n;
+        index[b + 1] = index[0] + out;
+    }
+
+    int fd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write_all(fd, &header, sizeof(header)) != 0 ||
+        write_all(fd, index, (header.nblocks + 1) * sizeof(uint64_t)) != 0 || write_all(fd, packed, out) != 0 ||
+        close(fd) != 0) {
+        perror(argv[2]);
+        return 1;
+    }
+    printf("Packed %s into %s: %zu bytes to %lu (%.2fx), %zu of %lu blocks of %u bytes compressed\n", argv[1],
+           argv[2], len, index[header.nblocks], (double)len / index[header.nblocks], compressed, header.nblocks,
+           block_size);
+    return 0;
+}
@@ -0,0 +1,965 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Replays a recorded reference trace against paging policies, offline:
+ *
+ *   pagersim [options] <trace>
+ *
+ * The trace is a fault profile, one "kind address" line per reference with
+ * kind r, w or x, as --fault-profile=FILE writes. Record it with --mrc so the
+ * sampled references to present pages are in it, not only the first fault on
+ * each page. The output of valgrind --tool=lackey --trace-mem=yes reads the
+ * same way, kinds I, L, S and M, for a trace of every access; other lines are
+ * skipped.
+ *
+ * Each combination of eviction policy, fetch policy and budget of resident
+ * pages is one simulation, and simulations run in parallel on a pool of
+ * threads. For each the simulator reports faults (references to pages not
+ * resident), the pages read and the dirty pages written back on eviction,
+ * how many prefetched pages were referenced before being evicted, and a
+ * modeled time: every fault costs FAULT plus READ microseconds, and every
+ * page read ahead of a fault costs PAGE more.
+ *
+ *   --evict=LIST         of lru, clock, arc and 2q; all of them by default
+ *   --fetch=LIST         of demand (the default), around=N, adaptive and
+ *                        stride=N
+ *   --budgets=LIST       resident pages, or MIN-MAX to double from MIN up to
+ *                        MAX; by default from 16 up to every page the trace
+ *                        touches
+ *   --latency=F,R,P      FAULT, READ and PAGE in microseconds, 3,100,1 by
+ *                        default
+ *   --threads=N          the number of CPUs by default
+ *   --page-size=N        bytes, 4096 by default
+ *   --csv                comma-separated output
+ *
+ * around=N reads the N - 1 pages after the faulting one with it, up to the
+ * first resident one, as the pagers' fault-around does. adaptive starts at
+ * one page and doubles its window, up to ADAPTIVE_MAX_PAGES, whenever a fault
+ * lands within the window past the previous one; it halves it on any other
+ * fault and whenever a page it read is evicted unused. stride=N waits for two
+ * faults in a row the same distance apart and then reads the next N pages
+ * along that stride. Pages a fetch reads that the trace never references
+ * still take their place among the resident ones.
+ */
+
+#define ADAPTIVE_MAX_PAGES 64
+#define LOAD_BATCH 32           // page lookups in flight at once while loading
+#define PREFETCH_AHEAD 16       // references ahead a simulation fetches page state for
+#define MAX_SETTINGS 32
+#define EVENT_WRITE 0x80000000u
+#define NIL UINT32_MAX
+
+// Low bits of a page's flags: the list it is on. Only A and B are resident.
+#define LIST_NONE 0
+#define LIST_A 1        // LRU's and CLOCK's pages, ARC's T1, 2Q's A1in
+#define LIST_B 2        // ARC's T2, 2Q's Am
+#define LIST_GHOST_A 3  // ARC's B1, 2Q's A1out
+#define LIST_GHOST_B 4  // ARC's B2
+#define LIST_MASK 7
+#define F_REF 8         // CLOCK's reference bit
+#define F_DIRTY 16
+#define F_PREFETCHED 32 // read ahead of a fault and not referenced since
+
+#define RESIDENT(flags) (((flags) & LIST_MASK) == LIST_A || ((flags) & LIST_MASK) == LIST_B)
+
+enum { FETCH_DEMAND, FETCH_AROUND, FETCH_ADAPTIVE, FETCH_STRIDE };
+
+typedef struct {
+    uint32_t head;      // most recent
+    uint32_t tail;
+    size_t size;
+} list_t;
+
+// A page's state, in one place for the cache's sake
+typedef struct {
+    uint32_t prev;
+    uint32_t next;
+    uint8_t flags;
+} node_t;
+
+typedef struct sim sim_t;
+
+typedef struct {
+    const char *name;
+    void (*hit)(sim_t *s, uint32_t id);
+    // Makes a page that is not resident resident, evicting another if full
+    void (*insert)(sim_t *s, uint32_t id, int demand);
+} evict_policy_t;
+
+typedef struct {
+    char name[24];
+    int kind;           // FETCH_*
+    size_t pages;
+} fetch_policy_t;
+
+struct sim {
+    const evict_policy_t *evict;
+    const fetch_policy_t *fetch;
+    size_t budget;
+
+    node_t *nodes;      // trace pages first, then pages only fetches read
+    list_t lists[5];
+    size_t resident;
+    uint32_t *ring;     // CLOCK's pages
+    size_t filled;
+    size_t hand;
+    size_t arc_p;       // ARC's target size of T1
+
+    // Pages outside the trace a fetch read, by phantom index
+    uint64_t *phantom_page;
+    uint32_t *phantom_free;
+    size_t nfree;
+    uint32_t *phantom_table;    // index + 1 by hashed page, 0 if free
+    size_t phantom_mask;
+
+    uint64_t last_fault;
+    int64_t last_stride;
+    size_t window;
+
+    uint64_t faults;
+    uint64_t prefetched;
+    uint64_t used;      // prefetched pages referenced before eviction
+    uint64_t written;   // dirty pages evicted
+};
+
+typedef struct {
+    uint64_t page;
+    uint32_t id;        // + 1, 0 if free
+} table_entry_t;
+
+// The trace: one id per reference, with EVENT_WRITE set for writes
+uint32_t *events;
+size_t nevents;
+uint64_t nwrites;
+uint64_t *page_of;      // by id
+uint32_t npages;
+table_entry_t *page_table;  // by hashed page
+int table_bits;
+
+size_t page_size = 4096;
+double fault_us = 3, read_us = 100, page_us = 1;
+
+sim_t *sims;
+size_t nsims;
+size_t next_sim;
+
+static inline size_t hash_page(uint64_t page, int bits) {
+    return (page * 0x9e3779b97f4a7c15ULL) >> (64 - bits);
+}
+
+// The id of `page` in the trace, or NIL
+uint32_t trace_id(uint64_t page) {
+    size_t mask = ((size_t)1 << table_bits) - 1;
+    for (size_t h = hash_page(page, table_bits);; h = (h + 1) & mask) {
+        if (page_table[h].id == 0) {
+            return NIL;
+        }
+        if (page_table[h].page == page) {
+            return page_table[h].id - 1;
+        }
+    }
+}
+
+void grow_table() {
+    table_bits++;
+    size_t size = (size_t)1 << table_bits;
+    free(page_table);
+    page_table = calloc(size, sizeof(table_entry_t));
+    if (page_table == NULL) {
+        perror("Failed to allocate page table");
+        exit(1);
+    }
+    for (uint32_t id = 0; id < npages; id++) {
+        size_t h = hash_page(page_of[id], table_bits);
+        while (page_table[h].id != 0) {
+            h = (h + 1) & (size - 1);
+        }
+        page_table[h] = (table_entry_t){ page_of[id], id + 1 };
+    }
+}
+
+// The id of `page`, given one if it is new
+uint32_t add_page(uint64_t page) {
+    static size_t capacity;
+    size_t mask = ((size_t)1 << table_bits) - 1;
+    size_t h = hash_page(page, table_bits);
+    for (; page_table[h].id != 0; h = (h + 1) & mask) {
+        if (page_table[h].page == page) {
+            return page_table[h].id - 1;
+        }
+    }
+    if (npages == EVENT_WRITE - 1) {
+        fprintf(stderr, "The trace touches too many pages\n");
+        exit(1);
+    }
+    if (npages == capacity) {
+        capacity = capacity > 0 ? capacity * 2 : 4096;
+        page_of = realloc(page_of, capacity * sizeof(uint64_t));
+        if (page_of == NULL) {
+            perror("Failed to allocate pages");
+            exit(1);
+        }
+    }
+    page_of[npages] = page;
+    page_table[h] = (table_entry_t){ page, ++npages };
+    if (npages * 2 > mask) {
+        grow_table();
+    }
+    return npages - 1;
+}
+
+/**
+ * Appends a batch of references to events[]. The table slots of all their
+ * pages are fetched first, so their cache misses overlap instead of coming
+ * one after another.
+ */
+void add_references(const uint64_t *pages, const uint32_t *writes, int n) {
+    static size_t capacity;
+    if (nevents + n > capacity) {
+        capacity = capacity > 0 ? capacity * 2 : (size_t)1 << 20;
+        events = realloc(events, capacity * sizeof(uint32_t));
+        if (events == NULL) {
+            perror("Failed to allocate trace");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        __builtin_prefetch(&page_table[hash_page(pages[i], table_bits)]);
+    }
+    for (int i = 0; i < n; i++) {
+        events[nevents++] = add_page(pages[i]) | writes[i];
+    }
+}
+
+int by_page(const void *x, const void *y) {
+    const table_entry_t *a = x, *b = y;
+    return a->page < b->page ? -1 : a->page > b->page;
+}
+
+// Renumbers the pages in address order, for read_around
+void sort_pages() {
+    table_entry_t *sorted = malloc(npages * sizeof(table_entry_t));
+    uint32_t *renumbered = malloc(npages * sizeof(uint32_t));
+    if (sorted == NULL || renumbered == NULL) {
+        perror("Failed to allocate pages");
+        exit(1);
+    }
+    for (uint32_t id = 0; id < npages; id++) {
+        sorted[id] = (table_entry_t){ page_of[id], id };
+    }
+    qsort(sorted, npages, sizeof(table_entry_t), by_page);
+    for (uint32_t id = 0; id < npages; id++) {
+        page_of[id] = sorted[id].page;
+        renumbered[sorted[id].id] = id;
+    }
+    for (size_t i = 0; i < nevents; i++) {
+        events[i] = renumbered[events[i] & ~EVENT_WRITE] | (events[i] & EVENT_WRITE);
+    }
+    for (size_t h = 0; h < (size_t)1 << table_bits; h++) {
+        if (page_table[h].id != 0) {
+            page_table[h].id = renumbered[page_table[h].id - 1] + 1;
+        }
+    }
+    free(sorted);
+    free(renumbered);
+}
+
+/**
+ * Reads the references of the trace at `path` into events[], with an id for
+ * every page. Returns 0, or -1 if it cannot be read.
+ */
+int load_trace(const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) == -1) {
+        perror(path);
+        return -1;
+    }
+    const char *data = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    if (data == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+    close(fd);
+
+    signed char hex[256];
+    memset(hex, -1, sizeof(hex));
+    for (int i = 0; i < 16; i++) {
+        hex[(unsigned char)"0123456789abcdef"[i]] = i;
+        hex[(unsigned char)"0123456789ABCDEF"[i]] = i;
+    }
+    table_bits = 12;
+    page_table = calloc((size_t)1 << table_bits, sizeof(table_entry_t));
+    if (page_table == NULL) {
+        perror("Failed to allocate page table");
+        return -1;
+    }
+
+    const char *p = data, *end = data + st.st_size;
+    uint64_t pending[LOAD_BATCH];
+    uint32_t writes[LOAD_BATCH];
+    int npending = 0;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        const char *line = p;
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL) {
+            eol = end;
+        }
+        p = eol + 1;
+        if (eol - line < 3 || (line[1] != ' ' && line[1] != '\t')) {
+            continue;
+        }
+        uint32_t write;
+        switch (line[0]) {
+        case 'r': case 'x': case 'I': case 'L':
+            write = 0;
+            break;
+        case 'w': case 'S': case 'M':
+            write = EVENT_WRITE;
+            break;
+        default:
+            continue;
+        }
+        const char *q = line + 2;
+        while (q < eol && (*q == ' ' || *q == '\t')) {
+            q++;
+        }
+        if (eol - q > 2 && q[0] == '0' && (q[1] == 'x' || q[1] == 'X')) {
+            q += 2;
+        }
+        uint64_t addr = 0;
+        const char *digits = q;
+        for (; q < eol && hex[(unsigned char)*q] >= 0; q++) {
+            addr = addr << 4 | hex[(unsigned char)*q];
+        }
+        if (q == digits) {
+            continue;
+        }
+        pending[npending] = addr / page_size;
+        writes[npending] = write;
+        nwrites += write != 0;
+        if (++npending == LOAD_BATCH) {
+            add_references(pending, writes, npending);
+            npending = 0;
+        }
+    }
+    add_references(pending, writes, npending);
+    sort_pages();
+    if (st.st_size > 0) {
+        munmap((void *)data, st.st_size);
+    }
+    return 0;
+}
+
+// ---- Lists over page ids ----
+
+void list_push(sim_t *s, int l, uint32_t id) {
+    list_t *list = &s->lists[l];
+    s->nodes[id].prev = NIL;
+    s->nodes[id].next = list->head;
+    if (list->head != NIL) {
+        s->nodes[list->head].prev = id;
+    } else {
+        list->tail = id;
+    }
+    list->head = id;
+    list->size++;
+    s->nodes[id].flags = (s->nodes[id].flags & ~LIST_MASK) | l;
+}
+
+void list_remove(sim_t *s, uint32_t id) {
+    list_t *list = &s->lists[s->nodes[id].flags & LIST_MASK];
+    if (s->nodes[id].prev != NIL) {
+        s->nodes[s->nodes[id].prev].next = s->nodes[id].next;
+    } else {
+        list->head = s->nodes[id].next;
+    }
+    if (s->nodes[id].next != NIL) {
+        s->nodes[s->nodes[id].next].prev = s->nodes[id].prev;
+    } else {
+        list->tail = s->nodes[id].prev;
+    }
+    list->size--;
+    s->nodes[id].flags &= ~LIST_MASK;
+}
+
+// ---- Pages outside the trace ----
+
+int is_phantom(uint32_t id) {
+    return id >= npages;
+}
+
+// Finds `page` among the phantoms, or gives it a free one
+uint32_t phantom_id(sim_t *s, uint64_t page) {
+    size_t h = hash_page(page, 64 - __builtin_clzll(s->phantom_mask));
+    for (; s->phantom_table[h] != 0; h = (h + 1) & s->phantom_mask) {
+        if (s->phantom_page[s->phantom_table[h] - 1] == page) {
+            return npages + s->phantom_table[h] - 1;
+        }
+    }
+    if (s->nfree == 0) {
+        return NIL;
+    }
+    uint32_t index = s->phantom_free[--s->nfree];
+    s->phantom_page[index] = page;
+    s->phantom_table[h] = index + 1;
+    return npages + index;
+}
+
+// Forgets an evicted phantom: linear probing, so later entries shift back
+void phantom_release(sim_t *s, uint32_t id) {
+    uint32_t index = id - npages;
+    int bits = 64 - __builtin_clzll(s->phantom_mask);
+    size_t h = hash_page(s->phantom_page[index], bits);
+    while (s->phantom_table[h] != index + 1) {
+        h = (h + 1) & s->phantom_mask;
+    }
+    for (size_t gap = h;;) {
+        h = (h + 1) & s->phantom_mask;
+        uint32_t slot = s->phantom_table[h];
+        if (slot == 0) {
+            s->phantom_table[gap] = 0;
+            break;
+        }
+        size_t home = hash_page(s->phantom_page[slot - 1], bits);
+        // Move the entry into the gap unless its home lies between them
+        if (((h - home) & s->phantom_mask) >= ((h - gap) & s->phantom_mask)) {
+            s->phantom_table[gap] = slot;
+            gap = h;
+        }
+    }
+    s->phantom_free[s->nfree++] = index;
+}
+
+// ---- Eviction policies ----
+
+// Accounts for a page leaving memory. The caller moves it to a ghost list.
+void evicted(sim_t *s, uint32_t id) {
+    uint8_t flags = s->nodes[id].flags;
+    s->written += (flags & F_DIRTY) != 0;
+    if (flags & F_PREFETCHED) {
+        if (s->fetch->kind == FETCH_ADAPTIVE && s->window > 1) {
+            s->window /= 2;
+        }
+    }
+    s->nodes[id].flags = flags & ~(F_REF | F_DIRTY | F_PREFETCHED);
+    s->resident--;
+    if (is_phantom(id)) {
+        phantom_release(s, id);
+    }
+}
+
+// Evicts the least recent page of `l`, onto `ghost` if it is a trace page
+void evict_tail(sim_t *s, int l, int ghost) {
+    uint32_t victim = s->lists[l].tail;
+    list_remove(s, victim);
+    evicted(s, victim);
+    if (ghost != LIST_NONE && !is_phantom(victim)) {
+        list_push(s, ghost, victim);
+    }
+}
+
+// Forgets the oldest page of a ghost list
+void drop_tail(sim_t *s, int l) {
+    list_remove(s, s->lists[l].tail);
+}
+
+void lru_hit(sim_t *s, uint32_t id) {
+    list_remove(s, id);
+    list_push(s, LIST_A, id);
+}
+
+void lru_insert(sim_t *s, uint32_t id, int demand) {
+    if (s->resident == s->budget) {
+        evict_tail(s, LIST_A, LIST_NONE);
+    }
+    list_push(s, LIST_A, id);
+    s->resident++;
+}
+
+void clock_hit(sim_t *s, uint32_t id) {
+    s->nodes[id].flags |= F_REF;
+}
+
+void clock_insert(sim_t *s, uint32_t id, int demand) {
+    size_t slot = s->filled;
+    if (s->filled < s->budget) {
+        s->filled++;
+    } else {
+        // Second chance for every page referenced since the hand last passed
+        while (s->nodes[s->ring[s->hand]].flags & F_REF) {
+            s->nodes[s->ring[s->hand]].flags &= ~F_REF;
+            s->hand = s->hand + 1 < s->budget ? s->hand + 1 : 0;
+        }
+        slot = s->hand;
+        s->hand = s->hand + 1 < s->budget ? s->hand + 1 : 0;
+        s->nodes[s->ring[slot]].flags &= ~LIST_MASK;
+        evicted(s, s->ring[slot]);
+    }
+    s->ring[slot] = id;
+    s->nodes[id].flags = (s->nodes[id].flags & ~LIST_MASK) | LIST_A | (demand ? F_REF : 0);
+    s->resident++;
+}
+
+// ARC's REPLACE: evicts from T1 or T2, whichever is over its target
+void arc_replace(sim_t *s, int in_b2) {
+    size_t t1 = s->lists[LIST_A].size;
+    if (t1 > 0 && ((in_b2 && t1 == s->arc_p) || t1 > s->arc_p || s->lists[LIST_B].size == 0)) {
+        evict_tail(s, LIST_A, LIST_GHOST_A);
+    } else {
+        evict_tail(s, LIST_B, LIST_GHOST_B);
+    }
+}
+
+void arc_hit(sim_t *s, uint32_t id) {
+    list_remove(s, id);
+    list_push(s, LIST_B, id);
+}
+
+void arc_insert(sim_t *s, uint32_t id, int demand) {
+    size_t c = s->budget;
+    int l = s->nodes[id].flags & LIST_MASK;
+    if (demand && (l == LIST_GHOST_A || l == LIST_GHOST_B)) {
+        // A ghost hit moves the target towards the list that would have kept it
+        size_t b1 = s->lists[LIST_GHOST_A].size, b2 = s->lists[LIST_GHOST_B].size;
+        if (l == LIST_GHOST_A) {
+            size_t delta = b2 > b1 ? b2 / b1 : 1;
+            s->arc_p = s->arc_p + delta < c ? s->arc_p + delta : c;
+        } else {
+            size_t delta = b1 > b2 ? b1 / b2 : 1;
+            s->arc_p = s->arc_p > delta ? s->arc_p - delta : 0;
+        }
+        list_remove(s, id);
+        if (s->resident == c) {
+            arc_replace(s, l == LIST_GHOST_B);
+        }
+        list_push(s, LIST_B, id);
+        s->resident++;
+        return;
+    }
+    // Read ahead, a ghost is only forgotten
+    if (l != LIST_NONE) {
+        list_remove(s, id);
+    }
+    size_t t1b1 = s->lists[LIST_A].size + s->lists[LIST_GHOST_A].size;
+    size_t total = t1b1 + s->lists[LIST_B].size + s->lists[LIST_GHOST_B].size;
+    if (t1b1 >= c) {
+        if (s->lists[LIST_A].size < c) {
+            drop_tail(s, LIST_GHOST_A);
+            if (s->resident == c) {
+                arc_replace(s, 0);
+            }
+        } else {
+            evict_tail(s, LIST_A, LIST_NONE);
+        }
+    } else if (total >= c) {
+        if (total >= 2 * c && s->lists[LIST_GHOST_B].size > 0) {
+            drop_tail(s, LIST_GHOST_B);
+        }
+        if (s->resident == c) {
+            arc_replace(s, 0);
+        }
+    }
+    list_push(s, LIST_A, id);
+    s->resident++;
+}
+
+// 2Q hits in A1in leave the page where it is: a burst of references counts once
+void twoq_hit(sim_t *s, uint32_t id) {
+    if ((s->nodes[id].flags & LIST_MASK) == LIST_B) {
+        list_remove(s, id);
+        list_push(s, LIST_B, id);
+    }
+}
+
+void twoq_reclaim(sim_t *s) {
+    size_t kin = s->budget / 4 > 0 ? s->budget / 4 : 1;
+    size_t kout = s->budget / 2 > 0 ? s->budget / 2 : 1;
+    if (s->resident < s->budget) {
+        return;
+    }
+    if (s->lists[LIST_A].size > kin || s->lists[LIST_B].size == 0) {
+        evict_tail(s, LIST_A, LIST_GHOST_A);
+        if (s->lists[LIST_GHOST_A].size > kout) {
+            drop_tail(s, LIST_GHOST_A);
+        }
+    } else {
+        evict_tail(s, LIST_B, LIST_NONE);
+    }
+}
+
+void twoq_insert(sim_t *s, uint32_t id, int demand) {
+    int remembered = (s->nodes[id].flags & LIST_MASK) == LIST_GHOST_A;
+    if (remembered) {
+        list_remove(s, id);
+    }
+    twoq_reclaim(s);
+    list_push(s, demand && remembered ? LIST_B : LIST_A, id);
+    s->resident++;
+}
+
+const evict_policy_t evict_policies[] = {
+    { "lru", lru_hit, lru_insert },
+    { "clock", clock_hit, clock_insert },
+    { "arc", arc_hit, arc_insert },
+    { "2q", twoq_hit, twoq_insert },
+};
+#define NUM_EVICT_POLICIES (sizeof(evict_policies) / sizeof(evict_policies[0]))
+
+// ---- Fetch policies ----
+
+/**
+ * Reads page `id` ahead of a fault unless it is resident. Returns 1 if it
+ * read it, 0 if it was resident already or is NIL.
+ */
+int prefetch(sim_t *s, uint32_t id) {
+    if (id == NIL || RESIDENT(s->nodes[id].flags)) {
+        return 0;
+    }
+    s->evict->insert(s, id, 0);
+    s->nodes[id].flags |= F_PREFETCHED;
+    s->prefetched++;
+    return 1;
+}
+
+// The id of `page`, a phantom one if it is outside the trace, or NIL if
+// every phantom is in use
+uint32_t any_id(sim_t *s, uint64_t page) {
+    uint32_t id = trace_id(page);
+    return id != NIL ? id : phantom_id(s, page);
+}
+
+/**
+ * Reads up to `count` pages after page `id`, stopping at the first resident
+ * one. Ids follow addresses, so the trace pages among them are the ids
+ * after `id` and need no lookup.
+ */
+void read_around(sim_t *s, uint32_t id, size_t count) {
+    uint64_t page = page_of[id];
+    uint32_t next = id + 1;
+    for (size_t k = 1; k <= count && page + k > page; k++) {
+        uint32_t target;
+        if (next < npages && page_of[next] == page + k) {
+            target = next++;
+        } else {
+            target = phantom_id(s, page + k);
+        }
+        if (!prefetch(s, target)) {
+            break;
+        }
+    }
+}
+
+// Reads ahead of a fault on page `id`, before the page itself goes in
+void fetch(sim_t *s, uint32_t id) {
+    uint64_t page = page_of[id];
+    // The faulting page must survive what is read with it
+    size_t most = s->budget - 1;
+    switch (s->fetch->kind) {
+    case FETCH_AROUND:
+        read_around(s, id, s->fetch->pages - 1 < most ? s->fetch->pages - 1 : most);
+        break;
+    case FETCH_ADAPTIVE:
+        if (s->faults > 1 && page > s->last_fault && page - s->last_fault <= s->window) {
+            s->window = s->window * 2 < ADAPTIVE_MAX_PAGES ? s->window * 2 : ADAPTIVE_MAX_PAGES;
+        } else if (s->window > 1) {
+            s->window /= 2;
+        }
+        read_around(s, id, s->window - 1 < most ? s->window - 1 : most);
+        break;
+    case FETCH_STRIDE: {
+        int64_t stride = (int64_t)(page - s->last_fault);
+        if (s->faults > 2 && stride == s->last_stride && stride != 0) {
+            uint64_t next = page;
+            for (size_t k = 0; k < s->fetch->pages && k < most; k++) {
+                // Stop short of wrapping around the address space
+                if ((stride > 0 && next + stride < next) || (stride < 0 && next < (uint64_t)-stride)) {
+                    break;
+                }
+                next += stride;
+                prefetch(s, any_id(s, next));
+            }
+        }
+        s->last_stride = stride;
+        break;
+    }
+    }
+    s->last_fault = page;
+}
+
+// ---- Simulations ----
+
+void run_sim(sim_t *s) {
+    size_t phantoms = s->fetch->kind == FETCH_DEMAND ? 0 : s->budget + 1;
+    size_t ids = npages + phantoms;
+    size_t table = 2;
+    while (table < phantoms * 2) {
+        table *= 2;
+    }
+    s->nodes = calloc(ids, sizeof(node_t));
+    s->ring = malloc(s->budget * sizeof(uint32_t));
+    s->phantom_page = malloc((phantoms + 1) * sizeof(uint64_t));
+    s->phantom_free = malloc((phantoms + 1) * sizeof(uint32_t));
+    s->phantom_table = calloc(table, sizeof(uint32_t));
+    if (s->nodes == NULL || s->ring == NULL || s->phantom_page == NULL ||
+        s->phantom_free == NULL || s->phantom_table == NULL) {
+        perror("Failed to allocate simulation");
+        exit(1);
+    }
+    s->phantom_mask = table - 1;
+    for (size_t i = 0; i < phantoms; i++) {
+        s->phantom_free[s->nfree++] = phantoms - 1 - i;
+    }
+    for (int l = 0; l < 5; l++) {
+        s->lists[l] = (list_t){ NIL, NIL, 0 };
+    }
+    s->window = 1;
+
+    const evict_policy_t *evict = s->evict;
+    int demand_only = s->fetch->kind == FETCH_DEMAND;
+    for (size_t i = 0; i < nevents; i++) {
+        if (i + PREFETCH_AHEAD < nevents) {
+            __builtin_prefetch(&s->nodes[events[i + PREFETCH_AHEAD] & ~EVENT_WRITE]);
+        }
+        uint32_t id = events[i] & ~EVENT_WRITE;
+        uint8_t flags = s->nodes[id].flags;
+        if (RESIDENT(flags)) {
+            if (flags & F_PREFETCHED) {
+                s->used++;
+                s->nodes[id].flags = flags & ~F_PREFETCHED;
+            }
+            evict->hit(s, id);
+        } else {
+            s->faults++;
+            if (!demand_only) {
+                fetch(s, id);
+            }
+            evict->insert(s, id, 1);
+        }
+        if (events[i] & EVENT_WRITE) {
+            s->nodes[id].flags |= F_DIRTY;
+        }
+    }
+
+    free(s->nodes);
+    free(s->ring);
+    free(s->phantom_page);
+    free(s->phantom_free);
+    free(s->phantom_table);
+}
+
+void *sim_thread(void *arg) {
+    for (;;) {
+        size_t i = __atomic_fetch_add(&next_sim, 1, __ATOMIC_RELAXED);
+        if (i >= nsims) {
+            return NULL;
+        }
+        run_sim(&sims[i]);
+    }
+}
+
+// ---- Options ----
+
+int parse_evict(char *list, const evict_policy_t **out, int *n) {
+    for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+        size_t p = 0;
+        while (p < NUM_EVICT_POLICIES && strcmp(evict_policies[p].name, name) != 0) {
+            p++;
+        }
+        if (p == NUM_EVICT_POLICIES || *n == MAX_SETTINGS) {
+            fprintf(stderr, "Unknown eviction policy: %s\n", name);
+            return -1;
+        }
+        out[(*n)++] = &evict_policies[p];
+    }
+    return 0;
+}
+
+int parse_fetch(char *list, fetch_policy_t *out, int *n) {
+    for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+        fetch_policy_t f = { .kind = -1 };
+        long pages = 0;
+        if (strcmp(name, "demand") == 0) {
+            f.kind = FETCH_DEMAND;
+        } else if (strcmp(name, "adaptive") == 0) {
+            f.kind = FETCH_ADAPTIVE;
+        } else if (strncmp(name, "around=", 7) == 0 && (pages = atol(name + 7)) > 0) {
+            f.kind = FETCH_AROUND;
+        } else if (strncmp(name, "stride=", 7) == 0 && (pages = atol(name + 7)) > 0) {
+            f.kind = FETCH_STRIDE;
+        }
+        if (f.kind < 0 || *n == MAX_SETTINGS) {
+            fprintf(stderr, "Unknown fetch policy: %s\n", name);
+            return -1;
+        }
+        f.pages = pages;
+        snprintf(f.name, sizeof(f.name), "%s", name);
+        out[(*n)++] = f;
+    }
+    return 0;
+}
+
+int parse_budgets(char *list, size_t *out, int *n) {
+    char *dash = strchr(list, '-');
+    if (dash != NULL) {
+        size_t min = atol(list), max = atol(dash + 1);
+        if (min == 0 || max < min) {
+            fprintf(stderr, "Bad budget range: %s\n", list);
+            return -1;
+        }
+        for (size_t b = min; b <= max && *n < MAX_SETTINGS; b *= 2) {
+            out[(*n)++] = b;
+        }
+        return 0;
+    }
+    for (char *budget = strtok(list, ","); budget != NULL; budget = strtok(NULL, ",")) {
+        if (atol(budget) <= 0 || *n == MAX_SETTINGS) {
+            fprintf(stderr, "Bad budget: %s\n", budget);
+            return -1;
+        }
+        out[(*n)++] = atol(budget);
+    }
+    return 0;
+}
+
+void print_results(int csv) {
+    const char *head = csv ? "%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n" : "%-6s %-12s %8s %12s %7s %10s %10s %12s %8s %12s\n";
+    printf(head, "evict", "fetch", "budget", "faults", "miss%", "read_MiB", "written_MiB", "prefetched", "used%",
+           "modeled_ms");
+    for (size_t i = 0; i < nsims; i++) {
+        sim_t *s = &sims[i];
+        double mib = page_size / 1048576.0;
+        double ms = (s->faults * (fault_us + read_us) + s->prefetched * page_us) / 1000;
+        char used[16] = "-";
+        if (s->prefetched > 0) {
+            snprintf(used, sizeof(used), "%.1f", 100.0 * s->used / s->prefetched);
+        }
+        printf(csv ? "%s,%s,%zu,%lu,%.2f,%.1f,%.1f,%lu,%s,%.1f\n"
+                   : "%-6s %-12s %8zu %12lu %7.2f %10.1f %10.1f %12lu %8s %12.1f\n",
+               s->evict->name, s->fetch->name, s->budget, (unsigned long)s->faults,
+               nevents > 0 ? 100.0 * s->faults / nevents : 0.0, (s->faults + s->prefetched) * mib,
+               s->written * mib, (unsigned long)s->prefetched, used, ms);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const evict_policy_t *evicts[MAX_SETTINGS];
+    fetch_policy_t fetches[MAX_SETTINGS];
+    size_t budgets[MAX_SETTINGS];
+    int nevicts = 0, nfetches = 0, nbudgets = 0, csv = 0;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        int rc = 0;
+        if (strncmp(argv[1], "--evict=", 8) == 0) {
+            rc = parse_evict(argv[1] + 8, evicts, &nevicts);
+        } else if (strncmp(argv[1], "--fetch=", 8) == 0) {
+            rc = parse_fetch(argv[1] + 8, fetches, &nfetches);
+        } else if (strncmp(argv[1], "--budgets=", 10) == 0) {
+            rc = parse_budgets(argv[1] + 10, budgets, &nbudgets);
+        } else if (strncmp(argv[1], "--latency=", 10) == 0) {
+            rc = sscanf(argv[1] + 10, "%lf,%lf,%lf", &fault_us, &read_us, &page_us) == 3 ? 0 : -1;
+        } else if (strncmp(argv[1], "--threads=", 10) == 0) {
+            threads = atol(argv[1] + 10);
+        } else if (strncmp(argv[1], "--page-size=", 12) == 0) {
+            page_size = atol(argv[1] + 12);
+            rc = page_size > 0 && (page_size & (page_size - 1)) == 0 ? 0 : -1;
+        } else if (strcmp(argv[1], "--csv") == 0) {
+            csv = 1;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[1]);
+            return 1;
+        }
+        if (rc != 0) {
+            fprintf(stderr, "Bad option: %s\n", argv[1]);
+            return 1;
+        }
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    if (argc != 2) {
+        printf("Usage: %s [--evict=LIST] [--fetch=LIST] [--budgets=LIST|MIN-MAX] [--latency=F,R,P] "
+               "[--threads=N] [--page-size=N] [--csv] <trace>\n", argv[0]);
+        return 1;
+    }
+
+    struct timespec begin, loaded, done;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    if (load_trace(argv[1]) != 0) {
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &loaded);
+    if (nevents == 0) {
+        fprintf(stderr, "%s holds no references\n", argv[1]);
+        return 1;
+    }
+    if (nevicts == 0) {
+        for (size_t p = 0; p < NUM_EVICT_POLICIES; p++) {
+            evicts[nevicts++] = &evict_policies[p];
+        }
+    }
+    if (nfetches == 0) {
+        fetches[nfetches++] = (fetch_policy_t){ "demand", FETCH_DEMAND, 0 };
+    }
+    if (nbudgets == 0) {
+        for (size_t b = 16; b < npages && nbudgets < MAX_SETTINGS - 1; b *= 2) {
+            budgets[nbudgets++] = b;
+        }
+        budgets[nbudgets++] = npages;
+    }
+    fprintf(csv ? stderr : stdout, "%s: %zu references, %lu writes, to %u pages, read in %.2f s\n", argv[1], nevents,
+            (unsigned long)nwrites, npages,
+            (loaded.tv_sec - begin.tv_sec) + (loaded.tv_nsec - begin.tv_nsec) / 1e9);
+
+    nsims = (size_t)nevicts * nfetches * nbudgets;
+    sims = calloc(nsims, sizeof(sim_t));
+    if (sims == NULL) {
+        perror("Failed to allocate simulations");
+        return 1;
+    }
+    size_t i = 0;
+    for (int e = 0; e < nevicts; e++) {
+        for (int f = 0; f < nfetches; f++) {
+            for (int b = 0; b < nbudgets; b++) {
+                sims[i++] = (sim_t){ .evict = evicts[e], .fetch = &fetches[f], .budget = budgets[b] };
+            }
+        }
+    }
+
+    threads = threads < 1 ? 1 : threads > nsims ? nsims : threads;
+    pthread_t *pool = malloc(threads * sizeof(pthread_t));
+    if (pool == NULL) {
+        perror("Failed to allocate threads");
+        return 1;
+    }
+    for (long t = 0; t < threads; t++) {
+        if (pthread_create(&pool[t], NULL, sim_thread, NULL) != 0) {
+            perror("Failed to start simulation thread");
+            return 1;
+        }
+    }
+    for (long t = 0; t < threads; t++) {
+        pthread_join(pool[t], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &done);
+
+    print_results(csv);
+    double seconds = (done.tv_sec - loaded.tv_sec) + (done.tv_nsec - loaded.tv_nsec) / 1e9;
+    fprintf(csv ? stderr : stdout, "%zu simulations on %ld threads in %.2f s, %.1f M references/s\n", nsims, threads,
+            seconds, seconds > 0 ? nsims * nevents / seconds / 1e6 : 0.0);
+    return 0;
+}
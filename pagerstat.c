@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "stats.h"
+
+/*
+ * Prints the live counters of a pager started with --stats, vmstat style:
+ *
+ *   pagerstat [-r] [-p pid] [interval [count]]
+ *
+ * Without -p it attaches to the only running pager. Rates are per second
+ * over each interval; -r adds a line per region that faulted in it. Segments
+ * left behind by pagers that have exited are removed on the way.
+ */
+
+#define HEADER_EVERY 20
+
+typedef struct {
+    uint64_t faults[STATS_MAX_REGIONS][STATS_FAULT_KINDS];
+    uint64_t installed;
+    uint64_t prefetched;
+    uint64_t evicted;
+    uint64_t bytes_read;
+    uint64_t handler_ns;
+} totals_t;
+
+int pager_alive(pid_t pid) {
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+// Finds the one live pager, removing segments of dead ones. Returns its pid,
+// 0 if there is none, or -1 if there are several (after listing them).
+pid_t find_pager() {
+    DIR *dir = opendir("/dev/shm");
+    if (dir == NULL) {
+        perror("Failed to open /dev/shm");
+        return 0;
+    }
+
+    pid_t found = 0;
+    int live = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, STATS_SHM_PREFIX + 1, strlen(STATS_SHM_PREFIX) - 1) != 0) {
+            continue;
+        }
+        pid_t pid = atoi(entry->d_name + strlen(STATS_SHM_PREFIX) - 1);
+        char name[sizeof(entry->d_name) + 1];
+        snprintf(name, sizeof(name), "/%s", entry->d_name);
+        if (!pager_alive(pid)) {
+            shm_unlink(name);
+            continue;
+        }
+        if (live++ == 1) {
+            printf("Several pagers are running, pick one:\n  %d\n", found);
+        }
+        if (live > 1) {
+            printf("  %d\n", pid);
+        }
+        found = pid;
+    }
+    closedir(dir);
+    return live > 1 ? -1 : found;
+}
+
+stats_shm_t *attach(pid_t pid) {
+    char name[64];
+    snprintf(name, sizeof(name), STATS_SHM_PREFIX "%d", pid);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "No stats for pid %d (was it started with --stats?)\n", pid);
+        return NULL;
+    }
+    stats_shm_t *shm = mmap(NULL, sizeof(stats_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        perror("Failed to map stats segment");
+        return NULL;
+    }
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC || shm->version != STATS_VERSION) {
+        fprintf(stderr, "%s is not a pager stats segment this pagerstat understands\n", name);
+        return NULL;
+    }
+    return shm;
+}
+
+void sum_threads(stats_shm_t *shm, totals_t *t) {
+    memset(t, 0, sizeof(*t));
+    unsigned nthreads = __atomic_load_n(&shm->nthreads, __ATOMIC_ACQUIRE);
+    for (unsigned i = 0; i < nthreads && i < STATS_MAX_THREADS; i++) {
+        volatile stats_thread_t *th = &shm->threads[i];
+        for (int r = 0; r < STATS_MAX_REGIONS; r++) {
+            for (int k = 0; k < STATS_FAULT_KINDS; k++) {
+                t->faults[r][k] += th->faults[r][k];
+            }
+        }
+        t->installed += th->pages_installed;
+        t->prefetched += th->pages_prefetched;
+        t->evicted += th->pages_evicted;
+        t->bytes_read += th->bytes_read;
+        t->handler_ns += th->handler_ns;
+    }
+}
+
+uint64_t all_faults(totals_t *t, int kind) {
+    uint64_t n = 0;
+    for (int r = 0; r < STATS_MAX_REGIONS; r++) {
+        n += t->faults[r][kind];
+    }
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    int per_region = 0;
+    pid_t pid = 0;
+    while (argc > 1 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "-r") == 0) {
+            per_region = 1;
+        } else if (strcmp(argv[1], "-p") == 0 && argc > 2 && atoi(argv[2]) > 0) {
+            pid = atoi(argv[2]);
+            argv[2] = argv[0];
+            argv++;
+            argc--;
+        } else {
+            printf("Usage: %s [-r] [-p pid] [interval [count]]\n", argv[0]);
+            return 1;
+        }
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
+    double interval = argc > 1 ? atof(argv[1]) : 1.0;
+    long count = argc > 2 ? atol(argv[2]) : -1;
+    if (interval <= 0) {
+        fprintf(stderr, "Interval must be positive\n");
+        return 1;
+    }
+    if (pid == 0) {
+        pid = find_pager();
+        if (pid == 0) {
+            fprintf(stderr, "No pager with --stats is running\n");
+        }
+        if (pid <= 0) {
+            return 1;
+        }
+    }
+
+    stats_shm_t *shm = attach(pid);
+    if (shm == NULL) {
+        return 1;
+    }
+    printf("%s (pid %d) running %s, %u threads\n", shm->pager, pid, shm->guest,
+           __atomic_load_n(&shm->nthreads, __ATOMIC_ACQUIRE));
+
+    totals_t prev, cur;
+    sum_threads(shm, &prev);
+    uint64_t prev_ns = stats_now();
+    for (long row = 0; count < 0 || row < count; row++) {
+        usleep(interval * 1e6);
+        int alive = pager_alive(pid);
+        sum_threads(shm, &cur);
+        uint64_t now = stats_now();
+        double secs = (now - prev_ns) / 1e9;
+
+        if (row % HEADER_EVERY == 0) {
+            printf("%9s %8s %8s %8s %10s %10s %9s %9s %10s %9s\n", "faults/s", "read", "write", "exec",
+                   "install/s", "prefetch/s", "evict/s", "resident", "readKB/s", "us/fault");
+        }
+        uint64_t faults[STATS_FAULT_KINDS], total = 0;
+        for (int k = 0; k < STATS_FAULT_KINDS; k++) {
+            faults[k] = all_faults(&cur, k) - all_faults(&prev, k);
+            total += faults[k];
+        }
+        printf("%9.0f %8.0f %8.0f %8.0f %10.0f %10.0f %9.0f %9lu %10.1f %9.1f\n",
+               total / secs, faults[STATS_FAULT_READ] / secs, faults[STATS_FAULT_WRITE] / secs,
+               faults[STATS_FAULT_EXEC] / secs, (cur.installed - prev.installed) / secs,
+               (cur.prefetched - prev.prefetched) / secs, (cur.evicted - prev.evicted) / secs,
+               (unsigned long)(cur.installed - cur.evicted), (cur.bytes_read - prev.bytes_read) / secs / 1024,
+               total > 0 ? (cur.handler_ns - prev.handler_ns) / 1e3 / total : 0.0);
+
+        if (per_region) {
+            unsigned nregions = __atomic_load_n(&shm->nregions, __ATOMIC_ACQUIRE);
+            for (int r = 0; r < STATS_MAX_REGIONS; r++) {
+                if (r >= nregions && r != STATS_OTHER_REGION) {
+                    continue;
+                }
+                uint64_t n[STATS_FAULT_KINDS], sum = 0;
+                for (int k = 0; k < STATS_FAULT_KINDS; k++) {
+                    n[k] = cur.faults[r][k] - prev.faults[r][k];
+                    sum += n[k];
+                }
+                if (sum > 0) {
+                    printf("  %-7s %#14lx %8.0f %8.0f %8.0f\n", shm->regions[r].name,
+                           (unsigned long)shm->regions[r].start, n[STATS_FAULT_READ] / secs,
+                           n[STATS_FAULT_WRITE] / secs, n[STATS_FAULT_EXEC] / secs);
+                }
+            }
+        }
+        fflush(stdout);
+
+        if (!alive) {
+            char name[64];
+            snprintf(name, sizeof(name), STATS_SHM_PREFIX "%d", pid);
+            shm_unlink(name);
+            printf("Pager %d has exited\n", pid);
+            break;
+        }
+        prev = cur;
+        prev_ns = now;
+    }
+    return 0;
+}
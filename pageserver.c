@@ -0,0 +1,195 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "remote.h"
+
+/*
+ * Stand-in for a far-memory node: serves the pages of one file to
+ * `dpager --page-server=SOCKET`, see remote.h for the protocol.
+ *
+ * --latency-us=N holds every request for N microseconds before answering it,
+ * like a network round trip would. Requests are timed from when they arrive,
+ * not from when the previous one was answered, so a client that keeps several
+ * requests in flight pays the latency once per window rather than once per
+ * request.
+ */
+
+// Requests received but not yet answered, per client
+#define MAX_PENDING 256
+
+int file_fd;
+off_t file_size;
+size_t page_size;
+long latency_ns = 0;
+
+typedef struct {
+    ps_request_t req;
+    long due_ns;
+} pending_t;
+
+long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+int send_pages(int sock, ps_request_t *req, char *buf) {
+    for (uint32_t i = 0; i < req->count; i++) {
+        ps_page_t hdr = { .offset = req->offsets[i] };
+        ssize_t n = 0;
+        if ((off_t)hdr.offset < file_size) {
+            n = pread(file_fd, buf, page_size, hdr.offset);
+            if (n < 0) {
+                perror("Failed to read page");
+                return -1;
+            }
+        }
+        hdr.len = n;
+
+        struct iovec iov[2] = { { &hdr, sizeof(hdr) }, { buf, n } };
+        struct msghdr mh = { .msg_iov = iov, .msg_iovlen = 2 };
+        if (sendmsg(sock, &mh, MSG_NOSIGNAL) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Serves one client. Requests queue up with the time they are due, and the
+ * thread sleeps in poll until either the oldest one is due or another request
+ * arrives.
+ */
+void *client_thread(void *arg) {
+    int sock = (int)(long)arg;
+    char *buf = malloc(page_size);
+    pending_t *queue = malloc(MAX_PENDING * sizeof(pending_t));
+    unsigned head = 0, tail = 0;
+    unsigned long requests = 0, pages = 0;
+    int open = buf != NULL && queue != NULL;
+
+    ps_hello_t hello = { .magic = PS_MAGIC, .page_size = page_size, .file_size = file_size };
+    if (open && send(sock, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello)) {
+        open = 0;
+    }
+
+    while (open || head != tail) {
+        long now = now_ns();
+        while (head != tail && queue[head % MAX_PENDING].due_ns <= now) {
+            if (send_pages(sock, &queue[head % MAX_PENDING].req, buf) != 0) {
+                open = 0;
+                tail = head;
+                break;
+            }
+            head++;
+        }
+        if (!open) {
+            // The client is gone; nobody is waiting for what is left
+            break;
+        }
+
+        int timeout = -1;
+        if (head != tail) {
+            timeout = (queue[head % MAX_PENDING].due_ns - now + 999999) / 1000000;
+        }
+        struct pollfd pfd = { .fd = sock, .events = tail - head < MAX_PENDING ? POLLIN : 0 };
+        if (poll(&pfd, 1, timeout) <= 0 || !(pfd.revents & (POLLIN | POLLHUP))) {
+            continue;
+        }
+
+        pending_t *p = &queue[tail % MAX_PENDING];
+        ssize_t n = recv(sock, &p->req, sizeof(p->req), 0);
+        if (n <= 0) {
+            open = 0;
+            break;
+        }
+        if (n < (ssize_t)offsetof(ps_request_t, offsets) ||
+            p->req.count > PS_MAX_BATCH ||
+            n != (ssize_t)(offsetof(ps_request_t, offsets) + p->req.count * sizeof(uint64_t))) {
+            fprintf(stderr, "Malformed request from client %d\n", sock);
+            break;
+        }
+        p->due_ns = now_ns() + latency_ns;
+        tail++;
+        requests++;
+        pages += p->req.count;
+    }
+
+    printf("Client %d done: %lu requests, %lu pages", sock, requests, pages);
+    printf(" (%.1f pages per request)\n", requests > 0 ? (double)pages / requests : 0.0);
+    fflush(stdout);
+    close(sock);
+    free(queue);
+    free(buf);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        if (strncmp(argv[1], "--latency-us=", 13) == 0) {
+            latency_ns = atol(argv[1] + 13) * 1000;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[1]);
+            return 1;
+        }
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    if (argc < 3) {
+        printf("Usage: %s [--latency-us=N] <socket> <file>\n", argv[0]);
+        return 1;
+    }
+
+    page_size = sysconf(_SC_PAGE_SIZE);
+    file_fd = open(argv[2], O_RDONLY);
+    struct stat st;
+    if (file_fd < 0 || fstat(file_fd, &st) == -1) {
+        perror("Failed to open file");
+        return 1;
+    }
+    file_size = st.st_size;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+    int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    unlink(argv[1]);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listen_fd, 16) == -1) {
+        perror("Failed to listen on socket");
+        return 1;
+    }
+    printf("Serving %s (%ld bytes) on %s, %ld us latency\n",
+           argv[2], (long)file_size, argv[1], latency_ns / 1000);
+    fflush(stdout);
+
+    for (;;) {
+        int sock = accept(listen_fd, NULL, NULL);
+        if (sock < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to accept client");
+            return 1;
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, client_thread, (void *)(long)sock) != 0) {
+            fprintf(stderr, "Failed to start client thread\n");
+            close(sock);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+#include "perf.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "stats.h"
+
+#define CACHE_MISSES(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+typedef struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} perf_counter_t;
+
+static const perf_counter_t counters[] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "dTLB load misses", PERF_TYPE_HW_CACHE, CACHE_MISSES(PERF_COUNT_HW_CACHE_DTLB) },
+    { "iTLB load misses", PERF_TYPE_HW_CACHE, CACHE_MISSES(PERF_COUNT_HW_CACHE_ITLB) },
+    { "minor faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN },
+    { "major faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ },
+    { "context switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+#define NUM_COUNTERS (int)(sizeof(counters) / sizeof(counters[0]))
+
+// What the child tells the reporter about each counter, ahead of the fds
+// of the ones it opened, in the same order
+#define COUNTER_OPEN 0
+#define COUNTER_USER_ONLY 1     // opened without the kernel's share
+#define COUNTER_UNSUPPORTED 2
+#define COUNTER_FAILED 3
+
+static int report_sock = -1;    // the child's end
+static int count_guest;
+static void (*report_at_exit)();
+static pid_t reported_pid;      // the reporter's child
+
+static int open_counter(const perf_counter_t *counter, int exclude_kernel) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter->type;
+    attr.config = counter->config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = exclude_kernel;
+    attr.exclude_hv = exclude_kernel;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+void perf_enter_guest() {
+    if (!count_guest || report_sock < 0) {
+        return;
+    }
+    uint8_t status[NUM_COUNTERS];
+    int fds[NUM_COUNTERS], nfds = 0;
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        int fd = open_counter(&counters[i], 0);
+        status[i] = COUNTER_OPEN;
+        if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+            // perf_event_paranoid may still allow counting user space
+            fd = open_counter(&counters[i], 1);
+            status[i] = COUNTER_USER_ONLY;
+        }
+        if (fd < 0) {
+            // VMs commonly expose no PMU, or only part of one
+            status[i] = (errno == ENOENT || errno == EOPNOTSUPP || errno == ENODEV || errno == EINVAL)
+                            ? COUNTER_UNSUPPORTED : COUNTER_FAILED;
+            continue;
+        }
+        fds[nfds++] = fd;
+    }
+
+    struct iovec iov = { status, sizeof(status) };
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+    if (nfds > 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+    if (sendmsg(report_sock, &msg, 0) == -1) {
+        perror("Failed to hand counters to the reporter");
+    }
+
+    // The reporter's copies keep the counters alive, so the guest inherits
+    // no descriptors of ours
+    for (int i = 0; i < nfds; i++) {
+        ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+    for (int i = 0; i < nfds; i++) {
+        close(fds[i]);
+    }
+    close(report_sock);
+    report_sock = -1;
+}
+
+static void print_pager_stats() {
+    stats_shm_t *shm = stats_segment();
+    uint64_t faults[STATS_FAULT_KINDS] = { 0 }, installed = 0, prefetched = 0, evicted = 0, handler_ns = 0;
+    unsigned nthreads = __atomic_load_n(&shm->nthreads, __ATOMIC_ACQUIRE);
+    for (unsigned i = 0; i < nthreads && i < STATS_MAX_THREADS; i++) {
+        stats_thread_t *th = &shm->threads[i];
+        for (int r = 0; r < STATS_MAX_REGIONS; r++) {
+            for (int k = 0; k < STATS_FAULT_KINDS; k++) {
+                faults[k] += th->faults[r][k];
+            }
+        }
+        installed += th->pages_installed;
+        prefetched += th->pages_prefetched;
+        evicted += th->pages_evicted;
+        handler_ns += th->handler_ns;
+    }
+    printf("Pager fault stats:\n");
+    printf("  %-18s %14lu (%lu read, %lu write, %lu exec)\n", "faults",
+           faults[STATS_FAULT_READ] + faults[STATS_FAULT_WRITE] + faults[STATS_FAULT_EXEC],
+           faults[STATS_FAULT_READ], faults[STATS_FAULT_WRITE], faults[STATS_FAULT_EXEC]);
+    printf("  %-18s %14lu (%lu prefetched)\n", "pages installed", installed, prefetched);
+    printf("  %-18s %14lu\n", "pages evicted", evicted);
+    printf("  %-18s %14.3f ms\n", "resolving faults", handler_ns / 1e6);
+}
+
+static void print_counters(uint8_t *status, int *fds, int nfds) {
+    printf("Guest counters:\n");
+    double cycles = 0.0;
+    for (int i = 0, fd = 0; i < NUM_COUNTERS; i++) {
+        if (status[i] == COUNTER_UNSUPPORTED || status[i] == COUNTER_FAILED) {
+            printf("  %-18s %14s\n", counters[i].name,
+                   status[i] == COUNTER_UNSUPPORTED ? "not supported" : "not counted");
+            continue;
+        }
+        uint64_t values[3];    // value, time enabled, time running
+        if (fd >= nfds || read(fds[fd++], values, sizeof(values)) != sizeof(values)) {
+            printf("  %-18s %14s\n", counters[i].name, "not counted");
+            continue;
+        }
+        // With more counters than the PMU has, the kernel time-shares them
+        // and the count is scaled up to the whole run
+        double value = values[0];
+        int scaled = values[2] > 0 && values[2] < values[1];
+        if (scaled) {
+            value = value * values[1] / values[2];
+        }
+        printf("  %-18s %14.0f", counters[i].name, value);
+        if (counters[i].type == PERF_TYPE_HARDWARE && counters[i].config == PERF_COUNT_HW_CPU_CYCLES) {
+            cycles = value;
+        } else if (counters[i].type == PERF_TYPE_HARDWARE && cycles > 0.0) {
+            printf("  %.2f per cycle", value / cycles);
+        }
+        if (status[i] == COUNTER_USER_ONLY) {
+            printf("  (user only)");
+        }
+        if (scaled) {
+            printf("  (counted %lu%% of the time)", values[2] * 100 / values[1]);
+        }
+        printf("\n");
+    }
+    for (int i = 0; i < nfds; i++) {
+        close(fds[i]);
+    }
+    print_pager_stats();
+}
+
+static void forward_signal(int sig) {
+    kill(reported_pid, sig);
+}
+
+static int report(pid_t child, int sock) {
+    // Ctrl-C reaches the guest too; the report still has to come out
+    signal(SIGINT, SIG_IGN);
+    // The pid the user sees is ours, so requests for reports go on to the pager
+    reported_pid = child;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = forward_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    uint8_t status[NUM_COUNTERS];
+    int fds[NUM_COUNTERS], nfds = 0;
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { status, sizeof(status) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control,
+                          .msg_controllen = sizeof(control) };
+    // Nothing arrives if the pager fails before reaching the guest, or
+    // without counters
+    ssize_t n = count_guest ? recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) : 0;
+    struct cmsghdr *cmsg = n == sizeof(status) ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+    }
+    close(sock);
+
+    int wstatus;
+    while (waitpid(child, &wstatus, 0) == -1) {
+        if (errno != EINTR) {
+            perror("Failed to wait for the pager");
+            return 1;
+        }
+    }
+    if (n == sizeof(status)) {
+        print_counters(status, fds, nfds);
+    }
+    if (report_at_exit != NULL) {
+        report_at_exit();
+    }
+
+    if (WIFSIGNALED(wstatus)) {
+        printf("Guest killed by signal %d\n", WTERMSIG(wstatus));
+        return 128 + WTERMSIG(wstatus);
+    }
+    return WEXITSTATUS(wstatus);
+}
+
+int perf_start(int count, void (*at_exit)()) {
+    count_guest = count;
+    report_at_exit = at_exit;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("Failed to create the counter socket");
+        return -1;
+    }
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == -1) {
+        perror("Failed to fork the reporter");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (child == 0) {
+        close(sv[0]);
+        report_sock = sv[1];
+        return 0;
+    }
+    close(sv[1]);
+    int code = report(child, sv[0]);
+    fflush(stdout);
+    exit(code);
+}
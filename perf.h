@@ -0,0 +1,37 @@
+#ifndef PERF_H
+#define PERF_H
+
+/*
+ * Hardware and kernel counters for the guest, set by --perf.
+ *
+ * The guest leaves with exit_group, so nothing in the pager's process gets to
+ * run once it is done. perf_start therefore forks: the child goes on to load
+ * and run the guest, and the parent stays behind as a reporter. Right before
+ * the jump to the guest, the child opens the counters on its own thread with
+ * perf_event_open, inherited by any threads the guest creates, and passes
+ * them to the reporter over a socket. The pager's threads started earlier
+ * are not counted; its fault handler is whenever it runs on the guest's
+ * thread. Once the child has exited, the reporter reads the counters, prints
+ * them next to the pager's own fault stats and exits with the guest's status.
+ *
+ * Counters the machine or VM does not support are reported as such and the
+ * rest are still counted.
+ */
+
+/**
+ * Forks the reporter. With `count` set it prints the guest's counters, and
+ * it runs `at_exit`, if not NULL, after the guest has exited; --mrc reports
+ * its curve that way. Returns 0 in the child, which goes on to run the
+ * guest, or -1 if the fork failed. Does not return in the reporter. Call
+ * after stats_init and before any pager thread is started.
+ */
+int perf_start(int count, void (*at_exit)());
+
+/**
+ * Opens the counters on the calling thread, if perf_start was asked to
+ * count, hands them to the reporter and enables them. Call on the guest's
+ * thread right before jumping to the guest.
+ */
+void perf_enter_guest();
+
+#endif
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pager.h"
+
+/*
+ * Paging policies. Each used to be a pager of its own: apager loaded
+ * everything up front, dpager paged on demand, and hpager paged file data
+ * on demand but set up the zero-filled part eagerly and mapped one page
+ * ahead of every fault.
+ */
+
+// Writable segments (.data, .got, .bss) are what libc start-up touches first,
+// then text, then read-only data.
+static int writable_first(segment_state_t *seg) {
+    int flags = seg->phdr_index >= 0 ? ph[seg->phdr_index].p_flags
+                                     : ((seg->prot & PROT_WRITE) ? PF_W : 0) |
+                                           ((seg->prot & PROT_EXEC) ? PF_X : 0);
+    if (flags & PF_W) {
+        return 0;
+    }
+    if (flags & PF_X) {
+        return 1;
+    }
+    return 2;
+}
+
+// Sweep hand over every segment's pages
+static int hand_segment;
+static size_t hand_page;
+
+/**
+ * Evicts in address order, wrapping around, and skips each segment's most
+ * recent fault so the page the guest is about to use stays. Without access
+ * bits this is the best a userspace pager can cheaply do.
+ */
+static int sweep_evict(segment_state_t **seg, size_t *idx) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    size_t total = 0;
+    for (int s = 0; s < num_segments; s++) {
+        total += segment_evictable(&segments[s]) ? segments[s].npages : 0;
+    }
+
+    for (size_t n = 0; n < total + num_segments; n++) {
+        segment_state_t *s = &segments[hand_segment % num_segments];
+        if (hand_page >= s->npages || !segment_evictable(s)) {
+            hand_segment = (hand_segment + 1) % num_segments;
+            hand_page = 0;
+            continue;
+        }
+        size_t i = hand_page++;
+        if (__atomic_load_n(&s->state[i], __ATOMIC_ACQUIRE) == PAGE_PRESENT &&
+            s->start + i * page_size != s->last_fault) {
+            *seg = s;
+            *idx = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void install_all(segment_state_t *seg) {
+    install_parallel(seg, 0, seg->npages);
+}
+
+// Pages past the file-backed part hold nothing to read, so they are cheap to
+// set up now.
+static void install_zero_fill(segment_state_t *seg) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    if (seg->phdr_index < 0) {
+        return;
+    }
+    Elf64_Phdr *phdr = &ph[seg->phdr_index];
+    uintptr_t file_end = (phdr->p_vaddr + phdr->p_filesz + page_size - 1) & ~(page_size - 1);
+    size_t first = (file_end - seg->start) / page_size;
+    if (first < seg->npages) {
+        install_now(seg, first, seg->npages - first);
+    }
+}
+
+static size_t one_page(segment_state_t *seg, size_t idx) {
+    return 1;
+}
+
+static size_t next_page_too(segment_state_t *seg, size_t idx) {
+    return 2;
+}
+
+/*
+ * Adaptive policy: every region starts lazy and its faults are counted over a
+ * window of ADAPT_WINDOW_NS that slides by a slot of ADAPT_SLOT_NS at a time,
+ * with a count kept for each of the last ADAPT_SLOTS slots. A lazy region is
+ * checked on every fault as well, so a start-up burst is noticed while it is
+ * still going. Once the window holds ADAPT_HOT_FAULTS, the region moves to a
+ * fault-around window of ADAPT_AROUND_PAGES, or, if most of its faults
+ * continue where the previous one left off, to installing the rest of the
+ * region on each fault, up to ADAPT_EAGER_PAGES at a time. It steps back down
+ * one level only after the window has held at most ADAPT_COLD_FAULTS for
+ * ADAPT_COLD_WINDOWS windows' worth of slides in a row, so a region hovering
+ * around one threshold does not flip back and forth.
+ * Each switch is printed with the numbers behind it.
+ */
+#define ADAPT_WINDOW_NS 10000000ULL
+#define ADAPT_SLOTS 4
+#define ADAPT_SLOT_NS (ADAPT_WINDOW_NS / ADAPT_SLOTS)
+#define ADAPT_HOT_FAULTS 20         // per window
+#define ADAPT_COLD_FAULTS 4
+#define ADAPT_COLD_WINDOWS 3
+#define ADAPT_SEQUENTIAL_PERCENT 50
+#define ADAPT_AROUND_PAGES 16
+#define ADAPT_EAGER_PAGES 512       // 2 MiB, so a huge heap region is not filled in one go
+
+enum { ADAPT_LAZY, ADAPT_AROUND, ADAPT_EAGER };
+static const char *adapt_modes[] = { "lazy", "around", "eager" };
+
+typedef struct {
+    uintptr_t start;            // of the region this is for; heap regions come and go
+    int mode;
+    uint64_t slot_start;        // when the current slot began
+    int slot;
+    unsigned long faults[ADAPT_SLOTS];
+    unsigned long sequential[ADAPT_SLOTS];      // faults just past the previous one
+    size_t last_idx;
+    int cold_slides;
+} adapt_state_t;
+
+// One per segment, only touched by the thread that resolves faults
+static adapt_state_t *adapt;
+static uint64_t adapt_start;
+
+static void adapt_setup(segment_state_t *seg) {
+    if (adapt == NULL) {
+        adapt = calloc(max_segments, sizeof(adapt_state_t));
+        if (adapt == NULL) {
+            perror("Failed to allocate adaptive policy state");
+            exit(1);
+        }
+        adapt_start = stats_now();
+    }
+}
+
+static void adapt_switch(segment_state_t *seg, adapt_state_t *a, int mode, uint64_t now, unsigned long faults,
+                         unsigned long sequential) {
+    // Integers only: in mprotect mode this runs on the guest's thread, where
+    // floating-point printf would reach for the guest's locale
+    printf("Adaptive policy: %lu us, segment [%ld] %s -> %s (%lu faults in the last %lu us, %lu%% sequential)\n",
+           (unsigned long)(now - adapt_start) / 1000, (long)(seg - segments), adapt_modes[a->mode],
+           adapt_modes[mode], faults, (unsigned long)(ADAPT_WINDOW_NS / 1000),
+           faults > 0 ? sequential * 100 / faults : 0);
+    // The guest exits without flushing the pager's stdio
+    fflush(stdout);
+    a->mode = mode;
+}
+
+// Decides the region's mode from the window's counts, which stood for `slides` slides
+static void adapt_judge(segment_state_t *seg, adapt_state_t *a, uint64_t now, unsigned long faults,
+                        unsigned long sequential, uint64_t slides) {
+    if (faults >= ADAPT_HOT_FAULTS) {
+        int mode = sequential * 100 >= faults * ADAPT_SEQUENTIAL_PERCENT ? ADAPT_EAGER : ADAPT_AROUND;
+        if (mode != a->mode) {
+            adapt_switch(seg, a, mode, now, faults, sequential);
+        }
+        a->cold_slides = 0;
+    } else if (faults <= ADAPT_COLD_FAULTS && a->mode != ADAPT_LAZY) {
+        a->cold_slides += slides;
+        if (a->cold_slides >= ADAPT_COLD_WINDOWS * ADAPT_SLOTS) {
+            adapt_switch(seg, a, a->mode - 1, now, faults, sequential);
+            a->cold_slides = 0;
+        }
+    } else {
+        a->cold_slides = 0;
+    }
+}
+
+static void adapt_sum(adapt_state_t *a, unsigned long *faults, unsigned long *sequential) {
+    *faults = *sequential = 0;
+    for (int s = 0; s < ADAPT_SLOTS; s++) {
+        *faults += a->faults[s];
+        *sequential += a->sequential[s];
+    }
+}
+
+// Slides the window past every slot that has ended, judging the region at each step
+static void adapt_slide(segment_state_t *seg, adapt_state_t *a, uint64_t now) {
+    uint64_t steps = (now - a->slot_start) / ADAPT_SLOT_NS;
+    for (uint64_t i = 0; i < steps; i++) {
+        unsigned long faults, sequential;
+        adapt_sum(a, &faults, &sequential);
+        if (faults == 0) {
+            // The window is empty for the rest of a quiet spell
+            adapt_judge(seg, a, now, 0, 0, steps - i);
+            break;
+        }
+        adapt_judge(seg, a, now, faults, sequential, 1);
+        a->slot = (a->slot + 1) % ADAPT_SLOTS;
+        a->faults[a->slot] = a->sequential[a->slot] = 0;
+    }
+    a->slot_start += steps * ADAPT_SLOT_NS;
+}
+
+static size_t adapt_fault_around(segment_state_t *seg, size_t idx) {
+    if (adapt == NULL || seg->phdr_index == SEGMENT_MIGRATED) {
+        return 1;
+    }
+    adapt_state_t *a = &adapt[seg - segments];
+    uint64_t now = stats_now();
+    if (a->start != seg->start) {
+        memset(a, 0, sizeof(*a));
+        a->start = seg->start;
+        a->last_idx = (size_t)-1;
+        a->slot_start = now;
+    } else if (now - a->slot_start >= ADAPT_SLOT_NS) {
+        adapt_slide(seg, a, now);
+    }
+
+    size_t count = 1;
+    if (a->mode == ADAPT_AROUND) {
+        count = ADAPT_AROUND_PAGES;
+    } else if (a->mode == ADAPT_EAGER) {
+        count = seg->npages - idx < ADAPT_EAGER_PAGES ? seg->npages - idx : ADAPT_EAGER_PAGES;
+    }
+    a->faults[a->slot]++;
+    a->sequential[a->slot] += idx > a->last_idx && idx - a->last_idx <= ADAPT_AROUND_PAGES;
+    a->last_idx = idx;
+
+    // A burst is hot as soon as the window holds enough faults, before the window slides
+    if (a->mode == ADAPT_LAZY) {
+        unsigned long faults, sequential;
+        adapt_sum(a, &faults, &sequential);
+        if (faults >= ADAPT_HOT_FAULTS) {
+            adapt_judge(seg, a, now, faults, sequential, 1);
+        }
+    }
+    return count;
+}
+
+static pager_policy_t policies[] = {
+    {
+        .name = "eager",
+        .description = "install every page before the guest starts",
+        .setup_region = install_all,
+        .fault_around = one_page,
+    },
+    {
+        .name = "demand",
+        .description = "install each page on its first fault",
+        .fault_around = one_page,
+        .prefetch_rank = writable_first,
+        .evict = sweep_evict,
+    },
+    {
+        .name = "hybrid",
+        .description = "zero-fill pages up front, file pages on demand with the next page",
+        .setup_region = install_zero_fill,
+        .fault_around = next_page_too,
+        .prefetch_rank = writable_first,
+        .evict = sweep_evict,
+    },
+    {
+        .name = "adaptive",
+        .description = "per region, switch between demand, fault-around and eager by fault rate",
+        .setup_region = adapt_setup,
+        .fault_around = adapt_fault_around,
+        .prefetch_rank = writable_first,
+        .evict = sweep_evict,
+    },
+};
+
+pager_policy_t *find_policy(const char *name) {
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(policies[i].name, name) == 0) {
+            return &policies[i];
+        }
+    }
+    return NULL;
+}
+
+void list_policies() {
+    fprintf(stderr, "Policies:\n");
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        fprintf(stderr, "  %-8s %s\n", policies[i].name, policies[i].description);
+    }
+}
@@ -0,0 +1,70 @@
+#define _GNU_SOURCE
+#include "psi.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PSI_MEMORY "/proc/pressure/memory"
+
+static int psi_fd = -1;
+
+static int arm_trigger(unsigned stall_ms, unsigned window_ms) {
+    char trigger[64];
+    // The kernel wants the terminating NUL written too
+    int len = snprintf(trigger, sizeof(trigger), "some %u %u", stall_ms * 1000, window_ms * 1000) + 1;
+    int fd = open(PSI_MEMORY, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (write(fd, trigger, len) != len) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+int psi_open(unsigned stall_ms) {
+    psi_fd = arm_trigger(stall_ms, 1000);
+    if (psi_fd < 0 && errno == EINVAL) {
+        // Unprivileged triggers need a window in whole multiples of 2 s
+        psi_fd = arm_trigger(stall_ms * 2, 2000);
+    }
+    if (psi_fd < 0) {
+        perror("Failed to set a memory pressure trigger on " PSI_MEMORY);
+        return -1;
+    }
+    return 0;
+}
+
+int psi_wait(int timeout_ms) {
+    struct pollfd pfd = { .fd = psi_fd, .events = POLLPRI };
+    int n = poll(&pfd, 1, timeout_ms);
+    if (n == -1) {
+        return errno == EINTR ? 0 : -1;
+    }
+    if (n > 0 && (pfd.revents & POLLERR)) {
+        // The trigger is gone, such as with its cgroup
+        return -1;
+    }
+    return n > 0;
+}
+
+double psi_some_avg10() {
+    char line[256];
+    double avg10 = 0.0;
+    FILE *f = fopen(PSI_MEMORY, "r");
+    if (f == NULL) {
+        return 0.0;
+    }
+    if (fgets(line, sizeof(line), f) == NULL || sscanf(line, "some avg10=%lf", &avg10) != 1) {
+        avg10 = 0.0;
+    }
+    fclose(f);
+    return avg10;
+}
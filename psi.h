@@ -0,0 +1,28 @@
+#ifndef PSI_H
+#define PSI_H
+
+/*
+ * Host memory pressure from pressure stall information, for --reclaim.
+ *
+ * A PSI trigger on /proc/pressure/memory wakes the pager once tasks have
+ * stalled on memory for `stall_ms` within a window, 1 s where the kernel
+ * allows it and 2 s for unprivileged pagers. The pager then reads the
+ * "some" ten-second average to see when the pressure has cleared.
+ */
+
+/**
+ * Arms the trigger for `stall_ms` of stalls per window. Returns 0, or -1 if
+ * the kernel has no PSI or refuses the trigger.
+ */
+int psi_open(unsigned stall_ms);
+
+/**
+ * Waits up to `timeout_ms` for the trigger. Returns 1 if it fired, 0 if
+ * not, or -1 on an error.
+ */
+int psi_wait(int timeout_ms);
+
+// The share of the last ten seconds some task stalled on memory, in percent
+double psi_some_avg10();
+
+#endif
@@ -0,0 +1,206 @@
+#define _GNU_SOURCE
+#include "remote.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+// Pages held locally, and how far a miss reads ahead
+#define REMOTE_CACHE_PAGES 256
+#define REMOTE_READAHEAD 8
+
+#define SLOT_EMPTY 0
+#define SLOT_PENDING 1      // requested, data not here yet
+#define SLOT_READY 2
+
+typedef struct {
+    uint64_t tag;           // file offset of the page held or requested
+    int state;
+    int lock;
+} slot_t;
+
+static int sock = -1;
+static size_t page_size;
+static off_t remote_size;
+static slot_t slots[REMOTE_CACHE_PAGES];
+static char *cache;         // REMOTE_CACHE_PAGES pages
+static char *recv_buf;
+
+static void lock_slot(slot_t *slot) {
+    while (__atomic_exchange_n(&slot->lock, 1, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+static void unlock_slot(slot_t *slot) {
+    __atomic_store_n(&slot->lock, 0, __ATOMIC_RELEASE);
+}
+
+static slot_t *slot_for(uint64_t offset) {
+    return &slots[(offset / page_size) % REMOTE_CACHE_PAGES];
+}
+
+static char *slot_data(slot_t *slot) {
+    return cache + (slot - slots) * page_size;
+}
+
+/**
+ * Claims the slot for `offset` and marks it pending. A demand fetch may evict
+ * whatever the slot holds; a prefetch only takes slots nobody is waiting on.
+ * Returns 1 if the caller must request the page.
+ */
+static int claim(uint64_t offset, int demand) {
+    slot_t *slot = slot_for(offset);
+    int claimed = 0;
+    lock_slot(slot);
+    if (slot->tag != offset || slot->state == SLOT_EMPTY) {
+        if (demand || slot->state != SLOT_PENDING) {
+            slot->tag = offset;
+            slot->state = SLOT_PENDING;
+            claimed = 1;
+        }
+    }
+    unlock_slot(slot);
+    return claimed;
+}
+
+static void send_request(ps_request_t *req) {
+    if (req->count > 0) {
+        send(sock, req, offsetof(ps_request_t, offsets) + req->count * sizeof(uint64_t), MSG_NOSIGNAL);
+        req->count = 0;
+    }
+}
+
+// Requests the pages in [first, last] that are not cached or in flight.
+static void request_range(uint64_t first, uint64_t last, uint64_t demand) {
+    ps_request_t req = { 0 };
+    for (uint64_t offset = first; offset <= last && offset < remote_size; offset += page_size) {
+        if (claim(offset, offset == demand)) {
+            req.offsets[req.count++] = offset;
+            if (req.count == PS_MAX_BATCH) {
+                send_request(&req);
+            }
+        }
+    }
+    send_request(&req);
+}
+
+/**
+ * Copies `len` bytes at `skip` into file page `offset` to `dst`, fetching
+ * the page (and a few after it) on a miss. Spins rather than blocking, since
+ * it also runs in the fault handler on the guest's thread.
+ */
+static int read_cached(uint64_t offset, size_t skip, void *dst, size_t len) {
+    slot_t *slot = slot_for(offset);
+    for (;;) {
+        lock_slot(slot);
+        if (slot->tag == offset && slot->state == SLOT_READY) {
+            memcpy(dst, slot_data(slot) + skip, len);
+            unlock_slot(slot);
+            return 0;
+        }
+        int missing = slot->tag != offset || slot->state == SLOT_EMPTY;
+        unlock_slot(slot);
+
+        if (missing) {
+            // Not here, or evicted while we waited: ask again
+            request_range(offset, offset + (REMOTE_READAHEAD - 1) * page_size, offset);
+        }
+        sched_yield();
+    }
+}
+
+ssize_t remote_pread(void *dst, size_t len, off_t offset) {
+    size_t done = 0;
+    while (done < len && offset + done < remote_size) {
+        uint64_t page = (offset + done) & ~(page_size - 1);
+        size_t skip = offset + done - page;
+        size_t chunk = page_size - skip < len - done ? page_size - skip : len - done;
+        if (read_cached(page, skip, (char *)dst + done, chunk) != 0) {
+            return -1;
+        }
+        done += chunk;
+    }
+    return done;
+}
+
+void remote_prefetch(off_t offset, size_t len) {
+    if (len > 0) {
+        request_range(offset & ~(page_size - 1), (offset + len - 1) & ~(page_size - 1), UINT64_MAX);
+    }
+}
+
+// Files every page the server sends into its slot, unless the slot has been
+// handed to another page since it was requested.
+static void *receive_thread(void *arg) {
+    for (;;) {
+        ps_page_t hdr;
+        struct iovec iov[2] = { { &hdr, sizeof(hdr) }, { recv_buf, page_size } };
+        struct msghdr mh = { .msg_iov = iov, .msg_iovlen = 2 };
+        ssize_t n = recvmsg(sock, &mh, 0);
+        if (n < (ssize_t)sizeof(hdr)) {
+            char msg[] = "Lost connection to the page server\n";
+            write(STDERR_FILENO, msg, sizeof(msg) - 1);
+            exit(1);
+        }
+
+        slot_t *slot = slot_for(hdr.offset);
+        lock_slot(slot);
+        if (slot->tag == hdr.offset && slot->state == SLOT_PENDING) {
+            memcpy(slot_data(slot), recv_buf, hdr.len);
+            memset(slot_data(slot) + hdr.len, 0, page_size - hdr.len);
+            slot->state = SLOT_READY;
+        }
+        unlock_slot(slot);
+    }
+    return NULL;
+}
+
+int remote_connect(const char *path, off_t file_size) {
+    page_size = sysconf(_SC_PAGE_SIZE);
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror("Failed to connect to page server");
+        return 1;
+    }
+
+    ps_hello_t hello;
+    if (recv(sock, &hello, sizeof(hello), 0) != sizeof(hello) || hello.magic != PS_MAGIC) {
+        fprintf(stderr, "%s is not a page server\n", path);
+        return 1;
+    }
+    if (hello.page_size != page_size || hello.file_size != file_size) {
+        fprintf(stderr, "Page server is serving a different file (%lu bytes, expected %ld)\n",
+                (unsigned long)hello.file_size, (long)file_size);
+        return 1;
+    }
+    remote_size = file_size;
+
+    cache = mmap(NULL, (REMOTE_CACHE_PAGES + 1) * page_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (cache == MAP_FAILED) {
+        perror("Failed to allocate page cache");
+        return 1;
+    }
+    recv_buf = cache + REMOTE_CACHE_PAGES * page_size;
+
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, receive_thread, NULL);
+    if (err != 0) {
+        fprintf(stderr, "Failed to start page server thread: %s\n", strerror(err));
+        return 1;
+    }
+    pthread_detach(thread);
+    printf("Fetching pages from page server %s (%d page cache)\n", path, REMOTE_CACHE_PAGES);
+    return 0;
+}
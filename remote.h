@@ -0,0 +1,61 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Remote page source: instead of reading the executable with pread, a pager
+ * fetches its pages from a page server process over a Unix socket, the way
+ * a memory-disaggregated node would fetch them from far memory.
+ *
+ * The socket is SOCK_SEQPACKET. On connect the server sends a ps_hello_t.
+ * The client then sends ps_request_t messages, each naming up to
+ * PS_MAX_BATCH page-aligned file offsets, without waiting for earlier ones
+ * to be answered. The server answers every offset with one ps_page_t
+ * followed by the page data, in request order. Pages past the end of the
+ * file come back short.
+ *
+ * The client keeps a small direct-mapped cache of file pages. A miss
+ * requests the page together with the next few, and bulk readers announce
+ * whole runs up front with remote_prefetch, so requests stay batched and
+ * several are in flight at once.
+ */
+
+#define PS_MAGIC 0x31475350     // "PSG1"
+#define PS_MAX_BATCH 32
+
+typedef struct {
+    uint32_t magic;
+    uint32_t page_size;
+    uint64_t file_size;
+} ps_hello_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t offsets[PS_MAX_BATCH]; // only `count` are sent
+} ps_request_t;
+
+typedef struct {
+    uint64_t offset;
+    uint32_t len;               // bytes of data that follow
+    uint32_t reserved;
+} ps_page_t;
+
+/**
+ * Connects to the page server at `path` and starts the thread that receives
+ * its pages. `file_size` is the size of the local copy of the executable;
+ * the server must be serving a file of the same size.
+ */
+int remote_connect(const char *path, off_t file_size);
+
+// Like pread on the executable. Safe to call from any pager thread and from
+// the fault handler.
+ssize_t remote_pread(void *dst, size_t len, off_t offset);
+
+// Requests the pages covering [offset, offset + len) without waiting.
+void remote_prefetch(off_t offset, size_t len);
+
+#endif
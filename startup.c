@@ -0,0 +1,204 @@
+#define _GNU_SOURCE
+#include "startup.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pager.h"
+
+#ifndef R_X86_64_IRELATIVE
+#define R_X86_64_IRELATIVE 37
+#endif
+
+// Functions and objects of glibc's static start-up, from _start to main.
+// Local copies the compiler split off, such as init_cpu_features.constprop.0,
+// match by the part before the dot.
+static const char *startup_symbols[] = {
+    "_start", "__libc_start_main", "__libc_start_main_impl", "__libc_start_call_main",
+    "__libc_init_secure", "__libc_init_first", "__libc_setup_tls", "__libc_early_init",
+    "_dl_relocate_static_pie", "_dl_aux_init", "_dl_non_dynamic_init", "_dl_tls_static_surplus_init",
+    "_dl_setup_stack_chk_guard", "_dl_discover_osversion", "_dl_important_hwcaps", "_dl_init_paths",
+    "_dl_get_origin", "_dl_setup_hash", "_dl_lookup_symbol_x", "do_lookup_x", "_dl_find_object_init",
+    "_dl_protect_relro", "__tunables_init", "__pthread_tunables_init", "init_cpu_features",
+    "update_active", "init_cacheinfo", "dl_init_cacheinfo", "__init_misc", "__ctype_init",
+    "__register_frame_info", "_IO_init", "__libc_csu_init", "apply_irel", "__sbrk", "__brk",
+    "__getrlimit", "getrlimit64", "getenv", "malloc", "calloc", "ptmalloc_init", "tcache_init",
+    "_int_malloc", "sysmalloc", "alloc_perturb", "__pthread_mutex_lock", "__pthread_mutex_unlock",
+    "pthread_mutex_lock", "pthread_mutex_unlock", "_init", "main",
+    // data
+    "__environ", "__libc_argc", "__libc_argv", "__libc_stack_end", "__libc_enable_secure",
+    "_dl_pagesize", "_dl_random", "_dl_phdr", "_dl_phnum", "_dl_hwcap", "_dl_hwcap2", "_dl_clktck",
+    "_dl_sysinfo_dso", "_dl_main_map", "_dl_static_dtv", "_dl_x86_cpu_features",
+    "__x86_shared_non_temporal_threshold", "__x86_data_cache_size", "__x86_shared_cache_size",
+    "__pthread_force_elision", "main_arena", "mp_", "_nl_C_locobj", "__exit_funcs", "intel_02_known",
+    "system_dirs", "system_dirs_len",
+    NULL,
+};
+
+typedef struct {
+    uintptr_t *pages;
+    size_t n;
+    size_t max;
+    size_t page_size;
+} page_set_t;
+
+// Adds the pages of [addr, addr + size), if they belong to a PT_LOAD segment
+static void add_range(page_set_t *set, uintptr_t addr, size_t size) {
+    if (addr == 0) {
+        return;
+    }
+    uintptr_t end = addr + (size > 0 ? size : 1);
+    for (int i = 0; i < elf_header.e_phnum; i++) {
+        if (ph[i].p_type != PT_LOAD || addr < ph[i].p_vaddr || addr >= ph[i].p_vaddr + ph[i].p_memsz) {
+            continue;
+        }
+        if (end > ph[i].p_vaddr + ph[i].p_memsz) {
+            end = ph[i].p_vaddr + ph[i].p_memsz;
+        }
+        for (uintptr_t page = addr & ~(set->page_size - 1); page < end && set->n < set->max;
+             page += set->page_size) {
+            set->pages[set->n++] = page;
+        }
+        return;
+    }
+}
+
+static int is_startup_symbol(const char *name) {
+    size_t len = strcspn(name, ".");
+    for (const char **s = startup_symbols; *s != NULL; s++) {
+        if (strlen(*s) == len && strncmp(*s, name, len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *read_section(Elf64_Shdr *sh) {
+    void *data = malloc(sh->sh_size > 0 ? sh->sh_size : 1);
+    if (data != NULL && read_file_range(data, sh->sh_size, sh->sh_offset) != 0) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+// Adds the targets of an array of function pointers, such as .init_array
+static void add_pointed_to(page_set_t *set, Elf64_Shdr *sh) {
+    uint64_t *ptrs = read_section(sh);
+    if (ptrs == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < sh->sh_size / sizeof(uint64_t); i++) {
+        // Functions have no size here; assume they fit their first page
+        add_range(set, ptrs[i], 1);
+    }
+    free(ptrs);
+}
+
+// Adds the IRELATIVE resolvers static glibc runs before main
+static void add_resolvers(page_set_t *set, Elf64_Shdr *sh) {
+    Elf64_Rela *rela = read_section(sh);
+    if (rela == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < sh->sh_size / sizeof(Elf64_Rela); i++) {
+        if (ELF64_R_TYPE(rela[i].r_info) == R_X86_64_IRELATIVE) {
+            add_range(set, rela[i].r_addend, 1);
+            add_range(set, rela[i].r_offset, sizeof(uint64_t));
+        }
+    }
+    free(rela);
+}
+
+static void add_symbols(page_set_t *set, Elf64_Shdr *symtab, Elf64_Shdr *strtab, uintptr_t *main_addr) {
+    Elf64_Sym *syms = read_section(symtab);
+    char *names = read_section(strtab);
+    if (syms != NULL && names != NULL) {
+        for (size_t i = 0; i < symtab->sh_size / sizeof(Elf64_Sym); i++) {
+            int type = ELF64_ST_TYPE(syms[i].st_info);
+            if ((type != STT_FUNC && type != STT_OBJECT) || syms[i].st_name >= strtab->sh_size ||
+                !is_startup_symbol(names + syms[i].st_name)) {
+                continue;
+            }
+            if (type == STT_FUNC && strcmp(names + syms[i].st_name, "main") == 0) {
+                *main_addr = syms[i].st_value;
+            }
+            add_range(set, syms[i].st_value, syms[i].st_size);
+        }
+    }
+    free(syms);
+    free(names);
+}
+
+static int compare_pages(const void *a, const void *b) {
+    uintptr_t x = *(const uintptr_t *)a, y = *(const uintptr_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+size_t startup_pages(uintptr_t *pages, size_t max, uintptr_t *main_addr) {
+    page_set_t set = { pages, 0, max, sysconf(_SC_PAGE_SIZE) };
+    *main_addr = 0;
+    add_range(&set, e_entry, 1);
+
+    Elf64_Shdr *sh = NULL;
+    char *shstr = NULL;
+    if (elf_header.e_shoff != 0 && elf_header.e_shnum > 0 && elf_header.e_shstrndx < elf_header.e_shnum &&
+        elf_header.e_shentsize == sizeof(Elf64_Shdr)) {
+        sh = malloc(elf_header.e_shnum * sizeof(Elf64_Shdr));
+        if (sh != NULL && read_file_range((char *)sh, elf_header.e_shnum * sizeof(Elf64_Shdr),
+                                          elf_header.e_shoff) != 0) {
+            free(sh);
+            sh = NULL;
+        }
+        if (sh != NULL) {
+            shstr = read_section(&sh[elf_header.e_shstrndx]);
+        }
+    }
+    if (sh == NULL || shstr == NULL) {
+        // Stripped of section headers: only the entry point is known
+        free(sh);
+        return set.n;
+    }
+
+    for (int i = 0; i < elf_header.e_shnum; i++) {
+        const char *name = sh[i].sh_name < sh[elf_header.e_shstrndx].sh_size ? shstr + sh[i].sh_name : "";
+        switch (sh[i].sh_type) {
+        case SHT_INIT_ARRAY:
+        case SHT_PREINIT_ARRAY:
+            add_range(&set, sh[i].sh_addr, sh[i].sh_size);
+            add_pointed_to(&set, &sh[i]);
+            break;
+        case SHT_RELA:
+            if (sh[i].sh_flags & SHF_ALLOC) {
+                add_range(&set, sh[i].sh_addr, sh[i].sh_size);
+                add_resolvers(&set, &sh[i]);
+            }
+            break;
+        case SHT_SYMTAB:
+            if (sh[i].sh_link < elf_header.e_shnum) {
+                add_symbols(&set, &sh[i], &sh[sh[i].sh_link], main_addr);
+            }
+            break;
+        default:
+            if (strcmp(name, ".init") == 0 || strcmp(name, ".tdata") == 0) {
+                add_range(&set, sh[i].sh_addr, sh[i].sh_size);
+            } else if (strcmp(name, ".eh_frame") == 0) {
+                add_range(&set, sh[i].sh_addr, 1);
+            }
+            break;
+        }
+    }
+    free(shstr);
+    free(sh);
+
+    qsort(pages, set.n, sizeof(uintptr_t), compare_pages);
+    size_t n = 0;
+    for (size_t i = 0; i < set.n; i++) {
+        if (n == 0 || pages[n - 1] != pages[i]) {
+            pages[n++] = pages[i];
+        }
+    }
+    return n;
+}
@@ -0,0 +1,29 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Static prediction of the pages a guest touches before main, for
+ * --prepopulate. No training run is needed: the path from _start to main is
+ * the same for every static glibc binary, so it can be read off the ELF file.
+ *
+ * The prediction takes:
+ *  - the entry page, .init, .init_array and .preinit_array, and the functions
+ *    those arrays point to;
+ *  - .rela.plt, the GOT it fills in, and the IRELATIVE resolvers it runs;
+ *  - the .tdata template copied into the first thread's TLS block, and the
+ *    start of .eh_frame, which frame registration reads;
+ *  - with a symbol table, the functions and objects of libc start-up, main
+ *    included.
+ */
+
+/**
+ * Fills `pages` with up to `max` page addresses the guest will most likely
+ * touch before main, sorted and without duplicates, and returns how many.
+ * Sets *main_addr to the address of main, or 0 without a symbol table.
+ */
+size_t startup_pages(uintptr_t *pages, size_t max, uintptr_t *main_addr);
+
+#endif
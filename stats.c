@@ -0,0 +1,114 @@
+#define _GNU_SOURCE
+#include "stats.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+
+// Page fault error code bits
+#define PF_ERR_WRITE 0x2
+#define PF_ERR_FETCH 0x10
+
+static stats_shm_t private_stats;
+static stats_thread_t overflow_thread;  // for threads beyond STATS_MAX_THREADS
+static stats_shm_t *stats = &private_stats;
+
+uint64_t stats_now() {
+    struct timespec ts;
+    syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void stats_init(int publish, const char *pager, const char *guest) {
+    if (publish) {
+        char name[64];
+        snprintf(name, sizeof(name), STATS_SHM_PREFIX "%d", getpid());
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, sizeof(stats_shm_t)) == -1) {
+            perror("Failed to create stats segment");
+        } else {
+            stats_shm_t *shm = mmap(NULL, sizeof(stats_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (shm == MAP_FAILED) {
+                perror("Failed to map stats segment");
+            } else {
+                stats = shm;
+                printf("Publishing stats in /dev/shm%s\n", name);
+            }
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (stats == &private_stats) {
+        // Shared even when unpublished, so a --perf reporter forked after
+        // this sees the counters the pager keeps bumping
+        stats_shm_t *anon = mmap(NULL, sizeof(stats_shm_t), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (anon != MAP_FAILED) {
+            stats = anon;
+        }
+    }
+
+    stats->version = STATS_VERSION;
+    stats->pid = getpid();
+    stats->page_size = sysconf(_SC_PAGE_SIZE);
+    stats->start_ns = stats_now();
+    strncpy(stats->pager, pager, sizeof(stats->pager) - 1);
+    strncpy(stats->guest, guest != NULL ? guest : "", sizeof(stats->guest) - 1);
+    strcpy(stats->regions[STATS_OTHER_REGION].name, "other");
+    // Readers check the magic last, so they never see a half-initialized header
+    __atomic_store_n(&stats->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+}
+
+void stats_add_region(uintptr_t start, uintptr_t end, int prot) {
+    if (stats->nregions >= STATS_OTHER_REGION) {
+        return;
+    }
+    stats_region_t *region = &stats->regions[stats->nregions];
+    region->start = start;
+    region->end = end;
+    region->prot = prot;
+    strcpy(region->name, (prot & PROT_EXEC) ? "text" : (prot & PROT_WRITE) ? "data" : "rodata");
+    __atomic_store_n(&stats->nregions, stats->nregions + 1, __ATOMIC_RELEASE);
+}
+
+stats_shm_t *stats_segment() {
+    return stats;
+}
+
+stats_thread_t *stats_thread(const char *name) {
+    unsigned slot = __atomic_load_n(&stats->nthreads, __ATOMIC_RELAXED);
+    do {
+        if (slot >= STATS_MAX_THREADS) {
+            return &overflow_thread;
+        }
+    } while (!__atomic_compare_exchange_n(&stats->nthreads, &slot, slot + 1, 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    stats_thread_t *t = &stats->threads[slot];
+    strncpy(t->name, name, sizeof(t->name) - 1);
+    return t;
+}
+
+int stats_region(uintptr_t addr) {
+    for (unsigned r = 0; r < stats->nregions; r++) {
+        if (addr >= stats->regions[r].start && addr < stats->regions[r].end) {
+            return r;
+        }
+    }
+    return STATS_OTHER_REGION;
+}
+
+int stats_segv_kind(void *info, void *ucontext) {
+    greg_t *gregs = ((ucontext_t *)ucontext)->uc_mcontext.gregs;
+    void *addr = ((siginfo_t *)info)->si_addr;
+    if ((gregs[REG_ERR] & PF_ERR_FETCH) || (uintptr_t)addr == (uintptr_t)gregs[REG_RIP]) {
+        return STATS_FAULT_EXEC;
+    }
+    return (gregs[REG_ERR] & PF_ERR_WRITE) ? STATS_FAULT_WRITE : STATS_FAULT_READ;
+}
@@ -0,0 +1,94 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/*
+ * Live pager statistics, published in a POSIX shared-memory segment named
+ * /pagerstat.<pid> when a pager runs with --stats. `pagerstat` attaches to it
+ * and prints rates.
+ *
+ * Every pager thread owns one stats_thread_t and is the only writer of it,
+ * so counters are bumped with plain increments. Each slot sits on its own
+ * cache lines, so threads never contend for them. Readers sum the slots and
+ * may see a count one update behind, which is fine for rates. Without --stats
+ * the same counters live in private memory, so the hot paths never branch on
+ * whether stats are enabled.
+ */
+
+#define STATS_MAGIC 0x54535350  // "PSST"
+#define STATS_VERSION 2
+#define STATS_SHM_PREFIX "/pagerstat."
+
+// Every userfaultfd shard, plus the guest, populator, hint and migration threads
+#define STATS_MAX_THREADS 72
+#define STATS_MAX_REGIONS 16
+#define STATS_OTHER_REGION (STATS_MAX_REGIONS - 1)  // anything not in a named region
+
+#define STATS_FAULT_READ 0
+#define STATS_FAULT_WRITE 1
+#define STATS_FAULT_EXEC 2
+#define STATS_FAULT_KINDS 3
+
+typedef struct {
+    char name[16];
+    uint64_t faults[STATS_MAX_REGIONS][STATS_FAULT_KINDS];
+    uint64_t pages_installed;   // made resident, on a fault or ahead of one
+    uint64_t pages_prefetched;  // the part of pages_installed nobody faulted on
+    uint64_t pages_evicted;
+    uint64_t bytes_read;        // bytes read from the executable
+    uint64_t handler_ns;        // time spent resolving faults
+} __attribute__((aligned(64))) stats_thread_t;
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    uint32_t prot;
+    char name[12];
+} stats_region_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    uint32_t nregions;
+    uint32_t nthreads;
+    uint32_t page_size;
+    uint64_t start_ns;          // CLOCK_MONOTONIC
+    char pager[16];
+    char guest[64];
+    stats_region_t regions[STATS_MAX_REGIONS];
+    stats_thread_t threads[STATS_MAX_THREADS];
+} stats_shm_t;
+
+/**
+ * Sets up the counters. With `publish` set they go to /pagerstat.<pid>;
+ * otherwise, or if that fails, to private memory. Call before any other
+ * stats function.
+ */
+void stats_init(int publish, const char *pager, const char *guest);
+
+// Names the guest range [start, end) in per-region fault counts.
+void stats_add_region(uintptr_t start, uintptr_t end, int prot);
+
+// The counters of every thread, for summing them up in-process
+stats_shm_t *stats_segment();
+
+// Hands the calling thread its own counters. Not for hot paths.
+stats_thread_t *stats_thread(const char *name);
+
+// Region index for `addr`, or STATS_OTHER_REGION
+int stats_region(uintptr_t addr);
+
+// STATS_FAULT_* for a SIGSEGV raised by the guest, given the handler's
+// siginfo_t and ucontext (APager has its own stack_t, so no <signal.h> here)
+int stats_segv_kind(void *info, void *ucontext);
+
+// CLOCK_MONOTONIC in ns, without the vDSO, so it is safe on any thread
+uint64_t stats_now();
+
+static inline void stats_fault(stats_thread_t *t, uintptr_t addr, int kind) {
+    t->faults[stats_region(addr)][kind]++;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+#include "trace.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <x86intrin.h>
+
+#ifdef PAGER_TRACE
+
+static trace_header_t *header;
+
+// How long to watch the time stamp counter against CLOCK_MONOTONIC
+#define CALIBRATE_NS 5000000
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int trace_open(const char *path, const char *pager) {
+    size_t size = sizeof(trace_header_t) + TRACE_MAX_RINGS * sizeof(trace_ring_t);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || ftruncate(fd, size) == -1) {
+        perror("Failed to create trace file");
+        return 1;
+    }
+    header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        header = NULL;
+        perror("Failed to map trace file");
+        return 1;
+    }
+
+    uint64_t ns = monotonic_ns(), tsc = __rdtsc();
+    uint64_t end_ns;
+    while ((end_ns = monotonic_ns()) - ns < CALIBRATE_NS) {
+    }
+    header->tsc_base = __rdtsc();
+    header->tsc_per_us = (header->tsc_base - tsc) * 1000 / (end_ns - ns);
+    header->version = TRACE_VERSION;
+    header->pid = getpid();
+    header->ring_records = TRACE_RING_RECORDS;
+    strncpy(header->pager, pager, sizeof(header->pager) - 1);
+    header->magic = TRACE_MAGIC;
+    printf("Tracing to %s\n", path);
+    return 0;
+}
+
+trace_ring_t *trace_thread(const char *name) {
+    if (header == NULL) {
+        return NULL;
+    }
+    unsigned slot = __atomic_fetch_add(&header->nrings, 1, __ATOMIC_RELAXED);
+    if (slot >= TRACE_MAX_RINGS) {
+        fprintf(stderr, "No trace ring left for thread %s; it is not traced\n", name);
+        return NULL;
+    }
+    trace_ring_t *ring = (trace_ring_t *)(header + 1) + slot;
+    strncpy(ring->name, name, sizeof(ring->name) - 1);
+    return ring;
+}
+
+void trace_write(trace_ring_t *ring, int event, uint64_t a, uint64_t b) {
+    uint64_t index = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    trace_record_t *rec = &ring->records[index % TRACE_RING_RECORDS];
+    // Invalidate the slot first, so a record cut short never looks complete
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    rec->tsc = __rdtsc();
+    rec->event = event;
+    rec->a = a;
+    rec->b = b;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    __atomic_store_n(&rec->seq, (uint32_t)(index + 1), __ATOMIC_RELAXED);
+}
+
+#else
+
+int trace_open(const char *path, const char *pager) {
+    fprintf(stderr, "%s was built without tracing; rebuild with make TRACE=1\n", pager);
+    return 1;
+}
+
+trace_ring_t *trace_thread(const char *name) {
+    return NULL;
+}
+
+void trace_write(trace_ring_t *ring, int event, uint64_t a, uint64_t b) {
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Binary tracepoints. TRACE(ring, event, a, b) compiles to nothing unless the
+ * pagers are built with `make TRACE=1` (PAGER_TRACE), so regular builds pay
+ * nothing for them.
+ *
+ * In a tracing build, --trace=FILE maps FILE shared and every pager thread
+ * gets a ring of fixed-size records in it. A thread is the only writer of its
+ * ring; a slot is reserved with one atomic add, which keeps tracepoints safe
+ * in signal handlers that interrupt another tracepoint on the same thread.
+ * Since the rings live in the file, they survive the pager crashing, and
+ * `tracedump FILE` decodes them afterwards.
+ *
+ * File layout: trace_header_t, then TRACE_MAX_RINGS trace_ring_t. Each record
+ * stores the low 32 bits of its index + 1 in `seq`, written last, so the
+ * decoder can tell complete records from ones a crash cut short.
+ */
+
+#define TRACE_MAGIC 0x43525450  // "PTRC"
+#define TRACE_VERSION 2
+#define TRACE_MAX_RINGS 72       // every userfaultfd shard and the other pager threads
+#define TRACE_RING_RECORDS 4096  // per thread; older records are overwritten
+
+// X(id, name, meaning of a, meaning of b)
+#define TRACE_EVENTS(X)                                  \
+    X(TR_LOAD_SEGMENT, "load_segment", "vaddr", "size")  \
+    X(TR_RESERVE, "reserve", "start", "pages")           \
+    X(TR_STACK, "stack", "sp", "argc")                   \
+    X(TR_ENTER_GUEST, "enter_guest", "entry", "sp")      \
+    X(TR_FAULT, "fault", "addr", "kind")                 \
+    X(TR_INSTALL, "install", "page", "bytes")            \
+    X(TR_WAIT, "wait", "page", "state")                  \
+    X(TR_RETRY, "retry", "page", "state")                \
+    X(TR_POPULATE, "populate", "page", "count")
+
+#define TRACE_ENUM(id, name, a, b) id,
+enum { TRACE_EVENTS(TRACE_ENUM) TR_NUM_EVENTS };
+#undef TRACE_ENUM
+
+typedef struct {
+    uint64_t tsc;               // time stamp counter
+    uint32_t seq;
+    uint16_t event;
+    uint16_t reserved;
+    uint64_t a;
+    uint64_t b;
+} trace_record_t;
+
+typedef struct {
+    char name[16];
+    uint64_t head;              // records ever written
+    char pad[40];
+    trace_record_t records[TRACE_RING_RECORDS];
+} trace_ring_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    uint32_t nrings;
+    uint32_t ring_records;
+    uint32_t reserved;
+    uint64_t tsc_base;          // counter value at start
+    uint64_t tsc_per_us;
+    char pager[16];
+    char pad[8];
+} trace_header_t;
+
+#ifdef PAGER_TRACE
+#define TRACE(ring, event, a, b)                                          \
+    do {                                                                  \
+        if ((ring) != NULL) {                                             \
+            trace_write((ring), (event), (uint64_t)(a), (uint64_t)(b));   \
+        }                                                                 \
+    } while (0)
+#else
+#define TRACE(ring, event, a, b) do { (void)(ring); } while (0)
+#endif
+
+/**
+ * Creates FILE and maps the rings into it. Fails in builds without
+ * PAGER_TRACE, so --trace is rejected there instead of silently ignored.
+ */
+int trace_open(const char *path, const char *pager);
+
+// Hands the calling thread its own ring, or NULL when not tracing or out of rings.
+trace_ring_t *trace_thread(const char *name);
+
+void trace_write(trace_ring_t *ring, int event, uint64_t a, uint64_t b);
+
+#endif
@@ -0,0 +1,110 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+/*
+ * Decodes a trace file written by a pager built with `make TRACE=1` and run
+ * with --trace=FILE. Works on the file of a pager that crashed too: records
+ * are merged across threads by time and printed one per line, and records a
+ * crash cut short are skipped.
+ */
+
+#define TRACE_NAME(id, name, a, b) name,
+#define TRACE_ARG_A(id, name, a, b) a,
+#define TRACE_ARG_B(id, name, a, b) b,
+const char *event_names[] = { TRACE_EVENTS(TRACE_NAME) };
+const char *arg_a_names[] = { TRACE_EVENTS(TRACE_ARG_A) };
+const char *arg_b_names[] = { TRACE_EVENTS(TRACE_ARG_B) };
+
+// TR_FAULT kinds, as STATS_FAULT_*
+const char *fault_kinds[] = { "read", "write", "exec" };
+
+typedef struct {
+    trace_record_t rec;
+    int ring;
+} entry_t;
+
+int by_time(const void *x, const void *y) {
+    const entry_t *a = x, *b = y;
+    return a->rec.tsc < b->rec.tsc ? -1 : a->rec.tsc > b->rec.tsc;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <trace file>\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) == -1) {
+        perror("Failed to open trace file");
+        return 1;
+    }
+    if (st.st_size < sizeof(trace_header_t)) {
+        fprintf(stderr, "%s is too short to be a trace\n", argv[1]);
+        return 1;
+    }
+    trace_header_t *header = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (header == MAP_FAILED) {
+        perror("Failed to map trace file");
+        return 1;
+    }
+    if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION ||
+        header->ring_records != TRACE_RING_RECORDS ||
+        st.st_size < sizeof(trace_header_t) + TRACE_MAX_RINGS * sizeof(trace_ring_t)) {
+        fprintf(stderr, "%s is not a trace this tracedump understands\n", argv[1]);
+        return 1;
+    }
+
+    int nrings = header->nrings < TRACE_MAX_RINGS ? header->nrings : TRACE_MAX_RINGS;
+    trace_ring_t *rings = (trace_ring_t *)(header + 1);
+    entry_t *entries = malloc((size_t)nrings * TRACE_RING_RECORDS * sizeof(entry_t));
+    if (entries == NULL) {
+        perror("Failed to allocate records");
+        return 1;
+    }
+
+    size_t n = 0;
+    unsigned long overwritten = 0, incomplete = 0;
+    for (int r = 0; r < nrings; r++) {
+        uint64_t head = rings[r].head;
+        uint64_t first = head > TRACE_RING_RECORDS ? head - TRACE_RING_RECORDS : 0;
+        overwritten += first;
+        for (uint64_t i = first; i < head; i++) {
+            trace_record_t *rec = &rings[r].records[i % TRACE_RING_RECORDS];
+            if (rec->seq != (uint32_t)(i + 1) || rec->event >= TR_NUM_EVENTS) {
+                incomplete++;
+                continue;
+            }
+            entries[n].rec = *rec;
+            entries[n].ring = r;
+            n++;
+        }
+    }
+    qsort(entries, n, sizeof(entry_t), by_time);
+
+    printf("%s pid %d, %d threads, %zu records", header->pager, header->pid, nrings, n);
+    printf(" (%lu overwritten, %lu incomplete)\n", overwritten, incomplete);
+    printf("%12s  %-10s %-14s %s\n", "time(us)", "thread", "event", "arguments");
+    for (size_t i = 0; i < n; i++) {
+        trace_record_t *rec = &entries[i].rec;
+        double us = header->tsc_per_us > 0
+                        ? (double)(int64_t)(rec->tsc - header->tsc_base) / header->tsc_per_us
+                        : 0.0;
+        printf("%12.3f  %-10.16s %-14s %s=%#lx ", us, rings[entries[i].ring].name,
+               event_names[rec->event], arg_a_names[rec->event], (unsigned long)rec->a);
+        if (rec->event == TR_FAULT && rec->b < sizeof(fault_kinds) / sizeof(fault_kinds[0])) {
+            printf("%s=%s\n", arg_b_names[rec->event], fault_kinds[rec->b]);
+        } else {
+            printf("%s=%#lx\n", arg_b_names[rec->event], (unsigned long)rec->b);
+        }
+    }
+    return 0;
+}
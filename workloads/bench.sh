@@ -0,0 +1,29 @@
+#!/bin/sh
+# Runs every workload under every pager and prints the wall time of each run.
+# A run passes only if the pager exits 0 and the workload reports OK.
+#
+# usage: workloads/bench.sh WORKLOAD...
+# PAGERS picks the pagers (default: apager dpager hpager), FLAGS adds pager
+# options to every run, e.g. FLAGS="--uffd --background".
+
+PAGERS=${PAGERS:-"apager dpager hpager"}
+failed=0
+
+printf "%-10s %-8s %10s  %s\n" workload pager "time(ms)" result
+for workload in "$@"; do
+  name=$(basename "$workload")
+  for pager in $PAGERS; do
+    start=$(date +%s%N)
+    # Not a pipeline: sh has no pipefail, and the pager's status must count
+    output=$(./$pager $FLAGS "$workload" 2>/dev/null)
+    status=$?
+    end=$(date +%s%N)
+    line=$(printf "%s\n" "$output" | grep -a -o "$name: [A-Z]*.*")
+    case "$status:$line" in
+      "0:$name: OK"*) result=OK ;;
+      *) result=FAIL; failed=1 ;;
+    esac
+    printf "%-10s %-8s %10d  %s\n" "$name" "$pager" $(( (end - start) / 1000000 )) "$result"
+  done
+done
+exit $failed
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+
+#include "workload.h"
+
+// Breadth-first search over a 1M-vertex graph in compressed sparse row form
+// with about 9M edges. Neighbour lists are scattered, so the frontier touches
+// the distance array at random.
+
+#define VERTICES (1 << 20)
+#define MAX_RANDOM_DEGREE 16
+
+int main() {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint64_t *offsets = malloc((VERTICES + 1) * sizeof(uint64_t));
+    uint32_t *dist = malloc(VERTICES * sizeof(uint32_t));
+    uint32_t *parent = malloc(VERTICES * sizeof(uint32_t));
+    uint32_t *queue = malloc(VERTICES * sizeof(uint32_t));
+    if (offsets == NULL || dist == NULL || parent == NULL || queue == NULL) {
+        printf("bfs: FAIL (out of memory)\n");
+        return 1;
+    }
+
+    // Every vertex links to its successor, so the whole graph is reachable
+    uint64_t seed = 99;
+    offsets[0] = 0;
+    for (uint32_t v = 0; v < VERTICES; v++) {
+        offsets[v + 1] = offsets[v] + 1 + rng_next(&seed) % MAX_RANDOM_DEGREE;
+    }
+    uint32_t *edges = malloc(offsets[VERTICES] * sizeof(uint32_t));
+    if (edges == NULL) {
+        printf("bfs: FAIL (out of memory)\n");
+        return 1;
+    }
+    for (uint32_t v = 0; v < VERTICES; v++) {
+        edges[offsets[v]] = (v + 1) % VERTICES;
+        for (uint64_t e = offsets[v] + 1; e < offsets[v + 1]; e++) {
+            edges[e] = rng_next(&seed) % VERTICES;
+        }
+    }
+
+    for (uint32_t v = 0; v < VERTICES; v++) {
+        dist[v] = UINT32_MAX;
+    }
+    size_t head = 0, tail = 0;
+    dist[0] = 0;
+    parent[0] = 0;
+    queue[tail++] = 0;
+    while (head < tail) {
+        uint32_t u = queue[head++];
+        for (uint64_t e = offsets[u]; e < offsets[u + 1]; e++) {
+            uint32_t v = edges[e];
+            if (dist[v] == UINT32_MAX) {
+                dist[v] = dist[u] + 1;
+                parent[v] = u;
+                queue[tail++] = v;
+            }
+        }
+    }
+
+    // Distances are right if no edge shortcuts them and every vertex's parent
+    // is one step closer and really links to it
+    int ok = tail == VERTICES;
+    uint64_t checksum = 0;
+    for (uint32_t u = 0; u < VERTICES && ok; u++) {
+        checksum += dist[u];
+        for (uint64_t e = offsets[u]; e < offsets[u + 1]; e++) {
+            ok &= dist[edges[e]] <= dist[u] + 1;
+        }
+        if (u != 0) {
+            uint32_t p = parent[u];
+            int linked = 0;
+            for (uint64_t e = offsets[p]; e < offsets[p + 1]; e++) {
+                linked |= edges[e] == u;
+            }
+            ok &= linked && dist[p] + 1 == dist[u];
+        }
+    }
+    return report("bfs", ok, checksum, &start);
+}
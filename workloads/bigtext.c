@@ -0,0 +1,45 @@
+#include "workload.h"
+
+// Start-up of a large binary: 5 MiB of text in 1280 functions, of which only
+// every 64th runs, the way most of a big program's code stays cold at
+// start-up. The functions are generated by the assembler, one per page:
+// no-ops, then x * MULTIPLIER + the function's number. Compiling as much
+// text from C would take minutes.
+
+#define COLD_FUNCTIONS 1280
+#define COLD_STRIDE 4096
+#define MULTIPLIER 0x9E3779B97F4A7C15ULL
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+__asm__(".text\n"
+        ".balign " XSTR(COLD_STRIDE) "\n"
+        "cold_text:\n"
+        ".set cold_id, 0\n"
+        ".rept " XSTR(COLD_FUNCTIONS) "\n"
+        ".fill 4064, 1, 0x90\n"
+        "movabs $" XSTR(MULTIPLIER) ", %rax\n"
+        "imul %rdi, %rax\n"
+        "add $cold_id, %rax\n"
+        "ret\n"
+        ".balign " XSTR(COLD_STRIDE) ", 0xcc\n"
+        ".set cold_id, cold_id + 1\n"
+        ".endr\n");
+
+extern char cold_text[];
+
+int main() {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int ok = 1;
+    uint64_t x = 1;
+    for (unsigned n = 0; n < COLD_FUNCTIONS; n += 64) {
+        uint64_t (*fn)(uint64_t) = (uint64_t(*)(uint64_t))(cold_text + (size_t)n * COLD_STRIDE);
+        uint64_t expect = x * MULTIPLIER + n;
+        x = fn(x);
+        ok &= x == expect;
+    }
+    return report("bigtext", ok, x, &start);
+}
@@ -0,0 +1,166 @@
+#include <stdlib.h>
+
+#include "workload.h"
+
+// B+tree of 1M keys inserted in scrambled order, then 1M point lookups and a
+// full leaf scan. Nodes are separate allocations, so lookups chase pointers
+// across the heap.
+
+#define KEYS (1 << 20)
+#define ORDER 64                // keys per node before it splits
+
+typedef struct node {
+    int leaf;
+    int n;
+    uint64_t keys[ORDER];
+    union {
+        struct node *child[ORDER + 1];
+        uint64_t vals[ORDER];
+    };
+    struct node *next;          // leaves only: the next leaf in key order
+} node_t;
+
+static node_t *new_node(int leaf) {
+    node_t *nd = calloc(1, sizeof(node_t));
+    if (nd == NULL) {
+        printf("btree: FAIL (out of memory)\n");
+        exit(1);
+    }
+    nd->leaf = leaf;
+    return nd;
+}
+
+// First index whose key is greater than `key`
+static int upper_bound(node_t *nd, uint64_t key) {
+    int lo = 0, hi = nd->n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (nd->keys[mid] <= key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Inserts into the subtree at `nd`. If `nd` splits, returns the new right
+// sibling and sets *sep to the first key that belongs to it.
+static node_t *insert(node_t *nd, uint64_t key, uint64_t val, uint64_t *sep) {
+    int i = upper_bound(nd, key);
+    if (nd->leaf) {
+        if (i > 0 && nd->keys[i - 1] == key) {
+            nd->vals[i - 1] = val;
+            return NULL;
+        }
+        for (int j = nd->n; j > i; j--) {
+            nd->keys[j] = nd->keys[j - 1];
+            nd->vals[j] = nd->vals[j - 1];
+        }
+        nd->keys[i] = key;
+        nd->vals[i] = val;
+        if (++nd->n < ORDER) {
+            return NULL;
+        }
+        node_t *right = new_node(1);
+        right->n = nd->n - ORDER / 2;
+        for (int j = 0; j < right->n; j++) {
+            right->keys[j] = nd->keys[ORDER / 2 + j];
+            right->vals[j] = nd->vals[ORDER / 2 + j];
+        }
+        nd->n = ORDER / 2;
+        right->next = nd->next;
+        nd->next = right;
+        *sep = right->keys[0];
+        return right;
+    }
+
+    uint64_t child_sep;
+    node_t *split = insert(nd->child[i], key, val, &child_sep);
+    if (split == NULL) {
+        return NULL;
+    }
+    for (int j = nd->n; j > i; j--) {
+        nd->keys[j] = nd->keys[j - 1];
+        nd->child[j + 1] = nd->child[j];
+    }
+    nd->keys[i] = child_sep;
+    nd->child[i + 1] = split;
+    if (++nd->n < ORDER) {
+        return NULL;
+    }
+    int mid = ORDER / 2;
+    node_t *right = new_node(0);
+    right->n = nd->n - mid - 1;
+    for (int j = 0; j < right->n; j++) {
+        right->keys[j] = nd->keys[mid + 1 + j];
+        right->child[j] = nd->child[mid + 1 + j];
+    }
+    right->child[right->n] = nd->child[nd->n];
+    nd->n = mid;
+    *sep = nd->keys[mid];
+    return right;
+}
+
+static int lookup(node_t *nd, uint64_t key, uint64_t *val) {
+    while (!nd->leaf) {
+        nd = nd->child[upper_bound(nd, key)];
+    }
+    int i = upper_bound(nd, key);
+    if (i > 0 && nd->keys[i - 1] == key) {
+        *val = nd->vals[i - 1];
+        return 1;
+    }
+    return 0;
+}
+
+static uint64_t value_of(uint64_t key) {
+    return key ^ 0x5DEECE66DULL;
+}
+
+int main() {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    node_t *root = new_node(1);
+    for (uint64_t i = 0; i < KEYS; i++) {
+        uint64_t key = (i * 2654435761ULL + 12345) & (KEYS - 1);
+        uint64_t sep;
+        node_t *split = insert(root, key, value_of(key), &sep);
+        if (split != NULL) {
+            node_t *top = new_node(0);
+            top->n = 1;
+            top->keys[0] = sep;
+            top->child[0] = root;
+            top->child[1] = split;
+            root = top;
+        }
+    }
+
+    // Half the lookups ask for keys that were never inserted
+    int ok = 1;
+    uint64_t seed = 7, found = 0, checksum = 0;
+    for (uint64_t i = 0; i < KEYS; i++) {
+        uint64_t key = rng_next(&seed) % (2 * KEYS), val;
+        int hit = lookup(root, key, &val);
+        if (hit != (key < KEYS) || (hit && val != value_of(key))) {
+            ok = 0;
+        }
+        found += hit;
+        checksum += hit ? val : 0;
+    }
+
+    node_t *leaf = root;
+    while (!leaf->leaf) {
+        leaf = leaf->child[0];
+    }
+    uint64_t scanned = 0, expect = 0;
+    for (; leaf != NULL; leaf = leaf->next) {
+        for (int j = 0; j < leaf->n; j++) {
+            ok &= leaf->keys[j] == expect++;
+            scanned++;
+        }
+    }
+    ok &= scanned == KEYS && found > 0;
+    return report("btree", ok, checksum, &start);
+}
@@ -0,0 +1,88 @@
+#include <stdlib.h>
+
+#include "workload.h"
+#include "../hint.h"
+
+// Hash join of a 1M-row build side with a 4M-row probe side, about 64 MiB of
+// randomly probed hash table and sequentially scanned relations. Under a
+// pager run with --hints it says as much, and gives the build side back once
+// the table holds it.
+
+#define BUILD_ROWS (1 << 20)
+#define PROBE_ROWS (1 << 22)
+#define TABLE_SLOTS (1 << 21)
+#define EMPTY UINT64_MAX
+
+typedef struct {
+    uint64_t key;
+    uint64_t payload;
+} row_t;
+
+static uint64_t build_payload(uint64_t key) {
+    return key * 3 + 1;
+}
+
+static uint64_t slot_of(uint64_t key) {
+    return (key * 0x9E3779B97F4A7C15ULL) >> (64 - 21);
+}
+
+int main() {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    row_t *build = malloc(BUILD_ROWS * sizeof(row_t));
+    row_t *probe = malloc(PROBE_ROWS * sizeof(row_t));
+    row_t *table = malloc(TABLE_SLOTS * sizeof(row_t));
+    if (build == NULL || probe == NULL || table == NULL) {
+        printf("hash_join: FAIL (out of memory)\n");
+        return 1;
+    }
+    pager_hint(build, BUILD_ROWS * sizeof(row_t), HINT_SEQUENTIAL);
+    pager_hint(probe, PROBE_ROWS * sizeof(row_t), HINT_SEQUENTIAL);
+    pager_hint(table, TABLE_SLOTS * sizeof(row_t), HINT_SEQUENTIAL);
+
+    // Build keys are a permutation of [0, BUILD_ROWS); half the probe keys miss
+    for (uint64_t i = 0; i < BUILD_ROWS; i++) {
+        build[i].key = (i * 2654435761ULL) & (BUILD_ROWS - 1);
+        build[i].payload = build_payload(build[i].key);
+    }
+    uint64_t seed = 42;
+    for (uint64_t i = 0; i < PROBE_ROWS; i++) {
+        probe[i].key = rng_next(&seed) % (2 * BUILD_ROWS);
+        probe[i].payload = i;
+    }
+
+    for (uint64_t i = 0; i < TABLE_SLOTS; i++) {
+        table[i].key = EMPTY;
+    }
+    pager_hint(table, TABLE_SLOTS * sizeof(row_t), HINT_RANDOM);
+    for (uint64_t i = 0; i < BUILD_ROWS; i++) {
+        uint64_t s = slot_of(build[i].key);
+        while (table[s].key != EMPTY) {
+            s = (s + 1) & (TABLE_SLOTS - 1);
+        }
+        table[s] = build[i];
+    }
+    pager_hint(build, BUILD_ROWS * sizeof(row_t), HINT_DONTNEED);
+
+    uint64_t matches = 0, sum = 0;
+    for (uint64_t i = 0; i < PROBE_ROWS; i++) {
+        for (uint64_t s = slot_of(probe[i].key); table[s].key != EMPTY; s = (s + 1) & (TABLE_SLOTS - 1)) {
+            if (table[s].key == probe[i].key) {
+                matches++;
+                sum += table[s].payload + probe[i].payload;
+                break;
+            }
+        }
+    }
+
+    // Every probe key below BUILD_ROWS has exactly one partner
+    uint64_t expected_matches = 0, expected_sum = 0;
+    for (uint64_t i = 0; i < PROBE_ROWS; i++) {
+        if (probe[i].key < BUILD_ROWS) {
+            expected_matches++;
+            expected_sum += build_payload(probe[i].key) + probe[i].payload;
+        }
+    }
+    return report("hash_join", matches == expected_matches && sum == expected_sum, sum, &start);
+}
@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "workload.h"
+
+// LSM-style sort of 4M keys: sorted memtable flushes become level-0 runs, and
+// every FANOUT runs on a level are merged into one run on the next level.
+// Runs are allocated and freed as they are merged, so the heap churns.
+
+#define KEYS (1 << 22)
+#define MEMTABLE (1 << 16)
+#define FANOUT 8
+#define LEVELS 8
+
+typedef struct {
+    uint64_t *keys;
+    size_t n;
+} run_t;
+
+static run_t levels[LEVELS][FANOUT];
+static int level_runs[LEVELS];
+
+static int compare_keys(const void *x, const void *y) {
+    uint64_t a = *(const uint64_t *)x, b = *(const uint64_t *)y;
+    return a < b ? -1 : a > b;
+}
+
+static run_t merge(run_t *runs, int count) {
+    size_t total = 0, pos[FANOUT] = { 0 };
+    for (int r = 0; r < count; r++) {
+        total += runs[r].n;
+    }
+    run_t out = { malloc(total * sizeof(uint64_t)), total };
+    if (out.keys == NULL) {
+        printf("lsm_sort: FAIL (out of memory)\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < total; i++) {
+        int best = -1;
+        for (int r = 0; r < count; r++) {
+            if (pos[r] < runs[r].n && (best < 0 || runs[r].keys[pos[r]] < runs[best].keys[pos[best]])) {
+                best = r;
+            }
+        }
+        out.keys[i] = runs[best].keys[pos[best]++];
+    }
+    for (int r = 0; r < count; r++) {
+        free(runs[r].keys);
+    }
+    return out;
+}
+
+// Adds a run to `level`, compacting into the level below when it fills up
+static void add_run(int level, run_t run) {
+    levels[level][level_runs[level]++] = run;
+    if (level_runs[level] == FANOUT && level + 1 < LEVELS) {
+        run_t merged = merge(levels[level], FANOUT);
+        level_runs[level] = 0;
+        add_run(level + 1, merged);
+    }
+}
+
+int main() {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The pagers give the guest an 80 KiB stack, so nothing big lives there
+    uint64_t seed = 2024, sum = 0, xor = 0;
+    uint64_t *memtable = malloc(MEMTABLE * sizeof(uint64_t));
+    if (memtable == NULL) {
+        printf("lsm_sort: FAIL (out of memory)\n");
+        return 1;
+    }
+    for (size_t i = 0; i < KEYS; i += MEMTABLE) {
+        for (size_t j = 0; j < MEMTABLE; j++) {
+            memtable[j] = rng_next(&seed);
+            sum += memtable[j];
+            xor ^= memtable[j];
+        }
+        qsort(memtable, MEMTABLE, sizeof(uint64_t), compare_keys);
+        run_t run = { malloc(MEMTABLE * sizeof(uint64_t)), MEMTABLE };
+        if (run.keys == NULL) {
+            printf("lsm_sort: FAIL (out of memory)\n");
+            return 1;
+        }
+        memcpy(run.keys, memtable, MEMTABLE * sizeof(uint64_t));
+        add_run(0, run);
+    }
+
+    // Final compaction of whatever is left on every level
+    run_t rest[LEVELS * FANOUT];
+    int nrest = 0;
+    for (int l = 0; l < LEVELS; l++) {
+        for (int r = 0; r < level_runs[l]; r++) {
+            rest[nrest++] = levels[l][r];
+        }
+    }
+    while (nrest > 1) {
+        int count = nrest < FANOUT ? nrest : FANOUT;
+        run_t merged = merge(&rest[nrest - count], count);
+        nrest -= count;
+        rest[nrest++] = merged;
+    }
+
+    // The output must be sorted and hold exactly the keys that went in
+    run_t *out = &rest[0];
+    int ok = out->n == KEYS;
+    uint64_t out_sum = 0, out_xor = 0;
+    for (size_t i = 0; i < out->n; i++) {
+        ok &= i == 0 || out->keys[i - 1] <= out->keys[i];
+        out_sum += out->keys[i];
+        out_xor ^= out->keys[i];
+    }
+    ok &= out_sum == sum && out_xor == xor;
+    return report("lsm_sort", ok, out_sum ^ out_xor, &start);
+}
@@ -0,0 +1,62 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "workload.h"
+
+// Blocked multiplication of two 768x768 double matrices, 13.5 MiB in all,
+// walked tile by tile.
+
+#define N 768
+#define BLOCK 64
+#define SAMPLES 256
+
+int main() {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    double *a = malloc(N * N * sizeof(double));
+    double *b = malloc(N * N * sizeof(double));
+    double *c = calloc(N * N, sizeof(double));
+    if (a == NULL || b == NULL || c == NULL) {
+        printf("matmul: FAIL (out of memory)\n");
+        return 1;
+    }
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < N; j++) {
+            a[i * N + j] = (double)((i * 7 + j * 3) % 17) - 8.0;
+            b[i * N + j] = (double)((i * 5 + j * 11) % 13) / 4.0;
+        }
+    }
+
+    for (int ii = 0; ii < N; ii += BLOCK) {
+        for (int kk = 0; kk < N; kk += BLOCK) {
+            for (int jj = 0; jj < N; jj += BLOCK) {
+                for (int i = ii; i < ii + BLOCK; i++) {
+                    for (int k = kk; k < kk + BLOCK; k++) {
+                        double aik = a[i * N + k];
+                        for (int j = jj; j < jj + BLOCK; j++) {
+                            c[i * N + j] += aik * b[k * N + j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Spot-check entries against plain dot products
+    int ok = 1;
+    uint64_t seed = 3;
+    for (int s = 0; s < SAMPLES; s++) {
+        int i = rng_next(&seed) % N, j = rng_next(&seed) % N;
+        double expect = 0.0;
+        for (int k = 0; k < N; k++) {
+            expect += a[i * N + k] * b[k * N + j];
+        }
+        ok &= fabs(c[i * N + j] - expect) <= 1e-9 * (fabs(expect) + 1.0);
+    }
+    double trace = 0.0;
+    for (int i = 0; i < N; i++) {
+        trace += c[i * N + i];
+    }
+    return report("matmul", ok, (uint64_t)(int64_t)trace, &start);
+}
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Migrates a running workload between two DPager processes again and again,
+# at a different point of its run each time. A run passes only if both
+# pagers exit 0 and the migrated workload reports OK.
+#
+# usage: workloads/migrate.sh [WORKLOAD]
+# WORKLOAD defaults to workloads/lsm_sort. RUNS sets the number of runs
+# (default: 20), FLAGS adds pager options to both sides, e.g. FLAGS=--uffd.
+
+runs=${RUNS:-20}
+workload=${1:-workloads/lsm_sort}
+name=$(basename "$workload")
+dir=$(mktemp -d)
+sock=$dir/guest.sock
+failed=0
+
+run=1
+while [ $run -le $runs ]; do
+  ./dpager $FLAGS --migrate-listen=$sock "$workload" > $dir/source.log 2>&1 &
+  source=$!
+  while [ ! -S $sock ] && kill -0 $source 2>/dev/null; do
+    sleep 0.01
+  done
+  # Spread the migrations over the workload's run
+  sleep 0.$(( run * 7 % 10 ))
+  ./dpager $FLAGS --migrate-from=$sock > $dir/destination.log 2>&1
+  status=$?
+  wait $source
+  source_status=$?
+  if [ $status -eq 0 ] && [ $source_status -eq 0 ] && grep -aq "$name: OK" $dir/destination.log; then
+    result=OK
+  else
+    result="FAIL (source exit $source_status, destination exit $status)"
+    failed=$((failed + 1))
+    tail -n 3 $dir/destination.log
+  fi
+  printf "%-10s run %3d  %s\n" "$name" $run "$result"
+  rm -f $sock
+  run=$((run + 1))
+done
+rm -rf $dir
+echo "$failed of $runs migrations failed"
+[ $failed -eq 0 ]
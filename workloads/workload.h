@@ -0,0 +1,35 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Shared bits of the benchmark workloads. Every workload checks its own
+ * result against an independent computation and ends by printing
+ * "<name>: OK ..." and returning 0, or "<name>: FAIL ..." and returning 1,
+ * so a pager that corrupts a page cannot go unnoticed.
+ */
+
+// splitmix64: deterministic, so every run does the same work
+static inline uint64_t rng_next(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline double elapsed_ms(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static inline int report(const char *name, int ok, uint64_t checksum, struct timespec *start) {
+    printf("%s: %s (checksum %016llx, %.1f ms)\n", name, ok ? "OK" : "FAIL",
+           (unsigned long long)checksum, elapsed_ms(start));
+    return ok ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+#include "zeropool.h"
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define SLOT_EMPTY 0
+#define SLOT_READY 1    // allocated and zeroed
+#define SLOT_TAKEN 2    // being moved out by a fault
+
+typedef struct {
+    int prot;
+    char *pages;
+    unsigned char *slots;       // SLOT_* for every page
+    size_t cursor;              // where the next fault starts looking for a ready page
+} zero_pool_t;
+
+// UFFDIO_MOVE only moves pages between mappings of the same protection
+static zero_pool_t pools[ZEROPOOL_MAX_POOLS];
+static int npools;
+static size_t pool_pages;
+
+static uint32_t used;           // zero-fill faults, the futex the refill thread waits on
+static uint32_t used_at_refill;
+static uint32_t refill_sleeping;
+
+int zeropool_open(size_t pages, const int *prots, int nprots) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    pool_pages = pages;
+    for (int i = 0; i < nprots && i < ZEROPOOL_MAX_POOLS; i++) {
+        zero_pool_t *pool = &pools[npools];
+        pool->prot = prots[i];
+        pool->pages = mmap(NULL, pages * page_size + pages, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                           -1, 0);
+        if (pool->pages == MAP_FAILED) {
+            return -1;
+        }
+        // UFFDIO_MOVE takes huge pages only whole; the slots after the pages stay writable
+        madvise(pool->pages, pages * page_size, MADV_NOHUGEPAGE);
+        if (mprotect(pool->pages, pages * page_size, prots[i]) == -1) {
+            return -1;
+        }
+        pool->slots = (unsigned char *)pool->pages + pages * page_size;
+        npools++;
+    }
+    zeropool_refill();
+    // The first fault wakes the refill thread, which starts from there
+    used_at_refill = -(uint32_t)(pages / 2);
+    return 0;
+}
+
+int zeropool_move(int uffd, uintptr_t dst, int prot) {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    zeropool_used();
+    for (int p = 0; p < npools; p++) {
+        zero_pool_t *pool = &pools[p];
+        if (pool->prot != prot) {
+            continue;
+        }
+        size_t start = __atomic_fetch_add(&pool->cursor, 1, __ATOMIC_RELAXED);
+        for (size_t i = 0; i < pool_pages; i++) {
+            size_t s = (start + i) % pool_pages;
+            unsigned char expected = SLOT_READY;
+            if (!__atomic_compare_exchange_n(&pool->slots[s], &expected, SLOT_TAKEN, 0, __ATOMIC_ACQ_REL,
+                                             __ATOMIC_RELAXED)) {
+                continue;
+            }
+            struct uffdio_move move = { .dst = dst, .src = (uintptr_t)pool->pages + s * page_size, .len = page_size };
+            int rc = ioctl(uffd, UFFDIO_MOVE, &move);
+            // Moved or not, refilling the slot is harmless: a page still there stays as it is
+            __atomic_store_n(&pool->slots[s], SLOT_EMPTY, __ATOMIC_RELEASE);
+            return rc == 0 ? 0 : -1;
+        }
+    }
+    return -1;
+}
+
+void zeropool_refill() {
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    for (int p = 0; p < npools; p++) {
+        zero_pool_t *pool = &pools[p];
+        for (size_t s = 0; s < pool_pages; s++) {
+            if (__atomic_load_n(&pool->slots[s], __ATOMIC_ACQUIRE) != SLOT_EMPTY) {
+                continue;
+            }
+            // The kernel hands out a zeroed page for the write
+            *(volatile char *)(pool->pages + s * page_size) = 0;
+            __atomic_store_n(&pool->slots[s], SLOT_READY, __ATOMIC_RELEASE);
+        }
+    }
+    __atomic_store_n(&used_at_refill, __atomic_load_n(&used, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+void zeropool_used() {
+    uint32_t n = __atomic_add_fetch(&used, 1, __ATOMIC_SEQ_CST);
+    if (n - __atomic_load_n(&used_at_refill, __ATOMIC_RELAXED) >= pool_pages / 2 &&
+        __atomic_load_n(&refill_sleeping, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&refill_sleeping, 0, __ATOMIC_RELAXED);
+        syscall(SYS_futex, &used, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+void zeropool_wait(int timeout_ms) {
+    uint32_t n = __atomic_load_n(&used, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&refill_sleeping, 1, __ATOMIC_SEQ_CST);
+    // A fault after `n` was read changes it, and the wait returns at once
+    if (n - __atomic_load_n(&used_at_refill, __ATOMIC_RELAXED) < pool_pages / 2) {
+        struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+        syscall(SYS_futex, &used, FUTEX_WAIT, n, &timeout, NULL, 0);
+    }
+    __atomic_store_n(&refill_sleeping, 0, __ATOMIC_SEQ_CST);
+}
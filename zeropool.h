@@ -0,0 +1,70 @@
+#ifndef ZEROPOOL_H
+#define ZEROPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/userfaultfd.h>
+
+/*
+ * Pre-zeroed pages for zero-fill faults, set by --zero-pool[=PAGES].
+ *
+ * A fault on a page of bss or heap needs a page of zeroes. With userfaultfd
+ * the pager maps the shared zero page, and the guest's first write to it
+ * takes a second fault in which the kernel allocates and zeroes a page. With
+ * the pool, a refill thread keeps PAGES pages allocated and zeroed ahead of
+ * time, and the fault moves one into place with UFFDIO_MOVE: no copy, no
+ * allocation and no second fault while the guest waits. Whenever half the
+ * pool has gone, the fault wakes the refill thread.
+ *
+ * In mprotect mode, moving pages in with mremap would split the segment's
+ * reservation into a mapping per page, so the pool lives in place instead:
+ * the refill thread faults in the next PAGES zero-fill pages after the
+ * guest's latest fault while they are still PROT_NONE, and the fault handler
+ * only has to enable them (see prefault_zero_pages in pager.c).
+ */
+
+#define ZEROPOOL_DEFAULT_PAGES 256
+#define ZEROPOOL_IDLE_MS 100        // the refill thread tops up at least this often
+
+// UFFDIO_MOVE came with Linux 6.8, after the headers of many distributions
+#ifndef UFFDIO_MOVE
+#define UFFD_FEATURE_MOVE (1 << 10)
+#define _UFFDIO_MOVE 0x05
+struct uffdio_move {
+    uint64_t dst;
+    uint64_t src;
+    uint64_t len;
+    uint64_t mode;
+    int64_t move;
+};
+#define UFFDIO_MOVE _IOWR(UFFDIO, _UFFDIO_MOVE, struct uffdio_move)
+#endif
+
+#define ZEROPOOL_MAX_POOLS 4        // protections pooled at once
+
+/**
+ * Maps a pool of `pages` pages for each of the `nprots` protections in
+ * `prots` and fills them: UFFDIO_MOVE only moves a page into a region with
+ * the protection of the one it came from. With no protections only the
+ * refill thread's wakeups are set up, for mprotect mode. Returns 0, or -1 if
+ * a pool cannot be mapped.
+ */
+int zeropool_open(size_t pages, const int *prots, int nprots);
+
+/**
+ * Moves a page from the pool for `prot` to `dst` through `uffd`, waking
+ * whoever faulted on it. Returns 0, or -1 if there is no such pool, it is
+ * empty or the page cannot go there; the fault is then served the usual way.
+ */
+int zeropool_move(int uffd, uintptr_t dst, int prot);
+
+// Allocates and zeroes pages for the slots faults have emptied, if there is a pool
+void zeropool_refill();
+
+// Counts a zero-fill fault, and wakes the refill thread once half the pool is used
+void zeropool_used();
+
+// Sleeps until zeropool_used wakes the refill thread, or for `timeout_ms`
+void zeropool_wait(int timeout_ms);
+
+#endif